@@ -14,6 +14,7 @@ import Model.AE.CAE_home_voxel_3 as CAE_home_voxel_3
 import data_loader_home
 from utility import *
 import numpy as np
+import os
 from torch.autograd import Variable
 import torch
 import torch.nn as nn
@@ -217,6 +218,17 @@ def main(args):
     print('cpp_output:')
     print(cpp_output.mean(axis=0))
 
+    # compare the int8 C++ MLP (written by home_ompl --int8)
+    if os.path.exists("test_sample_output_cpp_int8.txt"):
+        int8_output = np.loadtxt("test_sample_output_cpp_int8.txt")
+        int8_output = int8_output.reshape(100,7)
+        print('cpp int8 output:')
+        print(int8_output.mean(axis=0))
+        print('int8 deviation from python:')
+        print(np.abs(int8_output.mean(axis=0) - mlp_outputs.mean(axis=0)))
+        print('int8 deviation from cpp fp32:')
+        print(np.abs(int8_output.mean(axis=0) - cpp_output.mean(axis=0)))
+
     # compare encoder output
     cpp_output = np.loadtxt('obs_enc_cpp.txt')
     cpp_output = cpp_output.reshape(-1)
@@ -0,0 +1,98 @@
+#ifndef MPNET_BATCHED_MLP_
+#define MPNET_BATCHED_MLP_
+
+#include <torch/torch.h>
+#include <torch/script.h>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** \brief MPNet planning network shared by concurrent planners, with dynamic batching.
+
+    Every planner thread calls predict() with one MLP input (obs_enc followed by the normalized
+    start/goal) and blocks until its output is ready. A batching thread gathers the pending
+    inputs into one forward on the device: a batch is run as soon as \e max_batch inputs are
+    pending, or \e max_wait_us after the first one arrived, whichever comes first.
+
+    The forward uses the Linear/PReLU parameters of the annotated MLP directly instead of its
+    TorchScript forward, whose dropout masks are {1, N} and would be shared by all rows of a
+    batch: here every row draws its own mask, so batching does not correlate the samples of
+    different queries. */
+class BatchedMLP
+{
+public:
+    struct Options
+    {
+        /** \brief largest number of inputs in one forward */
+        int max_batch{32};
+        /** \brief longest time the first input of a batch waits for more inputs */
+        int max_wait_us{500};
+        at::DeviceType device{at::kCPU};
+        /** \brief drop probability used in the annotated forward */
+        float dropout_p{0.5};
+    };
+
+    BatchedMLP(const torch::jit::script::Module& mlp, const Options& options);
+    explicit BatchedMLP(const torch::jit::script::Module& mlp);
+    ~BatchedMLP();
+
+    /** \brief Predict the next state of one input of inputSize() floats into \e output
+        (outputSize() floats). Blocks until the batch containing the input has been run. */
+    void predict(const float* input, float* output);
+
+    /** \brief Predict \e n inputs stored one after the other, queued together so that they are
+        run in the same batch when \e n <= max_batch. Blocks until all outputs are ready. */
+    void predict(const float* inputs, int n, float* outputs);
+
+    int inputSize() const
+    {
+        return input_size_;
+    }
+    int outputSize() const
+    {
+        return output_size_;
+    }
+
+    /** \brief Number of batched forwards run so far */
+    long forwards() const;
+
+    /** \brief Number of inputs predicted so far */
+    long requests() const;
+
+protected:
+    struct Request
+    {
+        const float* input;
+        float* output;
+        std::promise<void> done;
+    };
+
+    struct Layer
+    {
+        torch::Tensor weight;
+        torch::Tensor bias;
+        torch::Tensor prelu; // undefined for the output layer
+        bool dropout{false};
+    };
+
+    void run();
+    void forward(const std::vector<Request*>& batch);
+
+    Options options_;
+    std::vector<Layer> layers_;
+    int input_size_{0};
+    int output_size_{0};
+
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<Request*> pending_;
+    std::thread worker_;
+    bool running_{true};
+    long forwards_{0};
+    long requests_{0};
+};
+
+#endif
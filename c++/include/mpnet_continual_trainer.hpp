@@ -0,0 +1,150 @@
+#ifndef MPNET_CONTINUAL_TRAINER_
+#define MPNET_CONTINUAL_TRAINER_
+
+#include <torch/torch.h>
+#include <torch/script.h>
+#include "mpnet_quantized_mlp.hpp"
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** \brief Background continual learning of the MPNet MLP from solved queries.
+
+    Solution paths (normalized states, see MPNetPlanner::normalize) are queued by the planner
+    and turned into next-state samples the same way data_loader_home.py builds the training set.
+    A worker thread fine-tunes its own copy of the annotated MLP on them with GEM (as in
+    Model/GEM_end2end_model.py): an episodic memory per environment (task) filled by reservoir
+    sampling, and the new gradient projected so that it does not increase the loss on the memory
+    of earlier tasks. Every \e publish_every steps a snapshot of the weights is published; the
+    planner picks it up at the start of its next solve, so solves are never blocked by training.
+    With int8 calibration inputs (setInt8Calibration) the snapshot is also quantized and calibrated
+    when it is published, so planners on the int8 backend only fold their environment into it.
+
+    The obstacle encoder stays frozen: samples carry the obstacle encoding of their environment. */
+class ContinualTrainer
+{
+public:
+    struct Options
+    {
+        /** \brief episodic memory size per task */
+        int n_memories{256};
+        /** \brief margin of the GEM projection */
+        float memory_strength{0.5};
+        /** \brief optimization steps per batch of new samples */
+        int grad_step{1};
+        double learning_rate{0.01};
+        double momentum{0.9};
+        /** \brief training steps between two published snapshots */
+        int publish_every{10};
+        /** \brief new demonstrations kept while the trainer is busy, older ones are dropped */
+        int max_queue{64};
+        /** \brief device used for training, the planner keeps its own device for inference */
+        at::DeviceType device{at::kCPU};
+        /** \brief inference device of the planners; snapshots are moved there before they are published,
+            since they are shared by every planner that takes them */
+        at::DeviceType publish_device{torch::cuda::is_available() ? at::kCUDA : at::kCPU};
+    };
+
+    /** \brief Published snapshot, shared by the planners that take it */
+    struct Published
+    {
+        std::shared_ptr<torch::jit::script::Module> mlp;
+        std::shared_ptr<const QuantizedMLP> qmlp; // nullptr without calibration inputs or above the deviation bound
+        QuantizedMLP::DeviationReport int8_deviation;
+    };
+
+    ContinualTrainer(const std::string& mlp_fname, const Options& options);
+    explicit ContinualTrainer(const std::string& mlp_fname);
+    ~ContinualTrainer();
+
+    void start();
+    void stop();
+
+    /** \brief Queue a solution path of environment \e task. States are normalized
+        (x, y, z, qx, qy, qz, qw), \e obs_enc is the obstacle encoding of the environment. */
+    void addDemonstration(int task, const std::vector<float>& obs_enc, const std::vector<std::vector<float>>& path);
+
+    /** \brief The latest published snapshot if its version is newer than \e version (which is then
+        updated), nullptr otherwise */
+    std::shared_ptr<const Published> takePublished(int& version);
+
+    /** \brief Quantize every snapshot published after this call, calibrated on \e samples (full MLP
+        inputs); the int8 MLP is left out when it deviates more than \e max_deviation */
+    void setInt8Calibration(const std::vector<std::vector<float>>& samples, float max_deviation);
+
+    /** \brief Device of the published MLPs */
+    at::DeviceType publishDevice() const
+    {
+        return options_.publish_device;
+    }
+
+    /** \brief Number of training steps done so far */
+    int steps() const;
+
+    /** \brief Number of steps in which the GEM projection was needed */
+    int projections() const;
+
+    /** \brief Mean loss of the last training step */
+    float lastLoss() const;
+
+protected:
+    struct Demonstration
+    {
+        int task;
+        std::vector<float> obs_enc;
+        std::vector<std::vector<float>> path;
+    };
+
+    struct Memory
+    {
+        std::vector<float> inputs;  // [n][input_size]
+        std::vector<float> labels;  // [n][output_size]
+        int count{0};
+        int seen{0};
+    };
+
+    void run();
+    void train(int task, const std::vector<float>& inputs, const std::vector<float>& labels);
+    void remember(int task, const std::vector<float>& inputs, const std::vector<float>& labels);
+    torch::Tensor loss(const torch::Tensor& inputs, const torch::Tensor& labels);
+    torch::Tensor taskLoss(int task);
+    torch::Tensor flatGrad() const;
+    void setFlatGrad(const torch::Tensor& grad);
+    void publish();
+
+    /** \brief Solve the GEM dual QP min 0.5 v'Pv + q'v, v >= margin by coordinate descent */
+    static std::vector<double> solveDual(const std::vector<double>& P, const std::vector<double>& q, int t,
+                                         double margin);
+
+    Options options_;
+    torch::jit::script::Module mlp_;
+    std::vector<torch::Tensor> params_;
+    std::shared_ptr<torch::optim::SGD> opt_;
+    int input_size_{0};
+    int output_size_{0};
+
+    std::vector<int> observed_tasks_;
+    std::vector<Memory> memories_;
+    std::mt19937 gen_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<Demonstration> queue_;
+    std::thread worker_;
+    bool running_{false};
+
+    std::shared_ptr<const Published> published_;
+    std::vector<std::vector<float>> int8_calib_;
+    float int8_max_deviation_{0.05};
+    int version_{0};
+    int steps_{0};
+    int projections_{0};
+    float last_loss_{0.f};
+};
+
+#endif
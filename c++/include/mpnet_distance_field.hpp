@@ -0,0 +1,118 @@
+#ifndef MPNET_DISTANCE_FIELD_
+#define MPNET_DISTANCE_FIELD_
+
+#include "ompl/base/MotionValidator.h"
+#include "ompl/base/SpaceInformation.h"
+#include "mpnet_voxelizer.hpp"
+#include <iostream>
+#include <memory>
+#include <vector>
+
+/** \brief Lower bounds of the distance to the environment surface, on a grid.
+
+    The surface cells of the mesh (Voxelizer::fromTriangles, grid_size cells per axis over the
+    mesh bounds) are turned into a Euclidean distance transform of the cell centers. Any point
+    of a surface cell is within half a cell diagonal of its center, and any query point is
+    within half a diagonal of the center of its cell, so one diagonal is subtracted from the
+    stored distances: clearance() never overestimates the distance to the surface.
+
+    The environment meshes are not closed, so the distance is unsigned, which is also what the
+    FCL mesh checks see. Outside the grid the clearance is 0. */
+class DistanceField
+{
+public:
+    DistanceField() = default;
+
+    DistanceField(const std::vector<Triangle3>& triangles, int grid_size = 128);
+
+    /** \brief Lower bound of the distance from \e p to the surface */
+    double clearance(const double* p) const;
+
+    bool empty() const
+    {
+        return dist_.empty();
+    }
+
+    int gridSize() const
+    {
+        return n_;
+    }
+
+    void write(std::ostream& out) const;
+    bool read(std::istream& in);
+
+protected:
+    /** \brief squared distance transform along one axis of the grid, with cell spacing \e h */
+    void transformAxis(std::vector<float>& f, int axis, double h) const;
+
+    std::vector<float> lower_;
+    std::vector<double> resolution_;
+    int n_{0};
+    std::vector<float> dist_;
+};
+
+/** \brief Sphere of the robot, in the robot frame */
+struct BoundingSphere
+{
+    Point3 center;
+    float radius;
+};
+
+/** \brief Motion validator for SE3 rigid bodies by conservative advancement in a DistanceField.
+
+    Along the SE3 interpolation of a motion, a point p of the robot moves at most
+    |t2 - t1| + |p| * angle(q1, q2) per unit of interpolation time. At each step the clearance of
+    every bounding sphere divided by that bound is a time the robot can advance without touching
+    the surface, so open space is crossed in a few clearance queries. When the step would be
+    shorter than one segment of the discrete validator (close to the obstacles), the next state
+    at the discrete resolution is checked exactly by the state validity checker (FCL). */
+class DistanceFieldMotionValidator : public ompl::base::MotionValidator
+{
+public:
+    /** \brief Queries of one motion check */
+    struct CheckCounts
+    {
+        unsigned long clearance_queries{0};
+        unsigned long exact_checks{0};
+    };
+
+    DistanceFieldMotionValidator(const ompl::base::SpaceInformationPtr& si, const std::shared_ptr<const DistanceField>& field,
+                                 const std::vector<BoundingSphere>& spheres);
+
+    bool checkMotion(const ompl::base::State* s1, const ompl::base::State* s2) const override;
+    bool checkMotion(const ompl::base::State* s1, const ompl::base::State* s2,
+                     std::pair<ompl::base::State*, double>& lastValid) const override;
+
+    /** \brief Check with validSegmentCount * \e segment_factor segments for the exact fallback (as
+        MPNetPlanner::checkMotion scales the resolution); \e last_valid_time receives the last time
+        known to be valid */
+    bool checkMotion(const ompl::base::State* s1, const ompl::base::State* s2, double segment_factor,
+                     CheckCounts& counts, double* last_valid_time = nullptr) const;
+
+    /** \brief Spheres covering the robot triangles: the triangles are grouped by the cell of their
+        centroid in a \e cells^3 grid over the robot bounds, each group gets the sphere centered in
+        its cell that contains all its vertices. \e shift is subtracted from the vertices, i.e.
+        the robot center the geometry is shifted by (SE3RigidBodyPlanning::getRobotCenter). */
+    static std::vector<BoundingSphere> coverMesh(const std::vector<Triangle3>& triangles, const Point3& shift,
+                                                 int cells = 4);
+
+    const std::shared_ptr<const DistanceField>& getDistanceField() const
+    {
+        return field_;
+    }
+
+    const std::vector<BoundingSphere>& getSpheres() const
+    {
+        return spheres_;
+    }
+
+protected:
+    /** \brief Interpolation time the robot can move from \e state without touching the surface, for
+        a motion of \e translation and \e angle per unit time */
+    double safeStep(const ompl::base::State* state, double translation, double angle) const;
+
+    std::shared_ptr<const DistanceField> field_;
+    std::vector<BoundingSphere> spheres_;
+};
+
+#endif
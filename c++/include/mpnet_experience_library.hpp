@@ -0,0 +1,68 @@
+#ifndef MPNET_EXPERIENCE_LIBRARY_
+#define MPNET_EXPERIENCE_LIBRARY_
+
+#include "ompl/datastructures/NearestNeighborsGNAT.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/** \brief Solved paths of one environment, indexed by their start and goal.
+
+    The key of a path is its normalized start and goal (2 x (x, y, z, qx, qy, qz, qw), see
+    MPNetPlanner::normalize) and lookups are nearest neighbor queries in a GNAT over the keys.
+    The distance is the Euclidean distance of the positions plus the distance of the orientations
+    up to the sign of the quaternions, which is a metric as GNAT requires. Paths are stored
+    unnormalized, so they can be turned back into states directly.
+
+    The library is saved as a text file, one experience per block: the number of states, the key,
+    then one state per line. It can be shared by several planners of the same environment. */
+class ExperienceLibrary
+{
+public:
+    struct Experience
+    {
+        std::vector<float> key;
+        std::vector<std::vector<float>> path;
+    };
+
+    /** \brief Load the experiences in \e fname if it exists; save() writes them back there */
+    explicit ExperienceLibrary(const std::string& fname = "");
+
+    bool load(const std::string& fname);
+    bool save(const std::string& fname) const;
+    bool save() const;
+
+    /** \brief Store a path, unless an experience with a key closer than \e min_spacing is stored already */
+    void add(const std::vector<float>& key, const std::vector<std::vector<float>>& path, double min_spacing = 0.);
+
+    /** \brief The stored experience closest to \e key, if its distance is at most \e max_distance.
+        Without \e count the lookup is left out of the stats, see reportLookup(). */
+    bool nearest(const std::vector<float>& key, double max_distance, Experience& res, bool count = true);
+
+    /** \brief Count a lookup made with nearest(..., false), e.g. once for the attempts of a portfolio */
+    void reportLookup(bool candidate);
+
+    /** \brief Count a retrieved experience that was (or was not) repaired into a solution */
+    void reportRepair(bool repaired);
+
+    std::size_t size() const;
+
+    /** \brief Number of lookups, of lookups that returned a candidate, and of repaired candidates */
+    void getStats(int& lookups, int& candidates, int& repaired) const;
+
+    static double keyDistance(const std::vector<float>& a, const std::vector<float>& b);
+
+protected:
+    void insert(const std::shared_ptr<Experience>& experience);
+
+    std::string fname_;
+    std::vector<std::shared_ptr<Experience>> experiences_;
+    ompl::NearestNeighborsGNAT<Experience*> nn_;
+    mutable std::mutex mutex_;
+    int lookups_{0};
+    int candidates_{0};
+    int repaired_{0};
+};
+
+#endif
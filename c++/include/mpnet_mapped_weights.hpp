@@ -0,0 +1,112 @@
+#ifndef MPNET_MAPPED_WEIGHTS_
+#define MPNET_MAPPED_WEIGHTS_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+/** \brief Read-only file of named arrays (the native weight format), mapped into memory and used in
+    place.
+
+    The arrays start at 64 byte boundaries, and arrays of a page or more at page boundaries, so the
+    native kernels can read them with aligned vector loads straight from the mapping. The mapping is
+    shared and read-only: planner processes that map the same file share one copy of the weights in
+    the page cache, and pages that a process never reads (e.g. the fp32 reference of the int8
+    layers) take no memory in it. Where mmap is not available, or with \e copy, the file is read
+    into private memory instead.
+
+    Layout: "MPNW", version, number of arrays, then one entry per array (name of up to 47
+    characters, type, element count, offset) and the array data, little-endian. */
+class MappedWeights
+{
+public:
+    enum Type
+    {
+        FLOAT32 = 0,
+        INT8 = 1,
+        INT32 = 2
+    };
+
+    /** \brief Arrays collected in memory and written as a weight file; the data is copied by add() */
+    class Writer
+    {
+    public:
+        void add(const std::string& name, const float* data, std::size_t count);
+        void add(const std::string& name, const int8_t* data, std::size_t count);
+        void add(const std::string& name, const int32_t* data, std::size_t count);
+        bool save(const std::string& fname) const;
+
+    protected:
+        struct Array
+        {
+            Type type;
+            std::size_t count;
+            std::vector<char> bytes;
+        };
+        void add(const std::string& name, Type type, const void* data, std::size_t count, std::size_t size);
+        std::map<std::string, Array> arrays_;
+    };
+
+    /** \brief Map \e fname; throws std::runtime_error when it cannot be read or is not a weight file */
+    explicit MappedWeights(const std::string& fname, bool copy = false);
+    ~MappedWeights();
+
+    MappedWeights(const MappedWeights&) = delete;
+    MappedWeights& operator=(const MappedWeights&) = delete;
+
+    bool has(const std::string& name) const
+    {
+        return arrays_.count(name) > 0;
+    }
+
+    /** \brief Array \e name of type \e type and its element count; throws std::runtime_error when the
+        file has no such array */
+    const void* get(const std::string& name, Type type, std::size_t* count = nullptr) const;
+
+    const float* getFloat(const std::string& name, std::size_t* count = nullptr) const
+    {
+        return static_cast<const float*>(get(name, FLOAT32, count));
+    }
+    const int8_t* getInt8(const std::string& name, std::size_t* count = nullptr) const
+    {
+        return static_cast<const int8_t*>(get(name, INT8, count));
+    }
+    const int32_t* getInt32(const std::string& name, std::size_t* count = nullptr) const
+    {
+        return static_cast<const int32_t*>(get(name, INT32, count));
+    }
+
+    /** \brief false when the file was read into private memory */
+    bool isMapped() const
+    {
+        return mapped_;
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    static constexpr std::size_t PAGE = 4096;
+    static constexpr std::size_t ALIGNMENT = 64;
+
+protected:
+    struct Array
+    {
+        Type type;
+        std::size_t count;
+        std::size_t offset;
+    };
+
+    void unmap();
+
+    const char* data_{nullptr};
+    std::size_t size_{0};
+    bool mapped_{false};
+    std::vector<char> buffer_; // private copy when the file is not mapped
+    std::map<std::string, Array> arrays_;
+};
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef MPNET_MLP_LAYERS_
+#define MPNET_MLP_LAYERS_
+
+#include <torch/torch.h>
+#include <torch/script.h>
+#include <string>
+#include <vector>
+
+/** \brief Linear layer of the annotated TorchScript MLP and the PReLU that follows it */
+struct MLPLayerParams
+{
+    torch::Tensor weight; // [out][in]
+    torch::Tensor bias;   // [out]
+    torch::Tensor prelu;  // 1 or out values, undefined for the output layer
+    bool dropout{false};  // dropout is applied to the output of this layer
+};
+
+/** \brief The Linear/PReLU parameters of the annotated TorchScript MLP (fc1 ... fcN), detached and
+    contiguous on \e device. Throws std::runtime_error, prefixed with \e owner, when they do not
+    form a chain of at least two Linear layers with their biases. */
+std::vector<MLPLayerParams> mlpLayerParams(const torch::jit::script::Module& mlp, at::DeviceType device,
+                                           const std::string& owner);
+
+#endif
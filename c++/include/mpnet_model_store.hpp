@@ -0,0 +1,85 @@
+#ifndef MPNET_MODEL_STORE_
+#define MPNET_MODEL_STORE_
+
+#include <torch/torch.h>
+#include <torch/script.h>
+#include "mpnet_quantized_mlp.hpp"
+#include <atomic>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/** \brief The current encoder/MLP pair of a long-running process, replaced without stopping the
+    planners that use it.
+
+    A model is immutable once published. Publishing loads the networks and encodes the registered
+    environments on the calling thread (or the thread of loadAsync), then swaps the shared pointer
+    to the current model atomically and bumps the version. Planners compare the version at the
+    start of each solve and take the new model then (MPNetPlanner::setModelStore), so a solve that
+    is running finishes on the weights it started with and predictions never wait for the store.
+    A model is freed when the store and the last planner holding it have moved on.
+
+    With int8 calibration inputs (setInt8Calibration) the publisher also quantizes and calibrates
+    the MLP, so planners on the int8 backend only fold their environment into it. */
+class ModelStore
+{
+public:
+    /** \brief Published networks; \e environments are the registered voxel grids with their obs_enc */
+    struct Model
+    {
+        int version{0};
+        std::shared_ptr<torch::jit::script::Module> encoder;
+        std::shared_ptr<torch::jit::script::Module> mlp;
+        at::DeviceType mlp_device{at::kCPU};
+        std::map<int, std::pair<std::vector<float>, at::Tensor>> environments;
+        std::shared_ptr<const QuantizedMLP> qmlp; // nullptr without calibration inputs or above the deviation bound
+        QuantizedMLP::DeviationReport int8_deviation;
+    };
+
+    explicit ModelStore(at::DeviceType mlp_device = torch::cuda::is_available() ? at::kCUDA : at::kCPU);
+
+    /** \brief Load and publish the networks in the given files and return the new version. Throws
+        when a file cannot be loaded, the current model stays then. */
+    int load(const std::string& encoder_fname, const std::string& mlp_fname);
+
+    /** \brief load() on a thread of its own, the future rethrows its exception */
+    std::future<int> loadAsync(const std::string& encoder_fname, const std::string& mlp_fname);
+
+    /** \brief Publish networks that are loaded already; the MLP is moved to the device of the store */
+    int publish(const std::shared_ptr<torch::jit::script::Module>& encoder,
+                const std::shared_ptr<torch::jit::script::Module>& mlp);
+
+    /** \brief Quantize the MLP of every model published after this call, calibrated on \e samples
+        (full MLP inputs); the int8 MLP is left out when it deviates more than \e max_deviation */
+    void setInt8Calibration(const std::vector<std::vector<float>>& samples, float max_deviation);
+
+    /** \brief Register the voxel grid of environment \e env_id, encoded by every model published after
+        this call. The current model is not changed. */
+    void setEnvironment(int env_id, const std::vector<float>& voxels);
+
+    /** \brief The current model, nullptr before the first publish */
+    std::shared_ptr<const Model> current() const
+    {
+        return std::atomic_load(&model_);
+    }
+
+    /** \brief Version of the current model, 0 before the first publish */
+    int version() const
+    {
+        return version_.load(std::memory_order_acquire);
+    }
+
+protected:
+    at::DeviceType mlp_device_;
+    std::shared_ptr<const Model> model_; // only accessed with std::atomic_load and std::atomic_store
+    std::atomic<int> version_{0};
+    std::mutex publish_mutex_; // publishers one at a time, and the registered environments
+    std::map<int, std::vector<float>> environments_;
+    std::vector<std::vector<float>> int8_calib_;
+    float int8_max_deviation_{0.05};
+};
+
+#endif
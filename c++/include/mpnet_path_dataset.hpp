@@ -0,0 +1,61 @@
+#ifndef MPNET_PATH_DATASET_
+#define MPNET_PATH_DATASET_
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+/** \brief Packed binary file of demonstration paths, appended to by several threads.
+
+    The file starts with "MPPD" and the version, followed by one record per path: the environment
+    id, the path index (the N of paths/path_N.txt), the number of states and the states
+    (x, y, z, qx, qy, qz, qw), all 32-bit. A path with fewer than two states records a query that
+    was not solved, so that it is not attempted again; the loaders skip it like a short text path.
+
+    Records are written whole and flushed, so after an interruption only the last one can be
+    incomplete. Opening the file drops it and returns the records that are there, which is how
+    a generator resumes. */
+class PathDataset
+{
+public:
+    struct Record
+    {
+        int32_t env_id;
+        int32_t index;
+        std::vector<std::vector<float>> path;
+    };
+
+    /** \brief Open \e fname for appending, creating it if needed. A file that is not a dataset is
+        left alone and isOpen() is false. */
+    explicit PathDataset(const std::string& fname);
+
+    bool isOpen() const
+    {
+        return out_.is_open();
+    }
+
+    /** \brief Whether a record of this environment and path index is in the file */
+    bool contains(int env_id, int index) const;
+
+    void append(const Record& record);
+
+    /** \brief Number of records in the file */
+    std::size_t size() const;
+
+    /** \brief Read the complete records of \e fname; false if it is not a dataset */
+    static bool read(const std::string& fname, std::vector<Record>& records);
+
+protected:
+    /** \brief read() that also returns the end of the last complete record */
+    static bool read(const std::string& fname, std::vector<Record>& records, std::streamoff& valid_end);
+
+    std::ofstream out_;
+    std::set<std::pair<int, int>> done_;
+    mutable std::mutex mutex_;
+};
+
+#endif
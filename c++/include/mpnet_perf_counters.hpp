@@ -0,0 +1,108 @@
+#ifndef MPNET_PERF_COUNTERS_
+#define MPNET_PERF_COUNTERS_
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/** \brief Hardware counters of the planner phases, sampled with perf_event_open around every
+    TraceSpan while enabled.
+
+    Each thread opens its own counter group (cycles, instructions, last level cache misses and
+    branch misses, user space only) on its first span, and adds the counts of each span to the
+    totals of its phase. When the thread exits, its totals are folded into the recorder and its
+    group is closed, so the threads of benchmark runs and portfolio attempts do not pile up. Nested phases are included in the counts of the enclosing ones, and only
+    the thread that runs a span is counted, not e.g. the intra-op threads of libtorch. Reading the
+    group is a system call per span boundary, so the counts of short phases include some of that
+    overhead.
+
+    Where perf_event_open is not available (other systems, perf_event_paranoid, containers without
+    the capability), enable() returns false and the spans are not sampled; counters the CPU does
+    not have are reported as unavailable and stay 0. */
+class PerfRecorder
+{
+public:
+    enum Counter
+    {
+        CYCLES = 0,
+        INSTRUCTIONS = 1,
+        LLC_MISSES = 2,
+        BRANCH_MISSES = 3,
+        NUM_COUNTERS = 4
+    };
+
+    /** \brief Counts of one phase, summed over its spans */
+    struct PhaseCounts
+    {
+        uint64_t calls{0};
+        uint64_t values[NUM_COUNTERS]{0, 0, 0, 0};
+    };
+
+    static PerfRecorder& instance();
+
+    /** \brief Start sampling the spans; false (and disabled) when the counters cannot be opened */
+    bool enable(bool enabled);
+
+    bool enabled() const
+    {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    /** \brief Whether \e counter could be opened on the thread that enabled the recorder */
+    bool available(Counter counter) const
+    {
+        return available_[counter];
+    }
+
+    static const char* counterName(Counter counter);
+
+    /** \brief Totals per phase of all threads since the last reset */
+    std::map<std::string, PhaseCounts> totals() const;
+
+    /** \brief Clear the totals, e.g. at the start of a query */
+    void reset();
+
+    /** \brief Current counts of the calling thread, false if its counters are not open */
+    bool read(uint64_t* values);
+
+    /** \brief Add the counts between \e start and \e end of the calling thread to \e phase */
+    void add(const char* phase, const uint64_t* start, const uint64_t* end);
+
+protected:
+    struct ThreadCounters
+    {
+        int leader{-1};
+        std::vector<int> fds;
+        int slot[NUM_COUNTERS]{-1, -1, -1, -1}; // position of each counter in the group read, -1 if not open
+        std::map<const char*, PhaseCounts> phases; // keyed by the span names, which are literals
+        std::mutex mutex; // totals() reads the phases of other threads
+        ~ThreadCounters();
+    };
+
+    /** \brief owner of the counters of a thread, retires them when the thread exits */
+    struct ThreadOwner
+    {
+        std::unique_ptr<ThreadCounters> counters;
+        ~ThreadOwner();
+    };
+
+    PerfRecorder() = default;
+    ThreadCounters* counters();
+    /** \brief fold the phases of an exiting thread into finished_ and forget the thread */
+    void retire(ThreadCounters* counters);
+    /** \brief open the counter group of the calling thread */
+    static void open(ThreadCounters& counters);
+
+    std::atomic<bool> enabled_{false};
+    bool available_[NUM_COUNTERS]{false, false, false, false};
+    mutable std::mutex mutex_; // guards the list of threads and finished_
+    std::vector<ThreadCounters*> threads_; // running threads, owned by their ThreadOwner
+    std::map<std::string, PhaseCounts> finished_; // totals of the threads that exited
+
+};
+
+#endif
@@ -5,6 +5,19 @@
 #include "ompl/datastructures/NearestNeighbors.h"
 #include <torch/torch.h>
 #include <torch/script.h>
+#include <chrono>
+#include <future>
+#include <map>
+#include <random>
+#include "mpnet_quantized_mlp.hpp"
+#include "mpnet_voxel_encoder.hpp"
+#include "mpnet_continual_trainer.hpp"
+#include "mpnet_batched_mlp.hpp"
+#include "mpnet_experience_library.hpp"
+#include "mpnet_distance_field.hpp"
+#include "mpnet_replay_log.hpp"
+#include "mpnet_replan_schedule.hpp"
+#include "mpnet_model_store.hpp"
 
 
 using namespace ompl;
@@ -13,9 +26,49 @@ typedef std::vector<ompl::base::State *> StatePtrVec;
 class MPNetPlanner : public base::Planner
 {
 public:
+    /** \brief Backend used to encode the obstacle grid into obs_enc */
+    enum EncoderBackend
+    {
+        /** \brief the annotated TorchScript encoder */
+        TORCH_ENCODER,
+        /** \brief VoxelEncoder on the CPU, bit-packed for binary grids; its weights come from the
+            TorchScript encoder */
+        NATIVE_ENCODER
+    };
+
+    /** \brief Files and warm-up of the planner startup */
+    struct StartupOptions
+    {
+        std::string encoder_fname{"../encoder_annotated_test_cpu_2.pt"};
+        std::string mlp_fname{"../mlp_annotated_test_gpu_2.pt"};
+        std::string voxel_fname{"../obs_voxel.txt"};
+        /** \brief binary snapshot of the voxel grid and its encoding (see saveSnapshot). When it can be
+            read, the voxel text file is not parsed and the encoder is not run at startup. */
+        std::string snapshot_fname{""};
+        /** \brief MLP forwards run at startup, so that the first prediction does not pay for the
+            graph optimization of the TorchScript executor and the CUDA context setup */
+        int warm_up_runs{2};
+        /** \brief false to start without the networks and the voxel grid, for replaying a
+            ReplayLog with REPLAY_INFERENCE (see setReplayLog) on a machine without the models */
+        bool load_networks{true};
+        /** \brief encoder of the voxel grid at startup and in setObstacleVoxels (see setEncoderBackend) */
+        EncoderBackend encoder_backend{TORCH_ENCODER};
+        /** \brief native weight file (see exportWeights). When it can be mapped, the planner runs the
+            int8 MLP on the mapped weights, shared with the other processes that map the file, and
+            starts from its environment like from a snapshot; the TorchScript MLP is not loaded. */
+        std::string weights_fname{""};
+        /** \brief false when the predictions go through an MLP shared with other planners (see
+            setBatchedMLP): the encoder and the environment are loaded, the TorchScript MLP is not */
+        bool load_mlp{true};
+    };
+
     /** \brief Constructor */
     MPNetPlanner(const base::SpaceInformationPtr &si, bool addIntermediateStates = false, int max_replan = 1001, int max_length = 3000);
 
+    /** \brief Constructor with the given startup files. The networks and the environment are loaded in parallel. */
+    MPNetPlanner(const base::SpaceInformationPtr &si, bool addIntermediateStates, int max_replan, int max_length,
+                 const StartupOptions& startup);
+
     ~MPNetPlanner() override;
     void q_to_axis_angle(float q0, float q1, float q2, float q3, std::vector<float>& res);
     void getPlannerData(base::PlannerData &data) const override;
@@ -74,6 +127,319 @@ public:
 
     void setup() override;
 
+    /** \brief Lazy collision checking: the neural rollouts and lvc only check motions at the coarse
+        \e coarse_resolution (fraction of the space extent), every segment of the contracted path is
+        then checked at full resolution once, and only the failing ones are replanned. */
+    void setLazyCollisionChecking(bool lazy, double coarse_resolution = 0.08)
+    {
+        _lazy = lazy;
+        _lazy_resolution = coarse_resolution;
+    }
+
+    /** \brief setLazyCollisionChecking with the default coarse resolution (the "lazy" planner parameter) */
+    void setLazy(bool lazy)
+    {
+        setLazyCollisionChecking(lazy);
+    }
+
+    bool getLazy() const
+    {
+        return _lazy;
+    }
+
+    /** \brief Connect the bidirectional neural rollouts through any of the \e k nearest nodes of the
+        opposite tree, tried nearest first after each extension, instead of only the two newest
+        nodes (k = 0). The multi-start rollouts do the same within every start/goal pair. */
+    void setConnectNearest(int k)
+    {
+        _connect_k = k;
+    }
+
+    int getConnectNearest() const
+    {
+        return _connect_k;
+    }
+
+    /** \brief Wall time, in seconds, one neural_replanner call (the local replanning of one segment)
+        may take before the segment is left unconnected for the next iteration, so that a hopeless
+        segment does not use up the time of the solve. 0 for no limit. */
+    void setSegmentTimeLimit(double seconds)
+    {
+        _segment_time_limit = seconds;
+    }
+
+    double getSegmentTimeLimit() const
+    {
+        return _segment_time_limit;
+    }
+
+    /** \brief Largest number of goal states sampled from a goal region (GoalStates, GoalLazySamples, ...).
+        With several starts or goals, the rollouts of all start/goal pairs are run together, their
+        predictions batched into one MLP forward per step, and solve() continues with the first
+        pair that connects. */
+    void setMaxGoalSamples(int n)
+    {
+        _max_goal_samples = n;
+    }
+
+    int getMaxGoalSamples() const
+    {
+        return _max_goal_samples;
+    }
+
+    /** \brief Portfolio mode: solve() runs \e attempts independent replanning attempts on their own
+        threads and returns the first feasible path, stopping the other attempts. The attempts
+        share the networks and obs_enc of this planner; each has its own dropout generator,
+        states and solve counters. 1 disables the portfolio. */
+    void setPortfolio(int attempts)
+    {
+        _portfolio = attempts;
+    }
+
+    int getPortfolio() const
+    {
+        return _portfolio;
+    }
+
+    /** \brief Index of the attempt that produced the solution of the last portfolio solve, -1 if none */
+    int getPortfolioWinner() const
+    {
+        return _portfolio_winner;
+    }
+
+    /** \brief Mean number of rollout iterations of the connected neural_replanner calls of the last solve */
+    double getMeanConnectIterations() const
+    {
+        return _connect_calls > 0 ? (double)_connect_iterations / _connect_calls : 0.;
+    }
+
+    /** \brief Number of state validity checks of the last solve */
+    unsigned long getCollisionChecks() const
+    {
+        return _collision_checks;
+    }
+
+    /** \brief Memoize the MLP outputs of a solve by their start/goal input, quantized to \e quantum
+        (normalized units). Once \e pool_size outputs were predicted for an input, the later
+        predictions for it are served from them in turn instead of running the MLP: 1 for models
+        without dropout, more to keep some of the stochastic samples of the dropout models.
+        0 disables the cache. */
+    void setPredictionCache(int pool_size, double quantum = 1e-4)
+    {
+        _cache_pool = pool_size;
+        _cache_quantum = quantum;
+    }
+
+    int getPredictionCachePool() const
+    {
+        return _cache_pool;
+    }
+
+    /** \brief Fraction of the predictions of the last solve served from the prediction cache */
+    double getPredictionCacheHitRate() const
+    {
+        return _cache_lookups > 0 ? (double)_cache_hits / _cache_lookups : 0.;
+    }
+
+    /** \brief Backend used by mpnet_predict to run the planning network */
+    enum MLPBackend
+    {
+        /** \brief the annotated TorchScript MLP (on the GPU when available) */
+        TORCH_MLP,
+        /** \brief post-training int8 MLP on the CPU */
+        INT8_MLP
+    };
+
+    /** \brief Select the MLP backend. For INT8_MLP the activation scales are calibrated on the
+        recorded MLP inputs in \e calib_fname (see saveMLPInputs); the quantized model is only
+        accepted when its output deviates from fp32 by at most \e max_deviation on those inputs.
+        Returns false and keeps the TorchScript backend otherwise. */
+    bool setMLPBackend(MLPBackend backend, const std::string& calib_fname = "", float max_deviation = 0.05);
+
+    MLPBackend getMLPBackend() const
+    {
+        return _mlp_backend;
+    }
+
+    /** \brief Report of the last accepted or rejected int8 calibration */
+    const QuantizedMLP::DeviationReport& getInt8Deviation() const
+    {
+        return _int8_deviation;
+    }
+
+    /** \brief Record every MLP input (obs_enc followed by start/goal) for later calibration */
+    void setRecordMLPInputs(bool record)
+    {
+        _record_mlp_inputs = record;
+    }
+
+    /** \brief Write the recorded MLP inputs, one sample per line */
+    void saveMLPInputs(const std::string& fname) const;
+
+    /** \brief Fine-tune the MLP in the background from the solutions of this planner. The solutions
+        are stored as demonstrations of environment \e env_id; weights published by the trainer are
+        picked up at the start of the next solve. */
+    void setContinualTrainer(const std::shared_ptr<ContinualTrainer>& trainer, int env_id = 0)
+    {
+        _trainer = trainer;
+        _env_id = env_id;
+        if (_trainer && _mlp_backend == INT8_MLP)
+            _trainer->setInt8Calibration(_int8_calib, _int8_max_deviation);
+    }
+
+    /** \brief Run the TorchScript MLP through an MLP shared with other planners, which batches the
+        predictions of concurrent solves (see PlanningService). nullptr restores the own MLP. */
+    void setBatchedMLP(const std::shared_ptr<BatchedMLP>& mlp)
+    {
+        _batched_mlp = mlp;
+    }
+
+    /** \brief Use the networks and the environment of \e other, a planner of the same environment in
+        this process, instead of loading them (e.g. a planner started without networks) */
+    void shareNetworks(const MPNetPlanner& other);
+
+    /** \brief Warm-start solve() from the closest path of \e library: when a stored query is within
+        \e max_distance (ExperienceLibrary::keyDistance of the normalized start/goal), its path with
+        the actual start and goal is repaired by neural_replan and lvc; if that fails, planning
+        starts over from {start, goal}. Solutions are added to the library unless a query closer
+        than \e min_spacing is stored already. */
+    void setExperienceLibrary(const std::shared_ptr<ExperienceLibrary>& library, double max_distance = 0.2,
+                              double min_spacing = 0.01)
+    {
+        _experience = library;
+        _experience_max_distance = max_distance;
+        _experience_min_spacing = min_spacing;
+    }
+
+    /** \brief Choose the rollout budget and checking resolution of each replanning iteration with
+        \e schedule, which learns from the iterations of the solves, instead of the fixed schedule.
+        nullptr restores the fixed schedule. */
+    void setReplanSchedule(const std::shared_ptr<ReplanSchedule>& schedule)
+    {
+        _schedule = schedule;
+    }
+
+    const std::shared_ptr<ReplanSchedule>& getReplanSchedule() const
+    {
+        return _schedule;
+    }
+
+    /** \brief Take the networks from \e store: every solve starts on its current model, the environment
+        re-encoded by the new encoder (by the store for environment \e env_id, unless the grid changed
+        since it was registered). The current grid of the planner is registered as \e env_id, and on the
+        int8 backend its calibration inputs, so the store publishes the int8 MLP ready to use. A
+        running solve keeps its model. */
+    void setModelStore(const std::shared_ptr<ModelStore>& store, int env_id = 0);
+
+    int getModelVersion() const
+    {
+        return _model_version;
+    }
+
+    /** \brief Feed a path found by another planner (e.g. a fallback planner) to the trainer */
+    void addDemonstration(const std::vector<base::State*>& path);
+
+    /** \brief Run \e runs MLP forwards on the active environment */
+    void warmUp(int runs);
+
+    /** \brief Check motions by conservative advancement in the distance field of the environment,
+        with the robot covered by \e spheres (see DistanceFieldMotionValidator). The field and the
+        spheres are saved in the snapshot. nullptr restores the discrete checks. */
+    void setDistanceField(const std::shared_ptr<const DistanceField>& field, const std::vector<BoundingSphere>& spheres);
+
+    const std::shared_ptr<DistanceFieldMotionValidator>& getDistanceFieldValidator() const
+    {
+        return _sdf_validator;
+    }
+
+    /** \brief Number of distance field queries of the last solve */
+    unsigned long getClearanceQueries() const
+    {
+        return _clearance_queries;
+    }
+
+    /** \brief Record every solve into \e log (mode ReplayLog::RECORD), or replay the queries of
+        \e log in order, one per solve, with the predictions and/or the collision checks served
+        from it (ReplayLog::Mode flags). Checks that leave the log run live, as do predictions
+        when the networks are loaded; without them the rollouts step to their goal. Portfolio
+        attempts run without the log. nullptr stops recording and replaying. */
+    void setReplayLog(const std::shared_ptr<ReplayLog>& log, int mode)
+    {
+        _replay_log = log;
+        _replay_mode = mode;
+    }
+
+    const std::shared_ptr<ReplayLog>& getReplayLog() const
+    {
+        return _replay_log;
+    }
+
+    /** \brief Save the voxel grid and obs_enc of the active environment for StartupOptions::snapshot_fname,
+        followed by the distance field if one is set */
+    bool saveSnapshot(const std::string& fname) const;
+
+    /** \brief Write the calibrated int8 MLP and the active environment in the native weight format
+        for StartupOptions::weights_fname; false without a calibrated int8 MLP */
+    bool exportWeights(const std::string& fname) const;
+
+    /** \brief Time spent in the constructor, in seconds */
+    double getStartupTime() const
+    {
+        return _startup_time;
+    }
+
+    /** \brief Select the encoder of setObstacleVoxels. With NATIVE_ENCODER the grid is encoded by
+        the VoxelEncoder that updateObstacles also uses, so that its activations are kept. */
+    void setEncoderBackend(EncoderBackend backend)
+    {
+        _encoder_backend = backend;
+    }
+
+    EncoderBackend getEncoderBackend() const
+    {
+        return _encoder_backend;
+    }
+
+    /** \brief Replace the obstacle grid ({1,1,32,32,32}, x major, e.g. built by Voxelizer) and re-encode it */
+    void setObstacleVoxels(const std::vector<float>& voxels);
+
+    /** \brief Apply a sparse set of voxel changes to the active environment. Only the encoder
+        activations whose receptive field contains a changed voxel are recomputed (native encoder,
+        built on the first call), then obs_enc and the int8 MLP environment bias are refreshed. */
+    void updateObstacles(const std::vector<VoxelFlip>& flips);
+
+    /** \brief Axis-aligned box of the workspace in which obstacles moved, appeared or disappeared.
+        \e margin is the radius of a sphere around the robot origin that contains the robot. */
+    struct ChangedRegion
+    {
+        std::vector<double> low{0., 0., 0.};
+        std::vector<double> high{0., 0., 0.};
+        double margin{0.};
+    };
+
+    /** \brief Repair \e previous, a solution planned before the obstacles in \e region changed, into
+        \e result instead of solving again from its start and goal. Only the segments whose swept
+        volume can reach the region are checked again, the invalid ones are replanned by
+        neural_replanner until they are valid, then lvc shortens each repaired span between its
+        unchanged neighbors. The collision checker and obs_enc (updateObstacles) have to describe
+        the changed environment already. Returns an exact solution when every segment is valid,
+        otherwise the path up to its first invalid segment as an approximate one. Repairs are not
+        recorded into the replay log. */
+    base::PlannerStatus repair(const geometric::PathGeometric& previous, const ChangedRegion& region,
+                               const base::PlannerTerminationCondition& ptc, geometric::PathGeometric& result);
+
+    /** \brief Number of segments of the last repair checked again because they reach the changed region */
+    unsigned int getRepairCheckedSegments() const
+    {
+        return _repair_checked;
+    }
+
+    /** \brief Number of segments of the last repair replanned by neural_replanner */
+    unsigned int getRepairReplannedSegments() const
+    {
+        return _repair_replanned;
+    }
+
 protected:
     /** \brief Representation of a motion
         This only contains pointers to parent motions as we
@@ -81,19 +447,126 @@ protected:
     int _max_replan;
     int _max_length;
     at::Tensor obs_enc; // two dimensional or one dimensional
+    std::vector<float> _obs_voxel; // the {1,1,32,32,32} voxel grid obs_enc was computed from
+    std::shared_ptr<VoxelEncoder> _voxel_encoder;
+    EncoderBackend _encoder_backend{TORCH_ENCODER};
     std::shared_ptr<torch::jit::script::Module> encoder;
+    std::shared_future<std::shared_ptr<torch::jit::script::Module>> _encoder_loading;
+    double _startup_time{0.};
     std::shared_ptr<torch::jit::script::Module> MLP;
+    at::DeviceType _mlp_device;
+    MLPBackend _mlp_backend{TORCH_MLP};
+    std::shared_ptr<QuantizedMLP> _qmlp;
+    QuantizedMLP::DeviationReport _int8_deviation;
+    std::vector<std::vector<float>> _int8_calib;
+    float _int8_max_deviation{0.05};
+    std::mt19937 _dropout_gen;
+    std::shared_ptr<BatchedMLP> _batched_mlp;
+    std::shared_ptr<ContinualTrainer> _trainer;
+    std::shared_ptr<ExperienceLibrary> _experience;
+    double _experience_max_distance{0.2};
+    double _experience_min_spacing{0.01};
+    std::shared_ptr<ReplanSchedule> _schedule;
+    std::shared_ptr<ModelStore> _model_store;
+    int _model_version{0}; // version of the model store the networks come from, 0 for the startup files
+    int _env_id{0};
+    int _mlp_version{0};
+    bool _record_mlp_inputs{false};
+    std::vector<std::vector<float>> _mlp_inputs;
+    bool _lazy{false};
+    double _lazy_resolution{0.08};
+    double _check_resolution{0.01}; // resolution of the motion checks of the current iteration
+    unsigned long _collision_checks{0};
+    std::shared_ptr<DistanceFieldMotionValidator> _sdf_validator;
+    unsigned long _clearance_queries{0};
+    std::shared_ptr<ReplayLog> _replay_log;
+    int _replay_mode{ReplayLog::RECORD};
+    int _connect_k{0};
+    int _max_goal_samples{16};
+    int _portfolio{1};
+    int _portfolio_winner{-1};
+    bool _portfolio_attempt{false}; // attempts leave the trainer and the library to the planner that runs them
+    bool _experience_lookup{false}; // the last solve looked up the library (counted by the portfolio for its attempts)
+    bool _experience_candidate{false};
+    int _experience_repaired{-1}; // -1 when no retrieved path was repaired
+    const base::PlannerTerminationCondition* _ptc{nullptr}; // termination condition of the running solve
+    bool _stop_requested{false}; // _ptc was seen to fire
+    unsigned int _stop_polls{0};
+    double _segment_time_limit{0.};
+    int _cache_pool{0};
+    double _cache_quantum{1e-4};
+    std::map<std::vector<int64_t>, std::pair<std::vector<float>, unsigned int>> _prediction_cache; // outputs, next served
+    unsigned long _cache_lookups{0};
+    unsigned long _cache_hits{0};
+    long _connect_iterations{0};
+    long _connect_calls{0};
+    long _connect_failures{0}; // neural_replanner calls that did not connect
+    unsigned int _repair_checked{0};
+    unsigned int _repair_replanned{0};
+    std::map<std::vector<float>, bool> _segment_cache; // segments checked at full resolution in this solve
     std::vector<float> lower_bound = {-383.8, -371.47, -0.2};
     std::vector<float> upper_bound = {325, 337.89, 142.33};
     std::vector<float> bound = {0., 0., 0.};
+    /** \brief Planner of one portfolio attempt, sharing the networks and obs_enc of \e parent */
+    MPNetPlanner(const MPNetPlanner& parent, std::uint_fast32_t seed);
+    base::PlannerStatus solvePortfolio(const base::PlannerTerminationCondition &ptc);
+    /** \brief true once the termination condition of the solve fired, or when \e deadline passed.
+        The inner loops call it on every iteration, the condition is evaluated every
+        STOP_POLL_INTERVAL calls. */
+    bool stopRequested(std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max());
+    /** \brief reset the termination state and the counters of the last solve, at the start of solve() and repair() */
+    void beginSolve(const base::PlannerTerminationCondition &ptc);
+    /** \brief whether the robot can reach \e region while moving from \e s1 to \e s2: the origin moves on a
+        straight line, so the swept volume is within the box of the two positions grown by the margin */
+    bool segmentInRegion(const base::State* s1, const base::State* s2, const ChangedRegion& region) const;
     // MPNet specific:
     void neural_replan(StatePtrVec& path, StatePtrVec& res, int max_length);
     void neural_replanner(base::State* start, base::State* goal, StatePtrVec& res, int max_length);
     virtual void normalize(std::vector<float>& state, std::vector<float>& res, int dim);
     virtual void unnormalize(std::vector<float>& state, std::vector<float>& res, int dim);
     void mpnet_predict(const base::State* start, const base::State* goal, base::State* next);
+    /** \brief mpnet_predict for the pairs from[i], to[i] in one MLP forward. The TorchScript MLP
+        draws one dropout mask for the batch, BatchedMLP and the int8 MLP one per row. */
+    void mpnet_predict_batch(const StatePtrVec& from, const StatePtrVec& to, StatePtrVec& next);
+    /** \brief bidirectional rollouts of every start/goal pair in lockstep, up to the first pair that
+        connects; its path and indices are returned */
+    bool multi_rollout(const StatePtrVec& starts, const StatePtrVec& goals, StatePtrVec& path, int max_length,
+                       int& start_idx, int& goal_idx);
     torch::Tensor getStartGoalTensor(const base::State *start_state, const base::State *goal_state, int dim);
     void lvc(StatePtrVec& path, StatePtrVec& res);
+    /** \brief state validity check, counted in the collision checks of the solve */
+    bool isStateValid(const base::State* state);
+    /** \brief motion check as the DiscreteMotionValidator does it, at \e resolution instead of the
+        resolution of si_, so that solve() does not have to change the space information */
+    bool checkMotion(const base::State* s1, const base::State* s2, double resolution);
+    bool checkMotionLive(const base::State* s1, const base::State* s2, double resolution);
+    /** \brief state (\e s2 nullptr) or motion check recorded into or replayed from the replay log */
+    bool loggedCheck(const base::State* s1, const base::State* s2, double resolution);
+    /** \brief prediction served from the replay log into \e output (normalized), false if it has to run live */
+    bool replayPrediction(const float* input, float* output);
+    /** \brief normalized start/goal input quantized by _cache_quantum */
+    std::vector<int64_t> cacheKey(const float* input) const;
+    /** \brief normalized output for \e input served from the prediction cache, false if the MLP has to run */
+    bool cachedPrediction(const float* input, float* output);
+    /** \brief add a predicted output to the pool of its input */
+    void cachePrediction(const float* input, const float* output);
+    /** \brief record or compare a prediction; \e output becomes the recorded one when it was served */
+    void logPrediction(const float* input, const float* recorded, bool served, float* output);
+    /** \brief full resolution motion check, remembered for the rest of the solve */
+    bool checkSegment(const base::State* s1, const base::State* s2);
+    /** \brief (x, y, z, qx, qy, qz, qw) of an SE3 state, and back */
+    void stateToVector(const base::State* state, std::vector<float>& res) const;
+    void vectorToState(const std::vector<float>& vec, base::State* state);
+    /** \brief normalized start and goal, the key of the experience library */
+    std::vector<float> experienceKey(const base::State* start, const base::State* goal);
+    /** \brief wait for the encoder, which is loaded in the background when a snapshot is used */
+    void waitEncoder();
+    static bool loadSnapshot(const std::string& fname, std::vector<float>& voxels, std::vector<float>& enc,
+                             std::shared_ptr<DistanceField>& field, std::vector<BoundingSphere>& spheres);
+    /** \brief use the latest MLP published by the continual trainer, if any */
+    void updatePublishedMLP();
+    /** \brief use the current model of the model store if it is newer than the networks in use */
+    void updateStoredModel();
 
     class Motion
     {
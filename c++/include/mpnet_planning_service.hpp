@@ -0,0 +1,90 @@
+#ifndef MPNET_PLANNING_SERVICE_
+#define MPNET_PLANNING_SERVICE_
+
+#include "ompl/geometric/SimpleSetup.h"
+#include "mpnet_planner.hpp"
+#include "mpnet_batched_mlp.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** \brief A planning query, start and goal given as (x, y, z, qx, qy, qz, qw) like the path files */
+struct PlanningQuery
+{
+    std::vector<float> start;
+    std::vector<float> goal;
+    double time_limit{120.};
+};
+
+struct PlanningResult
+{
+    bool exact{false};
+    /** \brief solution path, states as (x, y, z, qx, qy, qz, qw) */
+    std::vector<std::vector<float>> path;
+    /** \brief time spent in solve */
+    float plan_time{0.f};
+    /** \brief time from submit to the result, including the time queued */
+    float latency{0.f};
+};
+
+/** \brief In-process planning service running concurrent MPNet solves on one shared, batched MLP.
+
+    Each worker owns a setup (built by the factory, e.g. an SE3RigidBodyPlanning with the scene
+    loaded) and an MPNetPlanner on it. Queries are solved by the first free worker; while a solve
+    waits for a prediction its worker is blocked and the BatchedMLP gathers the predictions of
+    all the other solves into the same forward, so the MLP runs on batches of up to
+    \e batching.max_batch inputs instead of one input per call. */
+class PlanningService
+{
+public:
+    struct Options
+    {
+        /** \brief number of concurrent solves */
+        int workers{8};
+        BatchedMLP::Options batching;
+        std::string mlp_fname{"../mlp_annotated_test_gpu_2.pt"};
+    };
+
+    typedef std::function<ompl::geometric::SimpleSetupPtr()> SetupFactory;
+
+    PlanningService(const SetupFactory& make_setup, const Options& options);
+    ~PlanningService();
+
+    /** \brief Queue a query, the result is ready once a worker has solved it */
+    std::future<PlanningResult> submit(const PlanningQuery& query);
+
+    const BatchedMLP& mlp() const
+    {
+        return *mlp_;
+    }
+
+    /** \brief Solve one query on a setup whose planner is already set; also used without the service */
+    static PlanningResult solve(ompl::geometric::SimpleSetup& setup, const PlanningQuery& query);
+
+protected:
+    struct Task
+    {
+        PlanningQuery query;
+        std::promise<PlanningResult> result;
+        std::chrono::steady_clock::time_point submitted;
+    };
+
+    void run(const ompl::geometric::SimpleSetupPtr& setup);
+
+    std::shared_ptr<BatchedMLP> mlp_;
+    std::vector<ompl::geometric::SimpleSetupPtr> setups_;
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<Task> queue_;
+    bool running_{true};
+};
+
+#endif
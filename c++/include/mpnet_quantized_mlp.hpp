@@ -0,0 +1,132 @@
+#ifndef MPNET_QUANTIZED_MLP_
+#define MPNET_QUANTIZED_MLP_
+
+#include <torch/script.h>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "mpnet_mapped_weights.hpp"
+
+/** \brief Post-training int8 version of the MPNet planning network (MLP) for CPU inference.
+
+    The weights of every hidden Linear layer are quantized symmetrically per output channel.
+    Activations entering those layers are quantized per layer, with the scale taken from a
+    calibration pass over recorded MLP inputs (obstacle encoding + start + goal). Without
+    calibration the activation scale is computed per forward (dynamic quantization).
+
+    The first layer stays in fp32: its input mixes the obstacle encoding and the normalized
+    start/goal, and the obstacle part is constant per environment, so it is folded into a
+    per-environment bias by setEnvironmentEncoding() and only the start/goal columns are
+    multiplied per prediction. The fp32 weights are kept as reference for calibration and
+    for reporting the deviation of the quantized outputs.
+
+    exportWeights() writes the quantized network in the native weight format; an MLP constructed
+    from the MappedWeights of that file computes on the mapped arrays in place. */
+class QuantizedMLP
+{
+public:
+    /** \brief Deviation of the int8 outputs from the fp32 outputs (dropout disabled) */
+    struct DeviationReport
+    {
+        int samples{0};
+        float max_abs{0.f};
+        float mean_abs{0.f};
+        float max_rel{0.f};
+    };
+
+    /** \brief Extract the Linear/PReLU parameters of the annotated TorchScript MLP (fc1 ... fcN)
+        and quantize them. \e obs_size is the length of the obstacle encoding at the front of
+        the input, \e dropout_p the drop probability used in the annotated forward. */
+    QuantizedMLP(const torch::jit::script::Module& mlp, int obs_size = 64, float dropout_p = 0.5);
+
+    /** \brief The MLP written by exportWeights under \e prefix, using the arrays of \e weights in place;
+        throws std::runtime_error when they are missing */
+    explicit QuantizedMLP(const std::shared_ptr<const MappedWeights>& weights, const std::string& prefix = "mlp.");
+
+    /** \brief The MLP of \e shared with an environment of its own; the weights and the calibration
+        are shared, not copied */
+    explicit QuantizedMLP(const std::shared_ptr<const QuantizedMLP>& shared);
+
+    QuantizedMLP(const QuantizedMLP&) = delete;
+    QuantizedMLP& operator=(const QuantizedMLP&) = delete;
+
+    /** \brief Add the layers, the quantized weights and the calibration to \e writer under \e prefix */
+    void exportWeights(MappedWeights::Writer& writer, const std::string& prefix = "mlp.") const;
+
+    /** \brief Calibrate the activation scales from full MLP inputs (obs_enc followed by start/goal) */
+    void calibrate(const std::vector<std::vector<float>>& inputs);
+
+    /** \brief Compare int8 against fp32 on full MLP inputs, with dropout disabled */
+    DeviationReport evaluate(const std::vector<std::vector<float>>& inputs) const;
+
+    /** \brief Fold the obstacle encoding of the active environment into the first layer */
+    void setEnvironmentEncoding(const float* obs_enc);
+
+    /** \brief Predict from the normalized start/goal (input_size - obs_size floats) of the active
+        environment. \e quantized selects the int8 layers, otherwise the fp32 reference is used. */
+    void forward(const float* sg, float* out, std::mt19937& gen, bool dropout = true, bool quantized = true) const;
+
+    /** \brief Predict from a full MLP input (obs_enc followed by start/goal), dropout disabled */
+    void forwardFull(const float* input, float* out, bool quantized = true) const;
+
+    /** \brief Read samples of \e dim floats from a whitespace separated text file, in the format
+        written by test_sample_gen.py or MPNetPlanner::saveMLPInputs */
+    static std::vector<std::vector<float>> loadSamples(const std::string& fname, int dim);
+
+    int inputSize() const
+    {
+        return input_size_;
+    }
+    int outputSize() const
+    {
+        return output_size_;
+    }
+    bool isCalibrated() const
+    {
+        return calibrated_;
+    }
+    /** \brief Bytes of weight data read by one quantized forward */
+    std::size_t quantizedWeightBytes() const;
+
+protected:
+    /** \brief the arrays are owned by the MLP (float_arrays_, int8_arrays_), by the mapped weight file or by the shared MLP */
+    struct Layer
+    {
+        int in{0};
+        int out{0};
+        const float* weight{nullptr};   // fp32 reference, row major [out][in]
+        const float* bias{nullptr};
+        const float* prelu{nullptr};    // nullptr for the output layer
+        int prelu_size{0};              // 1 or out
+        const int8_t* qweight{nullptr}; // int8 weight, row major [out][in]
+        const float* wscale{nullptr};   // per output channel weight scale
+        float ascale{0.f};              // calibrated scale of the input activation
+        bool dropout{false};            // dropout is applied to the output of this layer
+    };
+
+    /** \brief keep \e values in the MLP; the returned pointer stays valid */
+    const float* own(std::vector<float>&& values);
+    const int8_t* own(std::vector<int8_t>&& values);
+
+    void quantizeWeights(Layer& layer);
+    void firstLayer(const float* input, const float* env_bias, int offset, float* out) const;
+    void hiddenLayers(std::vector<float>& x, float* out, std::mt19937* gen, bool quantized,
+                      std::vector<float>* max_abs) const;
+    static void prelu(const Layer& layer, float* x);
+
+    std::vector<Layer> layers_;
+    std::vector<std::vector<float>> float_arrays_;
+    std::vector<std::vector<int8_t>> int8_arrays_;
+    std::shared_ptr<const MappedWeights> weights_;
+    std::shared_ptr<const QuantizedMLP> shared_; // owner of the arrays of an MLP built from another one
+    std::vector<float> env_bias_;
+    int obs_size_;
+    int input_size_{0};
+    int output_size_{0};
+    float dropout_p_;
+    bool calibrated_{false};
+};
+
+#endif
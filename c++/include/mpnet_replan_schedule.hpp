@@ -0,0 +1,89 @@
+#ifndef MPNET_REPLAN_SCHEDULE_
+#define MPNET_REPLAN_SCHEDULE_
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+/** \brief Chooses the rollout budget and the checking resolution of each replanning iteration of
+    MPNetPlanner::solve from the iterations it has seen, instead of the fixed schedule.
+
+    The iterations are split in three stages like the fixed schedule: the first one, the ones below
+    30% of the replanning budget, and the rest. Every stage runs a UCB1 bandit over the same arms,
+    each a multiple of max_length and of DEFAULT_STEP. An arm is scored by its upper confidence
+    bound on the rate of iterations that end with a feasible path, divided by its mean iteration
+    time, i.e. feasible paths per second. Coarse checks that missed a collision (the rollouts
+    connected, the feasibility check at DEFAULT_STEP failed) count as failed iterations of the arm
+    and are reported with the connect rate. Arms not tried yet in a stage are tried first, starting
+    with the arm of the fixed schedule.
+
+    The statistics belong to one environment; they are saved as a text file, one line per stage and
+    arm: stage, length factor, step factor, iterations, connected, feasible, coarse misses, seconds.
+    The schedule can be shared by several planners of the same environment. */
+class ReplanSchedule
+{
+public:
+    enum Stage
+    {
+        FIRST = 0,
+        EARLY = 1,
+        LATE = 2,
+        NUM_STAGES = 3
+    };
+
+    /** \brief An iteration runs rollouts of length_factor * max_length checked at step_factor * DEFAULT_STEP */
+    struct Arm
+    {
+        int length_factor;
+        int step_factor;
+    };
+
+    struct ArmStats
+    {
+        unsigned long iterations{0};
+        unsigned long connected{0};
+        unsigned long feasible{0};
+        unsigned long coarse_misses{0};
+        double seconds{0.};
+    };
+
+    /** \brief Load the statistics in \e fname if it exists; save() writes them back there. \e exploration
+        scales the confidence bonus. */
+    explicit ReplanSchedule(const std::string& fname = "", double exploration = 0.5);
+
+    bool load(const std::string& fname);
+    bool save(const std::string& fname) const;
+    bool save() const;
+
+    /** \brief stage of iteration \e iter out of \e max_replan */
+    static Stage stage(int iter, int max_replan);
+
+    /** \brief the arm the next iteration of \e stage runs */
+    int choose(Stage stage) const;
+
+    /** \brief Count an iteration of \e arm: whether every rollout connected at the coarse resolution,
+        whether the path was feasible at DEFAULT_STEP after it and how long it took */
+    void report(Stage stage, int arm, bool connected, bool feasible, double seconds);
+
+    const std::vector<Arm>& getArms() const
+    {
+        return arms_;
+    }
+
+    ArmStats getStats(Stage stage, int arm) const;
+
+    /** \brief the arm the bandit chose most often in \e stage, the fixed one while untried */
+    int getBest(Stage stage) const;
+
+protected:
+    /** \brief arm of the fixed schedule of \e stage */
+    int defaultArm(Stage stage) const;
+
+    std::string fname_;
+    double exploration_;
+    std::vector<Arm> arms_;
+    std::vector<ArmStats> stats_[NUM_STAGES];
+    mutable std::mutex mutex_;
+};
+
+#endif
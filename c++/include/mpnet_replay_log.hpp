@@ -0,0 +1,107 @@
+#ifndef MPNET_REPLAY_LOG_
+#define MPNET_REPLAY_LOG_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/** \brief Recorded planner queries, with every MLP prediction and collision check of their solves.
+
+    A planner that records (MPNetPlanner::setReplayLog with RECORD) adds one query per solve: its
+    starts, its sampled goals and obs_enc, then the normalized start/goal and the normalized output
+    of each prediction, and the result of each isStateValid/checkMotion of the planner with the
+    number of state checks it took. The checks are keyed by a hash of their states, so that a replay
+    that leaves the recorded trajectory is noticed.
+
+    A planner that replays serves the predictions (REPLAY_INFERENCE) and/or the checks
+    (REPLAY_COLLISION) of the next query from the log, in the recorded order, instead of running the
+    networks and FCL. Since the rest of solve() only depends on them, the solve repeats the recorded
+    one; replaying both needs neither the models nor the meshes. With COMPARE_INFERENCE the live
+    backend also runs on the recorded inputs and its outputs are compared to the recorded ones.
+    Solves cut short by their time limit are only repeated up to that point.
+
+    The log is a binary file of 32-bit fields as they are in memory (little-endian on x86 and ARM):
+    "MPRL", the version, the number of queries, then per query the sizes and contents of the arrays
+    of Query. A log is used by one planner at a time. */
+class ReplayLog
+{
+public:
+    enum Mode
+    {
+        RECORD = 0,
+        REPLAY_INFERENCE = 1,
+        REPLAY_COLLISION = 2,
+        REPLAY_ALL = 3,
+        COMPARE_INFERENCE = 4
+    };
+
+    static constexpr int kInputSize = 14;
+    static constexpr int kOutputSize = 7;
+
+    struct Query
+    {
+        std::vector<std::vector<float>> starts;
+        std::vector<std::vector<float>> goals;
+        std::vector<float> enc;
+        std::vector<float> inputs;  // kInputSize per prediction
+        std::vector<float> outputs; // kOutputSize per prediction
+        std::vector<uint32_t> check_keys;
+        std::vector<uint32_t> check_counts;
+        std::vector<uint8_t> check_results;
+    };
+
+    /** \brief What a replay served, and where it left the log */
+    struct ReplayStats
+    {
+        unsigned long predictions_served{0};
+        unsigned long checks_served{0};
+        unsigned long prediction_mismatches{0}; // served predictions whose input differs from the recorded one
+        unsigned long check_mismatches{0};      // checks run live because their key differs or the log is exhausted
+        unsigned long compared{0};
+        unsigned long bit_identical{0};
+        double max_deviation{0.};
+    };
+
+    ReplayLog() = default;
+
+    bool load(const std::string& fname);
+    bool save(const std::string& fname) const;
+
+    /** \brief Start recording a query */
+    void beginQuery(const std::vector<std::vector<float>>& starts, const std::vector<float>& enc);
+    void addGoal(const std::vector<float>& goal);
+    void addPrediction(const float* input, const float* output);
+    void addCheck(uint32_t key, bool valid, uint32_t count);
+
+    /** \brief Move the replay to the next query, false when all of them were replayed */
+    bool nextQuery();
+    /** \brief Replay from the first query again; the stats are kept */
+    void rewind();
+    /** \brief Recorded output of the next prediction of the current query, false when there is none */
+    bool nextPrediction(const float* input, float* output);
+    /** \brief Recorded result of the next check, false when \e key does not match it */
+    bool nextCheck(uint32_t key, bool& valid, uint32_t& count);
+    void comparePrediction(const float* recorded, const float* live);
+
+    const std::vector<Query>& queries() const
+    {
+        return queries_;
+    }
+
+    const ReplayStats& stats() const
+    {
+        return stats_;
+    }
+
+    /** \brief FNV-1a hash of \e n floats, the keys of the checks */
+    static uint32_t hash(const float* data, int n, uint32_t seed = 2166136261u);
+
+protected:
+    std::vector<Query> queries_;
+    int current_{-1};
+    std::size_t next_prediction_{0};
+    std::size_t next_check_{0};
+    ReplayStats stats_;
+};
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef MPNET_TRACE_
+#define MPNET_TRACE_
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "mpnet_perf_counters.hpp"
+
+/** \brief Records spans of the planner phases and writes them as Chrome trace-event JSON,
+    which opens in Perfetto (ui.perfetto.dev) or chrome://tracing.
+
+    Every thread writes to its own ring buffer, registered on its first span: recording takes no
+    lock and no allocation, and once a buffer is full the oldest spans are overwritten. When a
+    thread exits, its spans are moved to the finished spans (at most 8 buffers of them, the oldest
+    are dropped) and its buffer is reused by the next thread, so threads started per run or per
+    portfolio attempt do not add up. When the recorder is disabled a span costs one relaxed atomic
+    load. save() is meant to be called once the traced queries are done. */
+class TraceRecorder
+{
+public:
+    static TraceRecorder& instance();
+
+    void enable(bool enabled)
+    {
+        enabled_.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool enabled() const
+    {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    /** \brief Microseconds since the recorder was created */
+    int64_t now() const;
+
+    /** \brief Record a complete span; \e name must outlive the recorder (a string literal) */
+    void record(const char* name, int64_t start_us, int64_t duration_us, int64_t arg);
+
+    /** \brief Write the recorded spans of all threads as trace-event JSON */
+    bool save(const std::string& fname) const;
+
+protected:
+    struct Event
+    {
+        const char* name;
+        int64_t start;
+        int64_t duration;
+        int64_t arg;
+    };
+
+    struct ThreadBuffer
+    {
+        int tid;
+        std::vector<Event> events;
+        std::atomic<uint64_t> next{0};
+    };
+
+    /** \brief buffer of a thread, released when the thread exits */
+    struct ThreadOwner
+    {
+        ThreadBuffer* buffer{nullptr};
+        ~ThreadOwner();
+    };
+
+    TraceRecorder();
+    ThreadBuffer& buffer();
+    /** \brief move the spans of an exiting thread to finished_ and put its buffer on the free list */
+    void release(ThreadBuffer* buffer);
+
+    std::atomic<bool> enabled_{false};
+    int64_t epoch_;
+    std::size_t capacity_{1 << 16};
+    std::size_t max_finished_{8 << 16};
+    mutable std::mutex mutex_; // guards the lists of buffers and finished_
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers_; // all buffers, in use or free
+    std::vector<ThreadBuffer*> active_;
+    std::vector<ThreadBuffer*> free_;
+    std::deque<std::pair<int, Event>> finished_; // thread id and span
+    int next_tid_{1};
+};
+
+/** \brief Span from construction to destruction, recorded if the recorder is enabled. \e arg is
+    shown in the span details (e.g. the query or segment index), -1 for none. The hardware
+    counters of the span are added to its phase if the PerfRecorder is enabled. */
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char* name, int64_t arg = -1);
+    ~TraceSpan();
+
+private:
+    const char* name_;
+    int64_t arg_;
+    int64_t start_{0};
+    bool active_;
+    bool perf_;
+    uint64_t perf_start_[PerfRecorder::NUM_COUNTERS];
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef MPNET_TWO_TIER_CHECKER_
+#define MPNET_TWO_TIER_CHECKER_
+
+#include "ompl/base/StateValidityChecker.h"
+#include "ompl/base/SpaceInformation.h"
+#include "mpnet_distance_field.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/** \brief State validity checker of an SE3 rigid body that answers from conservative approximations
+    first and only runs the exact (FCL) checker on the states they cannot decide.
+
+    Free tier: the robot is covered by bounding spheres (DistanceFieldMotionValidator::coverMesh).
+    When every sphere is clear of the surface in the DistanceField, no environment triangle can
+    touch a robot triangle and the state is free.
+
+    Colliding tier: the environment triangles are bucketed in a grid with one occupancy bit per
+    cell. The longest edges of the robot mesh (probe edges) are walked through the occupied cells
+    and tested against their triangles. An edge crossing a triangle means that a robot triangle
+    intersects an environment triangle, which is what the FCL mesh check reports as a collision.
+    The triangle tests of a state are capped.
+
+    The other states go to the exact checker. Both tiers agree with the mesh check, so the answers
+    do not change, only the time they take. isValid can be called from several threads. */
+class TwoTierValidityChecker : public ompl::base::StateValidityChecker
+{
+public:
+    /** \brief States decided by each tier since the last resetCounts */
+    struct Counts
+    {
+        unsigned long free{0};
+        unsigned long colliding{0};
+        unsigned long exact{0};
+    };
+
+    /** \brief \e shift is the robot center the meshes are shifted by (SE3RigidBodyPlanning::getRobotCenter).
+        The bucket grid has \e grid_size cells per axis over the environment bounds. */
+    TwoTierValidityChecker(const ompl::base::SpaceInformationPtr& si, const ompl::base::StateValidityCheckerPtr& exact,
+                           const std::shared_ptr<const DistanceField>& field, const std::vector<BoundingSphere>& spheres,
+                           const std::vector<Triangle3>& env_triangles, const std::vector<Triangle3>& robot_triangles,
+                           const Point3& shift, int grid_size = 64, int probe_edges = 32, int max_triangle_tests = 256);
+
+    bool isValid(const ompl::base::State* state) const override;
+
+    Counts getCounts() const;
+    void resetCounts();
+
+    const ompl::base::StateValidityCheckerPtr& getExactChecker() const
+    {
+        return exact_;
+    }
+
+protected:
+    /** \brief robot point \e p (robot frame) at position \e t and rotation \e q (x, y, z, w) */
+    static void transform(const double* t, const double* q, const Point3& p, double* out);
+
+    bool definitelyFree(const double* t, const double* q) const;
+    bool definitelyColliding(const double* t, const double* q) const;
+
+    /** \brief bucket cell of a point, -1 if outside the grid */
+    int cellOf(const double* p) const;
+
+    bool occupied(int cell) const
+    {
+        return (occupied_[cell / 64] >> (cell % 64)) & 1;
+    }
+
+    /** \brief whether the segment p0, p1 crosses the interior of \e tri */
+    static bool segmentCrossesTriangle(const double* p0, const double* p1, const Triangle3& tri);
+
+    ompl::base::StateValidityCheckerPtr exact_;
+    std::shared_ptr<const DistanceField> field_;
+    std::vector<BoundingSphere> spheres_;
+    std::vector<std::pair<Point3, Point3>> probe_edges_;
+    int max_triangle_tests_;
+
+    std::vector<Triangle3> triangles_;
+    std::vector<float> lower_;
+    std::vector<double> resolution_;
+    int n_{0};
+    std::vector<uint64_t> occupied_;   // one bit per cell
+    std::vector<int> cell_offsets_;    // triangles of cell c: cell_triangles_[cell_offsets_[c] .. cell_offsets_[c + 1])
+    std::vector<int> cell_triangles_;
+
+    mutable std::atomic<unsigned long> free_{0};
+    mutable std::atomic<unsigned long> colliding_{0};
+    mutable std::atomic<unsigned long> exact_checks_{0};
+};
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef MPNET_VOXEL_ENCODER_
+#define MPNET_VOXEL_ENCODER_
+
+#include <torch/script.h>
+#include <cstdint>
+#include <vector>
+
+/** \brief A change of one voxel of the obstacle grid */
+struct VoxelFlip
+{
+    int x, y, z;
+    /** \brief new occupancy of the voxel (0 free, 1 occupied) */
+    float value;
+};
+
+/** \brief Native version of the voxel obstacle encoder (CAE_home_voxel_3):
+    Conv3d(1,C1,K1,stride S1) -> PReLU -> MaxPool3d(P) -> Conv3d(C1,C2,K2,stride S2) -> PReLU -> Linear.
+
+    All intermediate activations of the last encoded grid are kept, so that a sparse set of voxel
+    changes only recomputes the conv cells whose receptive field contains a changed voxel. Every
+    cell is computed by the same routine in the full and in the incremental pass, which makes an
+    incremental update bit-identical to a full encode of the changed grid.
+
+    A binary (0/1) grid is also kept bit-packed, one bit per voxel. The first conv then only adds
+    the weights of the occupied voxels of a window, all channels at once, and skips the empty rows;
+    since the terms of the empty voxels are zero, the sums are the ones of the dense conv. The
+    second conv accumulates all output channels together over contiguous transposed weights,
+    which the compiler vectorizes. */
+class VoxelEncoder
+{
+public:
+    /** \brief Extract the parameters of the annotated TorchScript encoder. The strides are not
+        stored in the module and default to the ones of CAE_home_voxel_3. */
+    VoxelEncoder(const torch::jit::script::Module& encoder, int grid_size = 32, int conv1_stride = 2,
+                 int pool = 2, int conv2_stride = 2);
+
+    /** \brief Encode a full grid (grid_size^3 floats, x major as in obs_voxel.txt) into \e out */
+    void encode(const float* voxels, float* out);
+
+    /** \brief Apply voxel changes to the last encoded grid and write the new encoding to \e out */
+    void update(const std::vector<VoxelFlip>& flips, float* out);
+
+    /** \brief The grid of the last encode/update */
+    const std::vector<float>& voxels() const
+    {
+        return voxels_;
+    }
+
+    int gridSize() const
+    {
+        return n0_;
+    }
+
+    int outputSize() const
+    {
+        return head_out_;
+    }
+
+    /** \brief Number of first-layer conv cells (all channels) recomputed by the last encode/update */
+    int lastConvCells() const
+    {
+        return last_cells_;
+    }
+
+    /** \brief Use the bit-packed first conv for binary grids (the default), or always the dense one */
+    void setBitPacked(bool packed)
+    {
+        packed_ = packed;
+    }
+
+    /** \brief Whether the last encode/update ran the bit-packed first conv */
+    bool isBitPacked() const
+    {
+        return packed_ && binary_;
+    }
+
+protected:
+    VoxelEncoder() = default;
+    /** \brief Derive the layer sizes from the weights and allocate the activations */
+    void init();
+
+    void conv1Cell(int i, int j, int k);
+    /** \brief conv1Cell from the packed bits of a binary grid */
+    void conv1CellPacked(int i, int j, int k);
+    /** \brief \e count bits of the packed row (x, y) from z on, bit d for voxel z + d */
+    uint64_t rowBits(int x, int y, int z, int count) const;
+    void setBit(int x, int y, int z, bool occupied);
+    void poolCell(int i, int j, int k);
+    void conv2Cell(int i, int j, int k);
+    void head(float* out) const;
+
+    static float prelu(const std::vector<float>& a, int c, float x)
+    {
+        return x >= 0.f ? x : x * (a.size() == 1 ? a[0] : a[c]);
+    }
+
+    // layer parameters, in the torch layouts
+    int c1_{0}, k1_{0}, s1_{1};
+    std::vector<float> w1_, b1_, a1_;
+    int pool_{2};
+    int c2_{0}, k2_{0}, s2_{1};
+    std::vector<float> w2_, b2_, a2_;
+    int head_out_{0};
+    std::vector<float> wh_, bh_;
+
+    // grid sizes: input, conv1 output, pool output, conv2 output
+    int n0_{0}, n1_{0}, np_{0}, n2_{0};
+    std::vector<float> voxels_;  // [n0][n0][n0]
+    bool packed_{true};
+    bool binary_{false};         // every voxel is 0 or 1, bits_ is valid
+    int row_words_{0};
+    std::vector<uint64_t> bits_; // [n0][n0][row_words], bit z % 64 of word z / 64
+    std::vector<float> w1t_;     // [k1][k1][k1][c1]
+    std::vector<float> w2t_;     // [c1][k2][k2][k2][c2]
+    std::vector<float> acc_;     // accumulators of one cell, all channels
+    std::vector<float> act1_;    // [c1][n1][n1][n1], after PReLU
+    std::vector<float> pooled_;  // [c1][np][np][np]
+    std::vector<float> act2_;    // [c2][n2][n2][n2], after PReLU
+    int last_cells_{0};
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef MPNET_VOXELIZER_
+#define MPNET_VOXELIZER_
+
+#include <array>
+#include <string>
+#include <vector>
+
+typedef std::array<float, 3> Point3;
+typedef std::array<Point3, 3> Triangle3;
+
+/** \brief Builds the occupancy grid fed to the voxel encoder from scene geometry.
+
+    The grid covers [lower_bound, upper_bound) with grid_size cells per axis and is laid out
+    x major, like obs_voxel.txt and the {1,1,32,32,32} encoder input. A point occupies the cell
+    floor((p - lower) / resolution), as in the offline voxelize() of data_loader_home.py; a
+    triangle occupies every cell its surface intersects. The grid is filled in parallel, each
+    thread owning a slab of x cells, so no synchronization is needed on the output. The input is
+    first bucketed by slab, each thread taking a part of it, so every slab only goes through the
+    points or triangles that reach it. */
+class Voxelizer
+{
+public:
+    /** \brief \e threads = 0 uses the hardware concurrency */
+    Voxelizer(const std::vector<float>& lower_bound, const std::vector<float>& upper_bound, int grid_size = 32,
+              int threads = 0);
+
+    /** \brief Occupancy grid of a point cloud */
+    std::vector<float> fromPointCloud(const std::vector<Point3>& points) const;
+
+    /** \brief Occupancy grid of the surface of a triangle mesh */
+    std::vector<float> fromTriangles(const std::vector<Triangle3>& triangles) const;
+
+    /** \brief Load the triangles of a mesh file (e.g. Home_env.dae), with node transforms applied */
+    static bool loadMesh(const std::string& fname, std::vector<Triangle3>& triangles);
+
+    /** \brief Axis aligned bounds of a point set, which is what the offline preprocessing voxelizes */
+    static void pointBounds(const std::vector<Point3>& points, std::vector<float>& lower, std::vector<float>& upper);
+
+    /** \brief Axis aligned bounds of a mesh */
+    static void triangleBounds(const std::vector<Triangle3>& triangles, std::vector<float>& lower,
+                               std::vector<float>& upper);
+
+    int gridSize() const
+    {
+        return n_;
+    }
+
+protected:
+    /** \brief run fill(slab, x_begin, x_end) on disjoint slabs of x cells, one thread per slab */
+    template <typename Fill>
+    void parallelSlabs(const Fill& fill) const;
+
+    /** \brief the \e count inputs by slab, as buckets[part][slab] for the part of the input each thread
+        went through; range(idx, lo, hi) gives the x cells of input idx and the value bucketed for
+        it, -1 when it is outside the grid */
+    template <typename Range>
+    std::vector<std::vector<std::vector<int>>> bucketBySlab(std::size_t count, const Range& range) const;
+
+    /** \brief cell range of the bounding box of a triangle, false when it is outside the grid */
+    bool triangleCells(const Triangle3& tri, int* lo, int* hi) const;
+
+    /** \brief cell of a coordinate along an axis, -1 if outside [lower, upper) */
+    int cell(float p, int axis) const;
+
+    bool triangleOverlapsCell(const Triangle3& tri, int i, int j, int k) const;
+
+    std::vector<float> lower_;
+    std::vector<float> upper_;
+    std::vector<double> resolution_;
+    int n_;
+    int threads_;
+};
+
+#endif
@@ -19,17 +19,27 @@
 #include <omplapp/apps/SE3RigidBodyPlanning.h>
 #include <omplapp/config.h>
 #include "mpnet_planner.hpp"
+#include "mpnet_quantized_mlp.hpp"
+#include "mpnet_voxel_encoder.hpp"
+#include "mpnet_voxelizer.hpp"
+#include "mpnet_continual_trainer.hpp"
+#include "mpnet_experience_library.hpp"
+#include "mpnet_trace.hpp"
+#include "mpnet_replay_log.hpp"
 #include <ompl/base/spaces/SE3StateSpace.h>
 
 #include <torch/torch.h>
 #include <torch/script.h>
 #include "mpnet_planner.hpp"
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <cmath>
 #include <iterator>
 #include <fstream>
 #include <stdio.h>
+#include <cstring>
+#include <random>
 
 
 #include <chrono>
@@ -45,9 +55,101 @@ typedef std::vector<ompl::base::State *> StatePtrVec;
 
 using namespace ompl;
 
-int main()
+int main(int argc, char** argv)
 {
-
+    // command line options:
+    //   --int8          plan with the int8 MLP backend
+    //   --calib=<file>  recorded MLP inputs used to calibrate the int8 MLP
+    //   --record=<file> record the MLP inputs of this run, to be used as calibration inputs
+    //   --check-incremental  check that incremental obstacle updates match a full re-encode
+    //   --voxelize      build the obstacle grid from the environment mesh instead of ../obs_voxel.txt
+    //   --continual=<file>  fine-tune this MLP in the background from the solved queries
+    //   --lazy          lazy collision checking in the neural planner
+    //   --connect-k=<k> connect the neural rollouts through the k nearest nodes of the opposite tree
+    //   --snapshot=<file>  start the planner from this snapshot of the environment, written if missing
+    //   --trace=<file>  write a trace of the planner phases of every query (open in ui.perfetto.dev)
+    //   --experience=<file>  warm-start from the solved paths in this file, and store the new ones there
+    //   --sdf=<n>       check motions in an n^3 distance field of the environment (kept in the snapshot)
+    //   --portfolio=<r> race r independent replanning attempts on their own threads
+    //   --goals=<n>     plan to any of n candidate goals: the goal of the query and of the next n-1 path files
+    //   --cache=<k>     memoize k MLP outputs per start/goal input within a solve
+    //   --record-log=<file>  record the queries with their predictions and collision checks (see mpnet_replay)
+    //   --native-encoder  encode the obstacle grid with the bit-packed native encoder instead of TorchScript
+    //   --repair=<h>    after each solved query, add a box obstacle of half size h on the solution and repair it
+    //   --schedule=<file>  learn the replanning schedule from the queries, kept in this file
+    //   --weights=<file>  run the int8 MLP mapped from this native weight file, written (with --int8) if missing
+    //   --swap=<encoder>,<mlp>  load these networks in the background while planning and switch to them
+    bool use_int8 = false;
+    bool check_incremental = false;
+    bool voxelize = false;
+    bool native_encoder = false;
+    bool lazy = false;
+    int connect_k = 0;
+    int n_goals = 1;
+    int portfolio = 1;
+    int sdf_grid = 0;
+    int cache_pool = 0;
+    double repair_size = 0.;
+    std::string continual_fname = "";
+    std::string experience_fname = "";
+    std::string schedule_fname = "";
+    std::string swap_encoder_fname = "";
+    std::string swap_mlp_fname = "";
+    std::string snapshot_fname = "";
+    std::string weights_fname = "";
+    std::string trace_fname = "";
+    std::string calib_fname = "../mlp_calib_inputs.txt";
+    std::string record_fname = "";
+    std::string record_log_fname = "";
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (arg == "--int8")
+            use_int8 = true;
+        else if (arg.compare(0, 8, "--calib=") == 0)
+            calib_fname = arg.substr(8);
+        else if (arg.compare(0, 9, "--record=") == 0)
+            record_fname = arg.substr(9);
+        else if (arg == "--check-incremental")
+            check_incremental = true;
+        else if (arg == "--voxelize")
+            voxelize = true;
+        else if (arg == "--native-encoder")
+            native_encoder = true;
+        else if (arg == "--lazy")
+            lazy = true;
+        else if (arg.compare(0, 12, "--connect-k=") == 0)
+            connect_k = std::stoi(arg.substr(12));
+        else if (arg.compare(0, 12, "--continual=") == 0)
+            continual_fname = arg.substr(12);
+        else if (arg.compare(0, 13, "--experience=") == 0)
+            experience_fname = arg.substr(13);
+        else if (arg.compare(0, 11, "--snapshot=") == 0)
+            snapshot_fname = arg.substr(11);
+        else if (arg.compare(0, 10, "--weights=") == 0)
+            weights_fname = arg.substr(10);
+        else if (arg.compare(0, 8, "--trace=") == 0)
+            trace_fname = arg.substr(8);
+        else if (arg.compare(0, 6, "--sdf=") == 0)
+            sdf_grid = std::stoi(arg.substr(6));
+        else if (arg.compare(0, 12, "--portfolio=") == 0)
+            portfolio = std::stoi(arg.substr(12));
+        else if (arg.compare(0, 8, "--goals=") == 0)
+            n_goals = std::stoi(arg.substr(8));
+        else if (arg.compare(0, 8, "--cache=") == 0)
+            cache_pool = std::stoi(arg.substr(8));
+        else if (arg.compare(0, 13, "--record-log=") == 0)
+            record_log_fname = arg.substr(13);
+        else if (arg.compare(0, 9, "--repair=") == 0)
+            repair_size = std::stod(arg.substr(9));
+        else if (arg.compare(0, 11, "--schedule=") == 0)
+            schedule_fname = arg.substr(11);
+        else if (arg.compare(0, 7, "--swap=") == 0 && arg.find(',') != std::string::npos)
+        {
+            swap_encoder_fname = arg.substr(7, arg.find(',') - 7);
+            swap_mlp_fname = arg.substr(arg.find(',') + 1);
+        }
+    }
 
     // debug if model output the same
     std::shared_ptr<torch::jit::script::Module> encoder(new torch::jit::script::Module(torch::jit::load("../encoder_annotated_test_cpu_2.pt")));
@@ -64,6 +166,7 @@ int main()
     while (getline(infile, line)){
         tt.push_back(std::atof(line.c_str()));
     }
+    std::vector<float> offline_voxels = tt;
     torch::Tensor torch_tensor = torch::from_blob(tt.data(), {1,1,32,32,32});
     #ifdef DEBUG
         std::cout << "after reading in obs and store in torch tensor" << std::endl;
@@ -92,6 +195,73 @@ int main()
 
     std::cout << "finished encoder testing." << std::endl;
 
+    if (check_incremental)
+    {
+        // apply random voxel flips incrementally and compare with a full re-encode of the same grid
+        VoxelEncoder incremental(*encoder);
+        std::vector<float> voxels(tt.begin(), tt.end());
+        std::vector<float> inc_out(64), full_out(64);
+        incremental.encode(voxels.data(), inc_out.data());
+        float native_dev = 0.;
+        for (int i=0; i < 64; i++)
+        {
+            native_dev = std::max(native_dev, std::fabs(inc_out[i] - encoder_out[i]));
+        }
+        std::cout << "native encoder max deviation from torch: " << native_dev << std::endl;
+        // the bit-packed first conv against the dense one, and the encode times of the three
+        VoxelEncoder dense(*encoder);
+        dense.setBitPacked(false);
+        std::vector<float> dense_out(64);
+        float torch_time = 0., dense_time = 0., packed_time = 0.;
+        for (int run=0; run < 10; run++)
+        {
+            auto torch_t0 = Time::now();
+            encoder->forward(inputs);
+            auto dense_t0 = Time::now();
+            dense.encode(voxels.data(), dense_out.data());
+            auto packed_t0 = Time::now();
+            incremental.encode(voxels.data(), inc_out.data());
+            auto packed_t1 = Time::now();
+            torch_time += fsec(dense_t0 - torch_t0).count() / 10;
+            dense_time += fsec(packed_t0 - dense_t0).count() / 10;
+            packed_time += fsec(packed_t1 - packed_t0).count() / 10;
+        }
+        std::cout << "bit-packed encoder (" << (incremental.isBitPacked() ? "binary grid" : "dense fallback")
+                  << ") bit-identical to dense: " << (memcmp(inc_out.data(), dense_out.data(), 64*sizeof(float)) == 0 ? "yes" : "no")
+                  << std::endl;
+        std::cout << "encode time: torch " << torch_time << "s, native dense " << dense_time << "s, native bit-packed "
+                  << packed_time << "s" << std::endl;
+        std::mt19937 gen(0);
+        std::uniform_int_distribution<int> voxel_idx(0, 31);
+        bool identical = true;
+        float inc_time = 0., full_time = 0.;
+        for (int round=0; round < 100; round++)
+        {
+            std::vector<VoxelFlip> flips;
+            for (int f=0; f < 1 + round % 8; f++)
+            {
+                VoxelFlip flip = {voxel_idx(gen), voxel_idx(gen), voxel_idx(gen), (float)(voxel_idx(gen) % 2)};
+                voxels[(flip.x*32 + flip.y)*32 + flip.z] = flip.value;
+                flips.push_back(flip);
+            }
+            auto inc_t0 = Time::now();
+            incremental.update(flips, inc_out.data());
+            auto inc_t1 = Time::now();
+            VoxelEncoder full(*encoder);
+            auto full_t0 = Time::now();
+            full.encode(voxels.data(), full_out.data());
+            auto full_t1 = Time::now();
+            inc_time += fsec(inc_t1 - inc_t0).count();
+            full_time += fsec(full_t1 - full_t0).count();
+            if (memcmp(inc_out.data(), full_out.data(), 64*sizeof(float)) != 0)
+            {
+                identical = false;
+            }
+        }
+        std::cout << "incremental encoding bit-identical to full re-encode: " << (identical ? "yes" : "no") << std::endl;
+        std::cout << "incremental update time: " << inc_time / 100 << "s, full encode time: " << full_time / 100 << "s" << std::endl;
+    }
+
 
     std::shared_ptr<torch::jit::script::Module> MLP(new torch::jit::script::Module(torch::jit::load("../mlp_annotated_test_gpu_2.pt")));
     MLP->to(at::kCUDA);
@@ -133,6 +303,50 @@ int main()
 
     std::cout << "finished mlp testing." << std::endl;
 
+    if (use_int8)
+    {
+        // compare the int8 MLP against fp32 on the same test sample, and on the calibration inputs
+        QuantizedMLP qmlp(*MLP);
+        std::vector<std::vector<float>> calib = QuantizedMLP::loadSamples(calib_fname, 78);
+        if (calib.empty())
+        {
+            std::cout << "no calibration inputs in " << calib_fname << ", calibrating on the test sample." << std::endl;
+            calib.push_back(tt);
+        }
+        qmlp.calibrate(calib);
+        QuantizedMLP::DeviationReport report = qmlp.evaluate(calib);
+        std::cout << "int8 deviation on " << report.samples << " calibration inputs: max abs " << report.max_abs
+                  << ", mean abs " << report.mean_abs << ", max rel " << report.max_rel << std::endl;
+        report = qmlp.evaluate({tt});
+        std::cout << "int8 deviation on the test sample: max abs " << report.max_abs << std::endl;
+        std::cout << "int8 weight bytes per forward: " << qmlp.quantizedWeightBytes() << std::endl;
+
+        std::mt19937 gen(0);
+        qmlp.setEnvironmentEncoding(tt.data());
+        std::vector<float> int8_out(700);
+        for (int i=0; i < 100; i++)
+        {
+            qmlp.forward(tt.data()+64, int8_out.data()+7*i, gen);
+        }
+        outfile_test.open("../test_sample_output_cpp_int8.txt");
+        for (int i=0; i < 700; i++)
+        {
+            outfile_test << int8_out[i] << "\n";
+        }
+        outfile_test.close();
+        for (int j=0; j < 7; j++)
+        {
+            float fp32_mean = 0., int8_mean = 0.;
+            for (int i=0; i < 100; i++)
+            {
+                fp32_mean += mlp_out[7*i+j] / 100;
+                int8_mean += int8_out[7*i+j] / 100;
+            }
+            std::cout << "output " << j << ": fp32 mean " << fp32_mean << ", int8 mean " << int8_mean << std::endl;
+        }
+        std::cout << "finished int8 mlp testing." << std::endl;
+    }
+
     //####################Finished testing################################
     //####################################################################
 
@@ -145,7 +359,136 @@ int main()
     setup.setRobotMesh(robot_fname);
     setup.setEnvironmentMesh(env_fname);
 
-    MPNetPlanner* planner = new MPNetPlanner(setup.getSpaceInformation(), false, 1001, 3000);
+    TraceRecorder::instance().enable(!trace_fname.empty());
+    MPNetPlanner::StartupOptions startup;
+    startup.snapshot_fname = snapshot_fname;
+    startup.weights_fname = weights_fname;
+    startup.encoder_backend = native_encoder ? MPNetPlanner::NATIVE_ENCODER : MPNetPlanner::TORCH_ENCODER;
+    auto startup_t0 = Time::now();
+    MPNetPlanner* planner = new MPNetPlanner(setup.getSpaceInformation(), false, 1001, 3000, startup);
+    auto startup_t1 = Time::now();
+    std::cout << "planner construction time: " << fsec(startup_t1 - startup_t0).count() << "s" << std::endl;
+    if (use_int8 && planner->getMLPBackend() != MPNetPlanner::INT8_MLP &&
+        !planner->setMLPBackend(MPNetPlanner::INT8_MLP, calib_fname))
+    {
+        std::cout << "int8 MLP rejected, planning with the TorchScript MLP." << std::endl;
+    }
+    planner->setRecordMLPInputs(!record_fname.empty());
+    planner->setLazyCollisionChecking(lazy);
+    planner->setConnectNearest(connect_k);
+    planner->setPortfolio(portfolio);
+    planner->setPredictionCache(cache_pool);
+    std::shared_ptr<ReplayLog> replay_log;
+    if (!record_log_fname.empty())
+    {
+        replay_log = std::make_shared<ReplayLog>();
+        planner->setReplayLog(replay_log, ReplayLog::RECORD);
+    }
+    if (voxelize)
+    {
+        // voxelize the environment mesh over its own extent, as the offline preprocessing does with the point cloud
+        auto vox_t0 = Time::now();
+        std::vector<Triangle3> triangles;
+        if (!Voxelizer::loadMesh(env_fname, triangles))
+        {
+            std::cout << "could not load the mesh " << env_fname << std::endl;
+            return 1;
+        }
+        std::vector<float> lower, upper;
+        Voxelizer::triangleBounds(triangles, lower, upper);
+        Voxelizer voxelizer(lower, upper);
+        std::vector<float> voxels = voxelizer.fromTriangles(triangles);
+        auto vox_t1 = Time::now();
+        int occupied = 0, differ = 0;
+        for (int i=0; i < voxels.size(); i++)
+        {
+            occupied += voxels[i] > 0.5;
+            if (i < offline_voxels.size())
+              differ += (voxels[i] > 0.5) != (offline_voxels[i] > 0.5);
+        }
+        std::cout << "voxelized " << triangles.size() << " triangles in " << fsec(vox_t1 - vox_t0).count() << "s: "
+                  << occupied << " occupied voxels, " << differ << " differ from obs_voxel.txt" << std::endl;
+        planner->setObstacleVoxels(voxels);
+    }
+    if (sdf_grid > 0 && !planner->getDistanceFieldValidator())
+    {
+        // built once per scene, a snapshot written below keeps it
+        auto sdf_t0 = Time::now();
+        std::vector<Triangle3> env_triangles, robot_triangles;
+        if (!Voxelizer::loadMesh(env_fname, env_triangles))
+        {
+            std::cout << "could not load the mesh " << env_fname << std::endl;
+            return 1;
+        }
+        if (!Voxelizer::loadMesh(robot_fname, robot_triangles))
+        {
+            std::cout << "could not load the mesh " << robot_fname << std::endl;
+            return 1;
+        }
+        auto field = std::make_shared<DistanceField>(env_triangles, sdf_grid);
+        aiVector3D center = setup.getRobotCenter(0);
+        std::vector<BoundingSphere> spheres = DistanceFieldMotionValidator::coverMesh(robot_triangles, {center.x, center.y, center.z});
+        planner->setDistanceField(field, spheres);
+        auto sdf_t1 = Time::now();
+        std::cout << "distance field " << sdf_grid << "^3 with " << spheres.size() << " robot spheres built in "
+                  << fsec(sdf_t1 - sdf_t0).count() << "s" << std::endl;
+    }
+    double robot_radius = 0.;
+    if (repair_size > 0.)
+    {
+        // the box obstacle of --repair is checked against a sphere around the robot origin containing the robot
+        std::vector<Triangle3> robot_triangles;
+        if (!Voxelizer::loadMesh(robot_fname, robot_triangles))
+        {
+            std::cout << "could not load the mesh " << robot_fname << std::endl;
+            return 1;
+        }
+        aiVector3D center = setup.getRobotCenter(0);
+        for (const Triangle3& tri : robot_triangles)
+            for (const Point3& p : tri)
+                robot_radius = std::max(robot_radius, std::sqrt(std::pow(p[0] - center.x, 2) + std::pow(p[1] - center.y, 2) +
+                                                                std::pow(p[2] - center.z, 2)));
+    }
+    if (!snapshot_fname.empty() && !std::ifstream(snapshot_fname).good())
+    {
+        planner->saveSnapshot(snapshot_fname);
+    }
+    if (!weights_fname.empty() && !std::ifstream(weights_fname).good())
+    {
+        std::cout << (planner->exportWeights(weights_fname) ? "native weights written to " : "no calibrated int8 MLP for ")
+                  << weights_fname << std::endl;
+    }
+    std::shared_ptr<ContinualTrainer> trainer;
+    if (!continual_fname.empty())
+    {
+        trainer = std::make_shared<ContinualTrainer>(continual_fname);
+        trainer->start();
+        planner->setContinualTrainer(trainer);
+    }
+    std::shared_ptr<ExperienceLibrary> experience;
+    if (!experience_fname.empty())
+    {
+        experience = std::make_shared<ExperienceLibrary>(experience_fname);
+        std::cout << "experience library: " << experience->size() << " paths" << std::endl;
+        planner->setExperienceLibrary(experience);
+    }
+    std::shared_ptr<ReplanSchedule> schedule;
+    if (!schedule_fname.empty())
+    {
+        schedule = std::make_shared<ReplanSchedule>(schedule_fname);
+        planner->setReplanSchedule(schedule);
+    }
+    // the queries keep running on the startup networks until the new ones are published
+    std::shared_ptr<ModelStore> model_store;
+    std::future<int> model_loading;
+    if (!swap_mlp_fname.empty())
+    {
+        model_store = std::make_shared<ModelStore>();
+        planner->setModelStore(model_store);
+        model_loading = model_store->loadAsync(swap_encoder_fname, swap_mlp_fname);
+    }
+    // result files of the int8 backend are kept next to the fp32 ones
+    std::string suffix = planner->getMLPBackend() == MPNetPlanner::INT8_MLP ? "_int8" : "";
 
     // setting collision checking resolution to 1% of the space extent
     setup.getSpaceInformation()->setStateValidityCheckingResolution(0.01);
@@ -168,6 +511,12 @@ int main()
     std::vector<float> plan_sucs;
     std::vector<float> plan_lens;
     std::vector<float> data_lens;
+    std::vector<float> plan_checks;
+    std::vector<float> plan_connect_iters;
+    std::vector<float> plan_clearance_queries;
+    std::vector<float> plan_cache_hit_rates;
+    std::vector<float> repair_times;
+    std::vector<float> resolve_times;
 
     //std::string model_path = "/media/arclabdl1/HD1/YLmiao/results/CMPnet_res/home_mlp2_lr025_SGD_c++/";
     std::string model_path = "/media/arclabdl1/HD1/YLmiao/results/MPnet_res/home_mlp2_lr01_SGD_c++/";
@@ -183,6 +532,7 @@ int main()
         // * load data
         //std::ifstream infile;
         auto load_t0 = Time::now();
+        std::unique_ptr<TraceSpan> phase_span(new TraceSpan("load", path_idx+sp));
         std::ifstream infile;
         std::string p_fname = "/media/arclabdl1/HD1/YLmiao/data/home/paths/path_" + std::to_string(path_idx+sp) + ".txt";
         path_idx += 1;
@@ -216,6 +566,8 @@ int main()
         // * setup env
 
         auto setup_t0 = Time::now();
+        phase_span.reset();
+        phase_span.reset(new TraceSpan("setup", path_idx+sp));
 
         // define start state
         base::ScopedState<base::SE3StateSpace> start(setup.getSpaceInformation());
@@ -243,6 +595,46 @@ int main()
 
         // set the start & goal states
         setup.setStartAndGoalStates(start, goal);
+        std::vector<base::ScopedState<base::SE3StateSpace>> candidate_goals = {goal};
+        if (n_goals > 1)
+        {
+            // extra candidates are the goals of the next path files, as with several grasp poses
+            for (int k=1; k < 10*n_goals && candidate_goals.size() < n_goals; k++)
+            {
+                std::ifstream goal_file("/media/arclabdl1/HD1/YLmiao/data/home/paths/path_" + std::to_string(path_idx+sp+k) + ".txt");
+                std::vector<float> candidate_vec(STATE_N);
+                bool found = false;
+                while (getline(goal_file, line))
+                {
+                  std::stringstream ss(line);
+                  std::vector<float> state(STATE_N);
+                  for (int state_i=0; state_i < STATE_N; state_i ++)
+                  {
+                    ss >> state[state_i];
+                  }
+                  if (ss)
+                  {
+                    candidate_vec = state;
+                    found = true;
+                  }
+                }
+                if (!found)
+                {
+                  continue;
+                }
+                base::ScopedState<base::SE3StateSpace> candidate(start);
+                candidate->setXYZ(candidate_vec[0], candidate_vec[1], candidate_vec[2]);
+                planner->q_to_axis_angle(candidate_vec[6], candidate_vec[3], candidate_vec[4], candidate_vec[5], angle);
+                candidate->rotation().setAxisAngle(angle[0], angle[1], angle[2], angle[3]);
+                candidate_goals.push_back(candidate);
+            }
+            auto goal_states = std::make_shared<base::GoalStates>(setup.getSpaceInformation());
+            for (const auto& candidate : candidate_goals)
+            {
+                goal_states->addState(candidate);
+            }
+            setup.setGoal(goal_states);
+        }
         //setup.setup();
         //setup.print();
         auto setup_t1 = Time::now();
@@ -254,12 +646,47 @@ int main()
         // * plan
         // try to solve the problem
 
+        phase_span.reset();
         auto plan_t0 = Time::now();
         base::PlannerStatus status = setup.solve(120);
         auto plan_t1 = Time::now();
         fsec time_plan = plan_t1 - plan_t0;
         float time_spent = time_plan.count();
         std::cout << "plan takes total time: " << time_spent << "s" << std::endl;
+        plan_checks.push_back(planner->getCollisionChecks());
+        std::cout << "collision checks: " << planner->getCollisionChecks() << std::endl;
+        plan_clearance_queries.push_back(planner->getClearanceQueries());
+        if (planner->getDistanceFieldValidator())
+        {
+          std::cout << "distance field queries: " << planner->getClearanceQueries() << std::endl;
+        }
+        plan_connect_iters.push_back(planner->getMeanConnectIterations());
+        if (model_store)
+        {
+          std::cout << "model version: " << planner->getModelVersion() << std::endl;
+        }
+        if (cache_pool > 0)
+        {
+          plan_cache_hit_rates.push_back(planner->getPredictionCacheHitRate());
+          std::cout << "prediction cache hit rate: " << plan_cache_hit_rates.back() << std::endl;
+        }
+        if (portfolio > 1)
+        {
+          std::cout << "portfolio winner: attempt " << planner->getPortfolioWinner() << " of " << portfolio << std::endl;
+        }
+        if (candidate_goals.size() > 1 && setup.haveSolutionPath())
+        {
+          // the candidate the path ends at
+          const base::State* reached = setup.getSolutionPath().getStates().back();
+          int reached_idx = 0;
+          for (int k=1; k < candidate_goals.size(); k++)
+          {
+            if (setup.getSpaceInformation()->distance(reached, candidate_goals[k].get()) <
+                setup.getSpaceInformation()->distance(reached, candidate_goals[reached_idx].get()))
+              reached_idx = k;
+          }
+          std::cout << "reached goal " << reached_idx << " of " << candidate_goals.size() << " candidates" << std::endl;
+        }
 
 
 
@@ -321,11 +748,56 @@ int main()
 
         data_lens.push_back(data_path->length());
 
+        if (repair_size > 0. && status == base::PlannerStatus::EXACT_SOLUTION)
+        {
+          // a box obstacle appears in the middle of the middle segment of the solution, seen only by the
+          // collision checker (not by the distance field of --sdf nor by obs_enc)
+          base::SpaceInformationPtr si = setup.getSpaceInformation();
+          geometric::PathGeometric previous = setup.getSolutionPath();
+          int mid_idx = (previous.getStateCount() - 1) / 2;
+          base::ScopedState<base::SE3StateSpace> mid(si);
+          si->getStateSpace()->interpolate(previous.getState(mid_idx), previous.getState(mid_idx+1), 0.5, mid.get());
+          MPNetPlanner::ChangedRegion region;
+          region.low = {mid->getX() - repair_size, mid->getY() - repair_size, mid->getZ() - repair_size};
+          region.high = {mid->getX() + repair_size, mid->getY() + repair_size, mid->getZ() + repair_size};
+          region.margin = robot_radius;
+          base::StateValidityCheckerPtr env_checker = si->getStateValidityChecker();
+          si->setStateValidityChecker([&](const base::State* state) {
+            const auto* se3 = state->as<base::SE3StateSpace::StateType>();
+            double pos[3] = {se3->getX(), se3->getY(), se3->getZ()};
+            double dist2 = 0.;
+            for (int k=0; k < 3; k++)
+            {
+              double d = std::max({region.low[k] - pos[k], 0., pos[k] - region.high[k]});
+              dist2 += d * d;
+            }
+            return dist2 > robot_radius * robot_radius && env_checker->isValid(state);
+          });
+          // set up again, so that SimpleSetup does not reinstall its own checker
+          si->setup();
+          geometric::PathGeometric repaired(si);
+          auto repair_t0 = Time::now();
+          base::PlannerStatus repair_status = planner->repair(previous, region, base::timedPlannerTerminationCondition(120.), repaired);
+          auto repair_t1 = Time::now();
+          repair_times.push_back(fsec(repair_t1 - repair_t0).count());
+          std::cout << "repair: " << (repair_status == base::PlannerStatus::EXACT_SOLUTION ? "valid" : "not valid")
+                    << " in " << repair_times.back() << "s, " << planner->getRepairReplannedSegments() << " of "
+                    << planner->getRepairCheckedSegments() << " checked segments replanned, "
+                    << planner->getCollisionChecks() << " collision checks" << std::endl;
+          setup.clear();
+          auto resolve_t0 = Time::now();
+          setup.solve(120);
+          auto resolve_t1 = Time::now();
+          resolve_times.push_back(fsec(resolve_t1 - resolve_t0).count());
+          std::cout << "full solve with the obstacle: " << resolve_times.back() << "s" << std::endl;
+          si->setStateValidityChecker(env_checker);
+          si->setup();
+        }
       }
     }
     // write the evaluation metrics
     std::filebuf fb;
-    fb.open(model_path+"plan_times.txt", std::ios::out);
+    fb.open(model_path+"plan_times"+suffix+".txt", std::ios::out);
     std::ostream time_f(&fb);
     //TODO: add env dimension in the vector
     for (int i=0; i < N*NP; i++)
@@ -334,7 +806,7 @@ int main()
     }
     fb.close();
 
-    fb.open(model_path+"plan_sucs.txt", std::ios::out);
+    fb.open(model_path+"plan_sucs"+suffix+".txt", std::ios::out);
     std::ostream suc_f(&fb);
     //TODO: add env dimension in the vector
     for (int i=0; i < N*NP; i++)
@@ -343,7 +815,7 @@ int main()
     }
     fb.close();
 
-    fb.open(model_path+"plan_lens.txt", std::ios::out);
+    fb.open(model_path+"plan_lens"+suffix+".txt", std::ios::out);
     std::ostream len_f(&fb);
     //TODO: add env dimension in the vector
     for (int i=0; i < N*NP; i++)
@@ -364,12 +836,124 @@ int main()
 
 
 
-    fb.open(model_path+"plan_accuracy.txt", std::ios::out);
+    fb.open(model_path+"plan_accuracy"+suffix+".txt", std::ios::out);
     std::ostream accuracy_f(&fb);
     //TODO: add env dimension in the vector
     accuracy_f << accuracy << "\n";
     fb.close();
 
+    float mean_time = 0.;
+    for (int i=0; i < plan_times.size(); i++)
+    {
+      mean_time += plan_times[i] / plan_times.size();
+    }
+    float mean_checks = 0.;
+    for (int i=0; i < plan_checks.size(); i++)
+    {
+      mean_checks += plan_checks[i] / plan_checks.size();
+    }
+    std::cout << "accuracy: " << accuracy << ", mean plan time: " << mean_time << "s" << std::endl;
+    if (!plan_times.empty())
+    {
+      std::cout << "first solve time: " << plan_times[0] << "s" << std::endl;
+      std::vector<float> sorted_times = plan_times;
+      std::sort(sorted_times.begin(), sorted_times.end());
+      std::cout << "plan time p50: " << sorted_times[sorted_times.size() / 2] << "s, p99: "
+                << sorted_times[sorted_times.size() * 99 / 100] << "s (portfolio " << portfolio << ")" << std::endl;
+    }
+    float mean_connect_iters = 0.;
+    for (int i=0; i < plan_connect_iters.size(); i++)
+    {
+      mean_connect_iters += plan_connect_iters[i] / plan_connect_iters.size();
+    }
+    std::cout << "mean iterations to connect: " << mean_connect_iters << " (k = " << connect_k << ")" << std::endl;
+    std::cout << "mean collision checks per query: " << mean_checks << (lazy ? " (lazy)" : "") << std::endl;
+    if (planner->getDistanceFieldValidator())
+    {
+      float mean_queries = 0.;
+      for (int i=0; i < plan_clearance_queries.size(); i++)
+      {
+        mean_queries += plan_clearance_queries[i] / plan_clearance_queries.size();
+      }
+      std::cout << "mean distance field queries per query: " << mean_queries << std::endl;
+    }
+    if (!plan_cache_hit_rates.empty())
+    {
+      float mean_hit_rate = 0.;
+      for (int i=0; i < plan_cache_hit_rates.size(); i++)
+      {
+        mean_hit_rate += plan_cache_hit_rates[i] / plan_cache_hit_rates.size();
+      }
+      std::cout << "mean prediction cache hit rate: " << mean_hit_rate << std::endl;
+    }
+
+    if (!repair_times.empty())
+    {
+      float mean_repair = 0., mean_resolve = 0.;
+      for (int i=0; i < repair_times.size(); i++)
+      {
+        mean_repair += repair_times[i] / repair_times.size();
+        mean_resolve += resolve_times[i] / resolve_times.size();
+      }
+      std::cout << "mean repair time: " << mean_repair << "s, mean full solve time with the obstacle: " << mean_resolve << "s" << std::endl;
+    }
+
+    if (!record_fname.empty())
+    {
+      planner->saveMLPInputs(record_fname);
+    }
+    if (!trace_fname.empty())
+    {
+      TraceRecorder::instance().save(trace_fname);
+    }
+    if (replay_log)
+    {
+      std::cout << "replay log: " << replay_log->queries().size() << " queries recorded"
+                << (replay_log->save(record_log_fname) ? "" : ", could not be saved") << std::endl;
+    }
+    if (experience)
+    {
+      int lookups, candidates, repaired;
+      experience->getStats(lookups, candidates, repaired);
+      std::cout << "experience library: " << candidates << "/" << lookups << " queries warm-started, "
+                << repaired << " repaired, " << experience->size() << " paths saved" << std::endl;
+      experience->save();
+    }
+    if (schedule)
+    {
+      const char* stage_names[ReplanSchedule::NUM_STAGES] = {"first", "early", "late"};
+      for (int s = 0; s < ReplanSchedule::NUM_STAGES; s++)
+      {
+        ReplanSchedule::Stage stage = (ReplanSchedule::Stage)s;
+        int best = schedule->getBest(stage);
+        ReplanSchedule::ArmStats stats = schedule->getStats(stage, best);
+        std::cout << "replan schedule, " << stage_names[s] << " iterations: " << schedule->getArms()[best].length_factor
+                  << "x max length at " << schedule->getArms()[best].step_factor << "x step, "
+                  << stats.feasible << "/" << stats.iterations << " feasible, " << stats.connected << " connected, "
+                  << stats.coarse_misses << " coarse misses, "
+                  << (stats.iterations > 0 ? stats.seconds / stats.iterations : 0.) << "s per iteration" << std::endl;
+      }
+      schedule->save();
+    }
+    if (model_loading.valid())
+    {
+      try
+      {
+        std::cout << "model store: version " << model_loading.get() << " published, last query planned with version "
+                  << planner->getModelVersion() << std::endl;
+      }
+      catch (const std::exception& e)
+      {
+        std::cout << "model store: the new networks could not be loaded: " << e.what() << std::endl;
+      }
+    }
+    if (trainer)
+    {
+      trainer->stop();
+      std::cout << "continual learning: " << trainer->steps() << " steps, " << trainer->projections()
+                << " GEM projections, last loss " << trainer->lastLoss() << std::endl;
+    }
+
 
 
 
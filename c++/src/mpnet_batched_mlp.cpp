@@ -0,0 +1,160 @@
+/**
+# dynamic batching of the MPNet MLP across concurrent planners
+**/
+
+#include "mpnet_batched_mlp.hpp"
+#include "mpnet_mlp_layers.hpp"
+#include <algorithm>
+#include <chrono>
+
+BatchedMLP::BatchedMLP(const torch::jit::script::Module& mlp)
+  : BatchedMLP(mlp, Options())
+{
+}
+
+BatchedMLP::BatchedMLP(const torch::jit::script::Module& mlp, const Options& options)
+  : options_(options)
+{
+    for (const MLPLayerParams& params : mlpLayerParams(mlp, options_.device, "BatchedMLP"))
+    {
+        Layer layer;
+        layer.weight = params.weight;
+        layer.bias = params.bias;
+        layer.prelu = params.prelu;
+        layer.dropout = params.dropout;
+        layers_.push_back(layer);
+    }
+    input_size_ = layers_.front().weight.size(1);
+    output_size_ = layers_.back().weight.size(0);
+    worker_ = std::thread(&BatchedMLP::run, this);
+}
+
+BatchedMLP::~BatchedMLP()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cond_.notify_all();
+    worker_.join();
+}
+
+void BatchedMLP::predict(const float* input, float* output)
+{
+    Request request{input, output, std::promise<void>()};
+    std::future<void> done = request.done.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.push_back(&request);
+    }
+    cond_.notify_one();
+    done.get();
+}
+
+void BatchedMLP::predict(const float* inputs, int n, float* outputs)
+{
+    std::vector<Request> requests(n);
+    std::vector<std::future<void>> done;
+    for (int i = 0; i < n; i++)
+    {
+        requests[i].input = inputs + i * input_size_;
+        requests[i].output = outputs + i * output_size_;
+        done.push_back(requests[i].done.get_future());
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (Request& request : requests)
+            pending_.push_back(&request);
+    }
+    cond_.notify_one();
+    // every request is waited for before rethrowing, the batching thread still points to them
+    std::exception_ptr error;
+    for (std::future<void>& f : done)
+    {
+        try
+        {
+            f.get();
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+long BatchedMLP::forwards() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return forwards_;
+}
+
+long BatchedMLP::requests() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return requests_;
+}
+
+void BatchedMLP::run()
+{
+    while (true)
+    {
+        std::vector<Request*> batch;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this]() { return !running_ || !pending_.empty(); });
+            if (pending_.empty())
+                return;
+            // the first input waits at most max_wait_us for the batch to fill up
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(options_.max_wait_us);
+            cond_.wait_until(lock, deadline, [this]() {
+                return !running_ || pending_.size() >= (std::size_t)options_.max_batch;
+            });
+            std::size_t n = std::min(pending_.size(), (std::size_t)options_.max_batch);
+            batch.assign(pending_.begin(), pending_.begin() + n);
+            pending_.erase(pending_.begin(), pending_.begin() + n);
+            forwards_ += 1;
+            requests_ += n;
+        }
+        try
+        {
+            forward(batch);
+        }
+        catch (...)
+        {
+            for (Request* request : batch)
+                request->done.set_exception(std::current_exception());
+            continue;
+        }
+        for (Request* request : batch)
+            request->done.set_value();
+    }
+}
+
+void BatchedMLP::forward(const std::vector<Request*>& batch)
+{
+    torch::NoGradGuard no_grad;
+    int64_t n = batch.size();
+    std::vector<float> inputs(n * input_size_);
+    for (int64_t i = 0; i < n; i++)
+        std::copy(batch[i]->input, batch[i]->input + input_size_, inputs.begin() + i * input_size_);
+    torch::Tensor x = torch::from_blob(inputs.data(), {n, (int64_t)input_size_}).to(options_.device);
+    float keep = 1 - options_.dropout_p;
+    for (const Layer& layer : layers_)
+    {
+        x = torch::linear(x, layer.weight, layer.bias);
+        if (layer.prelu.defined())
+            x = torch::prelu(x, layer.prelu);
+        if (layer.dropout)
+        {
+            // one mask per row, scaled like the annotated forward
+            torch::Tensor mask = torch::bernoulli(torch::full({n, x.size(1)}, keep, x.options()));
+            x = x * mask * (1.f / keep);
+        }
+    }
+    torch::Tensor res = x.to(at::kCPU).contiguous();
+    const float* out = res.data_ptr<float>();
+    for (int64_t i = 0; i < n; i++)
+        std::copy(out + i * output_size_, out + (i + 1) * output_size_, batch[i]->output);
+}
@@ -0,0 +1,357 @@
+/**
+* ompl::tools::Benchmark of MPNetPlanner against RRTConnect, BIT* and informed RRT* on start/goal
+* queries replayed from the path dataset. One log file is written per scene and query, e.g.
+*   ompl_benchmark_statistics.py <out dir>/<scene>_<index>.log ... -d mpnet.db
+* merges them into the benchmark database (plannerarena.org reads it).
+**/
+#include <omplapp/apps/SE3RigidBodyPlanning.h>
+#include <omplapp/config.h>
+#include <ompl/base/spaces/SE3StateSpace.h>
+#include <ompl/geometric/planners/rrt/RRTConnect.h>
+#include <ompl/geometric/planners/rrt/InformedRRTstar.h>
+#include <ompl/geometric/planners/informedtrees/BITstar.h>
+#include <ompl/tools/benchmark/Benchmark.h>
+#include "mpnet_planner.hpp"
+#include "mpnet_voxelizer.hpp"
+#include "mpnet_two_tier_checker.hpp"
+#include "mpnet_perf_counters.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define STATE_N 7
+
+using namespace ompl;
+
+namespace
+{
+    /** \brief A scene of the benchmark. Scenes other than home are voxelized from their environment
+        mesh, and can come with networks of their own. */
+    struct Scene
+    {
+        std::string name;
+        std::string env_fname;
+        std::string path_dir;
+        std::string mlp_fname;
+        std::string encoder_fname;
+    };
+
+    /** \brief start and goal of each path file that has at least two states */
+    std::vector<std::pair<int, std::vector<std::vector<float>>>> loadQueries(const std::string& path_dir, int first, int n)
+    {
+        std::vector<std::pair<int, std::vector<std::vector<float>>>> queries;
+        for (int path_idx = first; path_idx < first + n; path_idx++)
+        {
+            std::ifstream infile(path_dir + "path_" + std::to_string(path_idx) + ".txt");
+            std::string line;
+            std::vector<std::vector<float>> path;
+            while (getline(infile, line))
+            {
+                if (line.empty())
+                    continue;
+                std::vector<float> state(STATE_N);
+                std::stringstream ss(line);
+                for (int i = 0; i < STATE_N; i++)
+                    ss >> state[i];
+                path.push_back(state);
+            }
+            if (path.size() < 2)
+                continue;
+            queries.emplace_back(path_idx, std::vector<std::vector<float>>{path.front(), path.back()});
+        }
+        return queries;
+    }
+
+    void setSE3State(const std::vector<float>& vec, base::State* state)
+    {
+        auto* se3 = state->as<base::SE3StateSpace::StateType>();
+        se3->setXYZ(vec[0], vec[1], vec[2]);
+        double norm = std::sqrt(vec[3]*vec[3] + vec[4]*vec[4] + vec[5]*vec[5] + vec[6]*vec[6]);
+        se3->rotation().x = vec[3] / norm;
+        se3->rotation().y = vec[4] / norm;
+        se3->rotation().z = vec[5] / norm;
+        se3->rotation().w = vec[6] / norm;
+    }
+
+    /** \brief Share of \e n uniform states decided by each tier of \e checker, its agreement with the
+        exact checker and the speedup over it */
+    void reportTwoTier(const std::string& scene, const base::SpaceInformationPtr& si, TwoTierValidityChecker& checker, int n)
+    {
+        base::StateSamplerPtr sampler = si->allocStateSampler();
+        std::vector<base::State*> states(n);
+        for (base::State*& state : states)
+        {
+            state = si->allocState();
+            sampler->sampleUniform(state);
+        }
+        std::vector<bool> exact(n);
+        auto exact_t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; i++)
+            exact[i] = checker.getExactChecker()->isValid(states[i]);
+        auto exact_t1 = std::chrono::steady_clock::now();
+        checker.resetCounts();
+        int mismatches = 0;
+        for (int i = 0; i < n; i++)
+            mismatches += checker.isValid(states[i]) != exact[i];
+        auto two_tier_t1 = std::chrono::steady_clock::now();
+        TwoTierValidityChecker::Counts counts = checker.getCounts();
+        double exact_time = std::chrono::duration<double>(exact_t1 - exact_t0).count();
+        double two_tier_time = std::chrono::duration<double>(two_tier_t1 - exact_t1).count();
+        std::cout << scene << ": two-tier check of " << n << " uniform states: " << 100. * counts.free / n << "% free, "
+                  << 100. * counts.colliding / n << "% colliding, " << 100. * counts.exact / n << "% to FCL, "
+                  << mismatches << " answers differ, speedup " << exact_time / two_tier_time << std::endl;
+        si->freeStates(states);
+        checker.resetCounts();
+    }
+
+    /** \brief hardware counters of the phases of the run, e.g. "perf lvc llc misses INTEGER"; the
+        phases are inclusive, so iteration contains the predict, isValid and checkMotion counts */
+    void addPerfProperties(tools::Benchmark::RunProperties& run)
+    {
+        std::map<std::string, PerfRecorder::PhaseCounts> totals = PerfRecorder::instance().totals();
+        for (const char* phase : {"predict", "predict_batch", "isValid", "checkMotion", "lvc", "iteration"})
+        {
+            const PerfRecorder::PhaseCounts& counts = totals[phase];
+            std::string prefix = std::string("perf ") + phase + " ";
+            run[prefix + "calls INTEGER"] = std::to_string(counts.calls);
+            for (int c = 0; c < PerfRecorder::NUM_COUNTERS; c++)
+            {
+                if (PerfRecorder::instance().available((PerfRecorder::Counter)c))
+                    run[prefix + PerfRecorder::counterName((PerfRecorder::Counter)c) + " INTEGER"] =
+                        std::to_string(counts.values[c]);
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    // command line options:
+    //   --scene=<name>,<env mesh>,<path dir>[,<mlp>,<encoder>]  add a scene (e.g. a box world);
+    //                        the home scene is benchmarked when no scene is given
+    //   --first=<i>          index of the first path file of each scene
+    //   --queries=<n>        number of path files per scene
+    //   --runs=<n>           runs of every planner on each query
+    //   --time=<s>           time limit of a run
+    //   --segment-time=<s>   time limit of the local replanning of one segment by MPNet (0: none)
+    //   --cache=<k>          prediction cache pool of MPNet (0: no cache)
+    //   --two-tier=<n>       check states against an n^3 distance field and triangle buckets before FCL
+    //   --schedule=<dir>     MPNet learns its replanning schedule, kept in <dir>/<scene>.schedule
+    //   --perf               hardware counters of the MPNet phases in the run properties
+    //   --out=<dir>          directory of the log files
+    std::vector<Scene> scenes;
+    int first = 2196;
+    int n_queries = 10;
+    int runs = 10;
+    double max_time = 20.;
+    double segment_time = 0.;
+    int cache_pool = 0;
+    int two_tier_grid = 0;
+    bool perf = false;
+    std::string schedule_dir = "";
+    std::string out_dir = "./";
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (arg.compare(0, 8, "--scene=") == 0)
+        {
+            std::vector<std::string> fields;
+            std::stringstream ss(arg.substr(8));
+            std::string item;
+            while (getline(ss, item, ','))
+                fields.push_back(item);
+            if (fields.size() != 3 && fields.size() != 5)
+            {
+                std::cout << "expected --scene=<name>,<env mesh>,<path dir>[,<mlp>,<encoder>]" << std::endl;
+                return 1;
+            }
+            Scene scene = {fields[0], fields[1], fields[2], "", ""};
+            if (fields.size() == 5)
+            {
+                scene.mlp_fname = fields[3];
+                scene.encoder_fname = fields[4];
+            }
+            scenes.push_back(scene);
+        }
+        else if (arg.compare(0, 8, "--first=") == 0)
+            first = std::stoi(arg.substr(8));
+        else if (arg.compare(0, 10, "--queries=") == 0)
+            n_queries = std::stoi(arg.substr(10));
+        else if (arg.compare(0, 7, "--runs=") == 0)
+            runs = std::stoi(arg.substr(7));
+        else if (arg.compare(0, 7, "--time=") == 0)
+            max_time = std::stod(arg.substr(7));
+        else if (arg.compare(0, 15, "--segment-time=") == 0)
+            segment_time = std::stod(arg.substr(15));
+        else if (arg.compare(0, 8, "--cache=") == 0)
+            cache_pool = std::stoi(arg.substr(8));
+        else if (arg.compare(0, 11, "--two-tier=") == 0)
+            two_tier_grid = std::stoi(arg.substr(11));
+        else if (arg.compare(0, 11, "--schedule=") == 0)
+            schedule_dir = arg.substr(11) + "/";
+        else if (arg == "--perf")
+            perf = true;
+        else if (arg.compare(0, 6, "--out=") == 0)
+            out_dir = arg.substr(6) + "/";
+    }
+    if (scenes.empty())
+    {
+        scenes.push_back({"home", std::string(OMPLAPP_RESOURCE_DIR) + "/3D/Home_env.dae",
+                          "/media/arclabdl1/HD1/YLmiao/data/home/paths/", "", ""});
+    }
+    if (perf)
+    {
+        perf = PerfRecorder::instance().enable(true);
+        if (!perf)
+            std::cout << "hardware counters are not available (perf_event_open failed, see "
+                      << "/proc/sys/kernel/perf_event_paranoid), running without them" << std::endl;
+        for (int c = 0; perf && c < PerfRecorder::NUM_COUNTERS; c++)
+            if (!PerfRecorder::instance().available((PerfRecorder::Counter)c))
+                std::cout << PerfRecorder::counterName((PerfRecorder::Counter)c) << " counter is not available" << std::endl;
+    }
+    std::string robot_fname = std::string(OMPLAPP_RESOURCE_DIR) + "/3D/Home_robot.dae";
+
+    for (const Scene& scene : scenes)
+    {
+        std::vector<std::pair<int, std::vector<std::vector<float>>>> queries = loadQueries(scene.path_dir, first, n_queries);
+        if (queries.empty())
+        {
+            std::cout << scene.name << ": no queries found in " << scene.path_dir << std::endl;
+            continue;
+        }
+
+        app::SE3RigidBodyPlanning setup;
+        setup.setRobotMesh(robot_fname);
+        setup.setEnvironmentMesh(scene.env_fname);
+        // setting collision checking resolution to 1% of the space extent
+        setup.getSpaceInformation()->setStateValidityCheckingResolution(0.01);
+
+        // the networks are loaded once per scene and kept across queries and runs
+        MPNetPlanner::StartupOptions startup;
+        if (!scene.mlp_fname.empty())
+        {
+            startup.mlp_fname = scene.mlp_fname;
+            startup.encoder_fname = scene.encoder_fname;
+        }
+        MPNetPlanner* mpnet = new MPNetPlanner(setup.getSpaceInformation(), false, 1001, 3000, startup);
+        base::PlannerPtr mpnet_ptr(mpnet);
+        mpnet->setSegmentTimeLimit(segment_time);
+        mpnet->setPredictionCache(cache_pool);
+        std::shared_ptr<ReplanSchedule> schedule;
+        if (!schedule_dir.empty())
+        {
+            schedule = std::make_shared<ReplanSchedule>(schedule_dir + scene.name + ".schedule");
+            mpnet->setReplanSchedule(schedule);
+        }
+        if (scene.name != "home")
+        {
+            // the home grid is the offline one the encoder was trained on, other scenes are voxelized here
+            std::vector<Triangle3> triangles;
+            if (!Voxelizer::loadMesh(scene.env_fname, triangles))
+            {
+                std::cout << "could not load the mesh " << scene.env_fname << std::endl;
+                return 1;
+            }
+            std::vector<float> lower, upper;
+            Voxelizer::triangleBounds(triangles, lower, upper);
+            mpnet->setObstacleVoxels(Voxelizer(lower, upper).fromTriangles(triangles));
+        }
+        std::shared_ptr<TwoTierValidityChecker> two_tier;
+        if (two_tier_grid > 0)
+        {
+            // setup() infers the bounds and installs the FCL checker the tiers fall back to
+            setup.setStartAndGoalStates(setup.getDefaultStartState(), setup.getDefaultStartState());
+            setup.setup();
+            base::SpaceInformationPtr si = setup.getSpaceInformation();
+            std::vector<Triangle3> env_triangles, robot_triangles;
+            if (!Voxelizer::loadMesh(scene.env_fname, env_triangles))
+            {
+                std::cout << "could not load the mesh " << scene.env_fname << std::endl;
+                return 1;
+            }
+            if (!Voxelizer::loadMesh(robot_fname, robot_triangles))
+            {
+                std::cout << "could not load the mesh " << robot_fname << std::endl;
+                return 1;
+            }
+            aiVector3D center = setup.getRobotCenter(0);
+            Point3 shift = {center.x, center.y, center.z};
+            auto field = std::make_shared<DistanceField>(env_triangles, two_tier_grid);
+            two_tier = std::make_shared<TwoTierValidityChecker>(
+                si, si->getStateValidityChecker(), field, DistanceFieldMotionValidator::coverMesh(robot_triangles, shift),
+                env_triangles, robot_triangles, shift);
+            reportTwoTier(scene.name, si, *two_tier, 10000);
+        }
+        std::vector<base::PlannerPtr> planners = {
+            mpnet_ptr,
+            std::make_shared<geometric::RRTConnect>(setup.getSpaceInformation()),
+            std::make_shared<geometric::BITstar>(setup.getSpaceInformation()),
+            std::make_shared<geometric::InformedRRTstar>(setup.getSpaceInformation())};
+
+        for (const auto& query : queries)
+        {
+            base::ScopedState<base::SE3StateSpace> start(setup.getSpaceInformation());
+            base::ScopedState<base::SE3StateSpace> goal(setup.getSpaceInformation());
+            setSE3State(query.second[0], start.get());
+            setSE3State(query.second[1], goal.get());
+            setup.setStartAndGoalStates(start, goal);
+
+            tools::Benchmark benchmark(setup, scene.name + "_" + std::to_string(query.first));
+            benchmark.addExperimentParameter("scene", "VARCHAR(128)", scene.name);
+            benchmark.addExperimentParameter("path_index", "INTEGER", std::to_string(query.first));
+            for (const base::PlannerPtr& planner : planners)
+                benchmark.addPlanner(planner);
+            // per-run totals of MPNet next to the sampled progress properties, and for every planner
+            // how far the run went past the time limit
+            if (two_tier || perf)
+            {
+                benchmark.setPreRunEvent([&setup, two_tier, perf](const base::PlannerPtr&) {
+                    // a setup() of the benchmark may have installed the FCL checker again
+                    if (two_tier && setup.getSpaceInformation()->getStateValidityChecker() != two_tier)
+                        setup.getSpaceInformation()->setStateValidityChecker(two_tier);
+                    if (two_tier)
+                        two_tier->resetCounts();
+                    if (perf)
+                        PerfRecorder::instance().reset();
+                });
+            }
+            benchmark.setPostRunEvent([max_time, two_tier, perf](const base::PlannerPtr& planner, tools::Benchmark::RunProperties& run) {
+                auto time = run.find("time REAL");
+                if (time != run.end())
+                    run["timeout overshoot REAL"] = std::to_string(std::max(0., std::stod(time->second) - max_time));
+                if (auto* mpnet = dynamic_cast<MPNetPlanner*>(planner.get()))
+                {
+                    run["collision checks INTEGER"] = std::to_string(mpnet->getCollisionChecks());
+                    run["mean connect iterations REAL"] = std::to_string(mpnet->getMeanConnectIterations());
+                    run["prediction cache hit rate REAL"] = std::to_string(mpnet->getPredictionCacheHitRate());
+                    if (perf)
+                        addPerfProperties(run);
+                }
+                if (two_tier)
+                {
+                    TwoTierValidityChecker::Counts counts = two_tier->getCounts();
+                    unsigned long checks = counts.free + counts.colliding + counts.exact;
+                    run["two-tier resolved REAL"] = std::to_string(checks > 0 ? 1. - (double)counts.exact / checks : 0.);
+                    run["two-tier exact checks INTEGER"] = std::to_string(counts.exact);
+                }
+            });
+
+            tools::Benchmark::Request request(max_time, 4096., runs);
+            request.displayProgress = false;
+            benchmark.benchmark(request);
+            std::string log_fname = out_dir + scene.name + "_" + std::to_string(query.first) + ".log";
+            benchmark.saveResultsToFile(log_fname.c_str());
+            std::cout << scene.name << " query " << query.first << ": results in " << log_fname << std::endl;
+        }
+        if (schedule)
+            schedule->save();
+    }
+    return 0;
+}
@@ -0,0 +1,344 @@
+/**
+# background GEM fine-tuning of the MPNet MLP from solved queries
+**/
+
+#include "mpnet_continual_trainer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+ContinualTrainer::ContinualTrainer(const std::string& mlp_fname)
+  : ContinualTrainer(mlp_fname, Options())
+{
+}
+
+ContinualTrainer::ContinualTrainer(const std::string& mlp_fname, const Options& options)
+  : options_(options)
+  , mlp_(torch::jit::load(mlp_fname))
+  , gen_(std::random_device{}())
+{
+    mlp_.to(options_.device);
+    mlp_.train();
+    for (const auto& param : mlp_.named_parameters(/*recurse=*/true))
+    {
+        torch::Tensor p = param.value;
+        p.set_requires_grad(true);
+        params_.push_back(p);
+        if (p.dim() == 2)
+        {
+            // first and last Linear layers give the MLP input and output size
+            if (input_size_ == 0)
+                input_size_ = p.size(1);
+            output_size_ = p.size(0);
+        }
+    }
+    opt_ = std::make_shared<torch::optim::SGD>(
+        params_, torch::optim::SGDOptions(options_.learning_rate).momentum(options_.momentum));
+}
+
+ContinualTrainer::~ContinualTrainer()
+{
+    stop();
+}
+
+void ContinualTrainer::start()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_)
+        return;
+    running_ = true;
+    worker_ = std::thread(&ContinualTrainer::run, this);
+}
+
+void ContinualTrainer::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_)
+            return;
+        running_ = false;
+    }
+    cond_.notify_all();
+    worker_.join();
+}
+
+void ContinualTrainer::addDemonstration(int task, const std::vector<float>& obs_enc,
+                                        const std::vector<std::vector<float>>& path)
+{
+    if (path.size() < 2)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back({task, obs_enc, path});
+        if (queue_.size() > options_.max_queue)
+            queue_.pop_front();
+    }
+    cond_.notify_one();
+}
+
+std::shared_ptr<const ContinualTrainer::Published> ContinualTrainer::takePublished(int& version)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (version_ <= version)
+        return nullptr;
+    version = version_;
+    return published_;
+}
+
+void ContinualTrainer::setInt8Calibration(const std::vector<std::vector<float>>& samples, float max_deviation)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    int8_calib_ = samples;
+    int8_max_deviation_ = max_deviation;
+}
+
+int ContinualTrainer::steps() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return steps_;
+}
+
+int ContinualTrainer::projections() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return projections_;
+}
+
+float ContinualTrainer::lastLoss() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return last_loss_;
+}
+
+void ContinualTrainer::run()
+{
+    while (true)
+    {
+        std::vector<Demonstration> demos;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this]() { return !running_ || !queue_.empty(); });
+            if (!running_)
+                return;
+            demos.assign(queue_.begin(), queue_.end());
+            queue_.clear();
+        }
+        for (const Demonstration& demo : demos)
+        {
+            // next-state samples in both directions, as built by data_loader_home.load_dataset
+            std::vector<float> inputs, labels;
+            const auto& path = demo.path;
+            int n = path.size();
+            auto add_sample = [&](int from, int goal, int next) {
+                inputs.insert(inputs.end(), demo.obs_enc.begin(), demo.obs_enc.end());
+                inputs.insert(inputs.end(), path[from].begin(), path[from].end());
+                inputs.insert(inputs.end(), path[goal].begin(), path[goal].end());
+                labels.insert(labels.end(), path[next].begin(), path[next].end());
+            };
+            for (int m = 0; m < n - 1; m++)
+                add_sample(m, n - 1, m + 1);
+            for (int m = 1; m < n; m++)
+                add_sample(m, 0, m - 1);
+            if (inputs.size() != (std::size_t)(2 * (n - 1)) * input_size_)
+                continue;
+            train(demo.task, inputs, labels);
+            bool publish_now;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                steps_ += 1;
+                publish_now = steps_ % options_.publish_every == 0;
+            }
+            if (publish_now)
+                publish();
+        }
+    }
+}
+
+torch::Tensor ContinualTrainer::loss(const torch::Tensor& inputs, const torch::Tensor& labels)
+/**
+* pose_loss of End2EndMPNet: position MSE and MSE of the normalized orientation
+**/
+{
+    std::vector<torch::jit::IValue> mlp_input;
+    mlp_input.push_back(inputs);
+    torch::Tensor pred = mlp_.forward(mlp_input).toTensor();
+    torch::Tensor pos_loss = torch::mse_loss(pred.narrow(1, 0, 3), labels.narrow(1, 0, 3));
+    torch::Tensor pred_ori = pred.narrow(1, 3, 4);
+    pred_ori = pred_ori / pred_ori.norm(2, {1}, true).clamp_min(1e-4).expand_as(pred_ori);
+    torch::Tensor ori_loss = torch::mse_loss(pred_ori, labels.narrow(1, 3, 4));
+    float beta = 0.4;
+    return pos_loss * (1 - beta) + ori_loss * beta;
+}
+
+torch::Tensor ContinualTrainer::taskLoss(int task)
+{
+    Memory& memory = memories_[task];
+    torch::Tensor inputs = torch::from_blob(memory.inputs.data(), {memory.count, input_size_}).clone();
+    torch::Tensor labels = torch::from_blob(memory.labels.data(), {memory.count, output_size_}).clone();
+    return loss(inputs.to(options_.device), labels.to(options_.device));
+}
+
+void ContinualTrainer::train(int task, const std::vector<float>& inputs, const std::vector<float>& labels)
+/**
+* GEM observe(): gradients on the memory of every observed task act as constraints on the
+* gradient of the new samples, which is projected when it conflicts with any of them
+**/
+{
+    int n = labels.size() / output_size_;
+    torch::Tensor x = torch::from_blob((void*)inputs.data(), {n, input_size_}).clone().to(options_.device);
+    torch::Tensor y = torch::from_blob((void*)labels.data(), {n, output_size_}).clone().to(options_.device);
+    float step_loss = 0.f;
+    bool projected = false;
+    for (int step = 0; step < options_.grad_step; step++)
+    {
+        std::vector<torch::Tensor> mem_grads;
+        for (int t : observed_tasks_)
+        {
+            if (memories_[t].count == 0)
+                continue;
+            opt_->zero_grad();
+            taskLoss(t).backward();
+            mem_grads.push_back(flatGrad());
+        }
+
+        opt_->zero_grad();
+        torch::Tensor l = loss(x, y);
+        l.backward();
+        step_loss = l.item<float>();
+
+        if (!mem_grads.empty())
+        {
+            torch::Tensor g = flatGrad();
+            torch::Tensor G = torch::stack(mem_grads);
+            torch::Tensor dotp = torch::mv(G, g);
+            if (dotp.min().item<float>() < 0)
+            {
+                int t = mem_grads.size();
+                torch::Tensor P = torch::mm(G, G.t()).to(at::kCPU).to(at::kDouble).contiguous();
+                torch::Tensor q = dotp.to(at::kCPU).to(at::kDouble).contiguous();
+                std::vector<double> P_vec(P.data_ptr<double>(), P.data_ptr<double>() + t * t);
+                std::vector<double> q_vec(q.data_ptr<double>(), q.data_ptr<double>() + t);
+                for (int i = 0; i < t; i++)
+                    P_vec[i * t + i] += 1e-3;
+                std::vector<double> v = solveDual(P_vec, q_vec, t, options_.memory_strength);
+                std::vector<float> v_float(v.begin(), v.end());
+                torch::Tensor v_tensor = torch::from_blob(v_float.data(), {t}).clone().to(options_.device);
+                torch::Tensor projected_g = torch::mv(G.t(), v_tensor) + g;
+                // keep the norm of the original gradient, as the python implementation does
+                projected_g = projected_g * (g.norm().item<float>() / std::max(projected_g.norm().item<float>(), 1e-12f));
+                setFlatGrad(projected_g);
+                projected = true;
+            }
+        }
+        opt_->step();
+    }
+    remember(task, inputs, labels);
+    std::lock_guard<std::mutex> lock(mutex_);
+    last_loss_ = step_loss;
+    projections_ += projected;
+}
+
+void ContinualTrainer::remember(int task, const std::vector<float>& inputs, const std::vector<float>& labels)
+/**
+* reservoir sampling: the i-th sample of a task is kept with probability min(n_memories / i, 1)
+**/
+{
+    if (task >= memories_.size())
+        memories_.resize(task + 1);
+    if (std::find(observed_tasks_.begin(), observed_tasks_.end(), task) == observed_tasks_.end())
+        observed_tasks_.push_back(task);
+    Memory& memory = memories_[task];
+    memory.inputs.resize(options_.n_memories * input_size_);
+    memory.labels.resize(options_.n_memories * output_size_);
+    int n = labels.size() / output_size_;
+    for (int i = 0; i < n; i++)
+    {
+        memory.seen += 1;
+        int slot = std::uniform_int_distribution<int>(0, memory.seen - 1)(gen_);
+        if (slot >= options_.n_memories)
+            continue;
+        if (memory.count < options_.n_memories)
+            slot = memory.count++;
+        std::copy(inputs.begin() + i * input_size_, inputs.begin() + (i + 1) * input_size_,
+                  memory.inputs.begin() + slot * input_size_);
+        std::copy(labels.begin() + i * output_size_, labels.begin() + (i + 1) * output_size_,
+                  memory.labels.begin() + slot * output_size_);
+    }
+}
+
+torch::Tensor ContinualTrainer::flatGrad() const
+{
+    std::vector<torch::Tensor> grads;
+    for (const torch::Tensor& p : params_)
+    {
+        if (p.grad().defined())
+            grads.push_back(p.grad().view({-1}));
+        else
+            grads.push_back(torch::zeros({p.numel()}, torch::TensorOptions().device(options_.device)));
+    }
+    return torch::cat(grads);
+}
+
+void ContinualTrainer::setFlatGrad(const torch::Tensor& grad)
+{
+    int64_t offset = 0;
+    for (torch::Tensor& p : params_)
+    {
+        int64_t n = p.numel();
+        if (p.grad().defined())
+            p.grad().copy_(grad.narrow(0, offset, n).view_as(p));
+        offset += n;
+    }
+}
+
+void ContinualTrainer::publish()
+{
+    // an independent copy, so that training can go on while the planner uses the snapshot
+    std::stringstream buffer;
+    mlp_.save(buffer);
+    auto published = std::make_shared<Published>();
+    published->mlp = std::make_shared<torch::jit::script::Module>(torch::jit::load(buffer));
+    std::vector<std::vector<float>> calib;
+    float max_deviation;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        calib = int8_calib_;
+        max_deviation = int8_max_deviation_;
+    }
+    if (!calib.empty())
+    {
+        // quantized once here rather than by every planner in its next solve
+        auto qmlp = std::make_shared<QuantizedMLP>(*published->mlp);
+        qmlp->calibrate(calib);
+        published->int8_deviation = qmlp->evaluate(calib);
+        if (qmlp->isCalibrated() && published->int8_deviation.max_abs <= max_deviation)
+            published->qmlp = qmlp;
+    }
+    // the planners share the snapshot and must not move it
+    published->mlp->to(options_.publish_device);
+    std::lock_guard<std::mutex> lock(mutex_);
+    published_ = published;
+    version_ += 1;
+}
+
+std::vector<double> ContinualTrainer::solveDual(const std::vector<double>& P, const std::vector<double>& q, int t,
+                                                double margin)
+{
+    std::vector<double> v(t, margin);
+    for (int sweep = 0; sweep < 200; sweep++)
+    {
+        double change = 0.;
+        for (int i = 0; i < t; i++)
+        {
+            double grad = q[i];
+            for (int j = 0; j < t; j++)
+                grad += P[i * t + j] * v[j];
+            double vi = std::max(margin, v[i] - grad / P[i * t + i]);
+            change = std::max(change, std::fabs(vi - v[i]));
+            v[i] = vi;
+        }
+        if (change < 1e-10)
+            break;
+    }
+    return v;
+}
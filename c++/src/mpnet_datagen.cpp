@@ -0,0 +1,252 @@
+/**
+* Generates demonstration paths for training: random valid start/goal pairs of a scene are solved
+* with an asymptotically optimal OMPL planner under a time budget, optionally shortcut, and
+* appended to a packed PathDataset (and/or written as <path dir>/path_<index>.txt, the files
+* home_ompl.cpp and data_loader_home.py read). Queries are spread over worker threads, each with
+* its own planning context. Path indices already in the dataset are skipped, so an interrupted
+* run is resumed by starting it again with the same arguments.
+**/
+#include <omplapp/apps/SE3RigidBodyPlanning.h>
+#include <omplapp/config.h>
+#include <ompl/base/spaces/SE3StateSpace.h>
+#include <ompl/geometric/PathSimplifier.h>
+#include <ompl/geometric/planners/rrt/RRTstar.h>
+#include <ompl/geometric/planners/rrt/InformedRRTstar.h>
+#include <ompl/geometric/planners/informedtrees/BITstar.h>
+#include <ompl/util/RandomNumbers.h>
+#include "mpnet_path_dataset.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace ompl;
+
+namespace
+{
+    /** \brief A scene to generate paths in; its environment id is its position on the command line */
+    struct Scene
+    {
+        std::string name;
+        std::string env_fname;
+        std::string path_dir;
+    };
+
+    struct Options
+    {
+        int first{0};
+        int n_paths{100};
+        double max_time{10.};
+        std::string planner{"bitstar"};
+        bool shortcut{false};
+        bool text{false};
+        std::uint_fast32_t seed{1};
+    };
+
+    base::PlannerPtr allocPlanner(const std::string& name, const base::SpaceInformationPtr& si)
+    {
+        if (name == "rrtstar")
+            return std::make_shared<geometric::RRTstar>(si);
+        if (name == "informedrrtstar")
+            return std::make_shared<geometric::InformedRRTstar>(si);
+        return std::make_shared<geometric::BITstar>(si);
+    }
+
+    /** \brief uniform valid state in the bounds of the space, false after \e attempts invalid draws */
+    bool sampleValid(const base::SpaceInformationPtr& si, RNG& rng, base::State* state, int attempts = 1000)
+    {
+        const base::RealVectorBounds& bounds = si->getStateSpace()->as<base::SE3StateSpace>()->getBounds();
+        auto* se3 = state->as<base::SE3StateSpace::StateType>();
+        for (int i = 0; i < attempts; i++)
+        {
+            se3->setXYZ(rng.uniformReal(bounds.low[0], bounds.high[0]), rng.uniformReal(bounds.low[1], bounds.high[1]),
+                        rng.uniformReal(bounds.low[2], bounds.high[2]));
+            double q[4];
+            rng.quaternion(q);
+            se3->rotation().x = q[0];
+            se3->rotation().y = q[1];
+            se3->rotation().z = q[2];
+            se3->rotation().w = q[3];
+            if (si->isValid(state))
+                return true;
+        }
+        return false;
+    }
+
+    std::vector<float> stateToVector(const base::State* state)
+    {
+        const auto* se3 = state->as<base::SE3StateSpace::StateType>();
+        return {(float)se3->getX(), (float)se3->getY(), (float)se3->getZ(), (float)se3->rotation().x,
+                (float)se3->rotation().y, (float)se3->rotation().z, (float)se3->rotation().w};
+    }
+
+    std::string pathFilename(const Scene& scene, int index)
+    {
+        return scene.path_dir + "path_" + std::to_string(index) + ".txt";
+    }
+
+    /** \brief solve the path indices handed out by \e next until \e end */
+    void generate(const Scene& scene, int env_id, const Options& options, std::atomic<int>& next, int end,
+                  PathDataset* dataset, std::atomic<int>& solved, std::atomic<int>& failed, std::mutex& print_mutex)
+    {
+        app::SE3RigidBodyPlanning setup;
+        setup.setRobotMesh(std::string(OMPLAPP_RESOURCE_DIR) + "/3D/Home_robot.dae");
+        setup.setEnvironmentMesh(scene.env_fname);
+        setup.getSpaceInformation()->setStateValidityCheckingResolution(0.01);
+        setup.setPlanner(allocPlanner(options.planner, setup.getSpaceInformation()));
+        // setup() infers the bounds from the environment and installs the collision checker
+        setup.setStartAndGoalStates(setup.getDefaultStartState(), setup.getDefaultStartState());
+        setup.setup();
+        const base::SpaceInformationPtr& si = setup.getSpaceInformation();
+        geometric::PathSimplifier simplifier(si);
+
+        for (int index = next++; index < end; index = next++)
+        {
+            if (dataset != nullptr ? dataset->contains(env_id, index)
+                                   : options.text && std::ifstream(pathFilename(scene, index)).good())
+                continue;
+            // the queries of an index do not depend on the thread or on the other indices
+            RNG rng(options.seed + 1000003u * env_id + index);
+            base::ScopedState<base::SE3StateSpace> start(si), goal(si);
+            PathDataset::Record record{env_id, index, {}};
+            if (sampleValid(si, rng, start.get()) && sampleValid(si, rng, goal.get()))
+            {
+                setup.clear();
+                setup.setStartAndGoalStates(start, goal);
+                if (setup.solve(options.max_time) == base::PlannerStatus::EXACT_SOLUTION)
+                {
+                    geometric::PathGeometric& path = setup.getSolutionPath();
+                    if (options.shortcut)
+                        simplifier.shortcutPath(path);
+                    for (std::size_t i = 0; i < path.getStateCount(); i++)
+                        record.path.push_back(stateToVector(path.getState(i)));
+                }
+            }
+            // unsolved queries are kept as empty paths, the loaders skip them and a resumed run does not retry them
+            (record.path.size() >= 2 ? solved : failed) += 1;
+            if (dataset != nullptr)
+                dataset->append(record);
+            if (options.text)
+            {
+                std::ofstream outfile(pathFilename(scene, index));
+                for (const auto& state : record.path)
+                {
+                    for (int i = 0; i < state.size(); i++)
+                        outfile << (i > 0 ? " " : "") << state[i];
+                    outfile << "\n";
+                }
+            }
+            std::lock_guard<std::mutex> lock(print_mutex);
+            std::cout << scene.name << " path " << index << ": "
+                      << (record.path.size() >= 2 ? std::to_string(record.path.size()) + " states" : "not solved")
+                      << std::endl;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    // command line options:
+    //   --scene=<name>,<env mesh>,<path dir>  add a scene; the home scene is used when none is given
+    //   --first=<i>          index of the first path of each scene
+    //   --paths=<n>          number of paths per scene
+    //   --threads=<t>        worker threads (default: hardware threads)
+    //   --time=<s>           planning time of a query
+    //   --planner=<name>     bitstar, informedrrtstar or rrtstar
+    //   --shortcut           shortcut the solutions
+    //   --out=<file>         packed dataset the paths are appended to
+    //   --text               also write <path dir>/path_<index>.txt
+    //   --seed=<s>           seed of the start/goal sampling
+    std::vector<Scene> scenes;
+    Options options;
+    int n_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::string out_fname = "";
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (arg.compare(0, 8, "--scene=") == 0)
+        {
+            std::vector<std::string> fields;
+            std::stringstream ss(arg.substr(8));
+            std::string item;
+            while (getline(ss, item, ','))
+                fields.push_back(item);
+            if (fields.size() != 3)
+            {
+                std::cout << "expected --scene=<name>,<env mesh>,<path dir>" << std::endl;
+                return 1;
+            }
+            scenes.push_back({fields[0], fields[1], fields[2] + "/"});
+        }
+        else if (arg.compare(0, 8, "--first=") == 0)
+            options.first = std::stoi(arg.substr(8));
+        else if (arg.compare(0, 8, "--paths=") == 0)
+            options.n_paths = std::stoi(arg.substr(8));
+        else if (arg.compare(0, 10, "--threads=") == 0)
+            n_threads = std::stoi(arg.substr(10));
+        else if (arg.compare(0, 7, "--time=") == 0)
+            options.max_time = std::stod(arg.substr(7));
+        else if (arg.compare(0, 10, "--planner=") == 0)
+            options.planner = arg.substr(10);
+        else if (arg == "--shortcut")
+            options.shortcut = true;
+        else if (arg.compare(0, 6, "--out=") == 0)
+            out_fname = arg.substr(6);
+        else if (arg == "--text")
+            options.text = true;
+        else if (arg.compare(0, 7, "--seed=") == 0)
+            options.seed = std::stoul(arg.substr(7));
+    }
+    if (scenes.empty())
+    {
+        scenes.push_back({"home", std::string(OMPLAPP_RESOURCE_DIR) + "/3D/Home_env.dae",
+                          "/media/arclabdl1/HD1/YLmiao/data/home/paths/"});
+    }
+    if (out_fname.empty() && !options.text)
+    {
+        std::cout << "expected --out=<dataset> and/or --text" << std::endl;
+        return 1;
+    }
+    std::unique_ptr<PathDataset> dataset;
+    if (!out_fname.empty())
+    {
+        dataset.reset(new PathDataset(out_fname));
+        if (!dataset->isOpen())
+        {
+            std::cout << out_fname << " is not a path dataset" << std::endl;
+            return 1;
+        }
+        std::cout << out_fname << ": " << dataset->size() << " paths already generated" << std::endl;
+    }
+
+    std::mutex print_mutex;
+    for (int env_id = 0; env_id < scenes.size(); env_id++)
+    {
+        std::atomic<int> next(options.first);
+        std::atomic<int> solved(0), failed(0);
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (int t = 0; t < n_threads; t++)
+        {
+            threads.emplace_back(generate, std::cref(scenes[env_id]), env_id, std::cref(options), std::ref(next),
+                                 options.first + options.n_paths, dataset.get(), std::ref(solved), std::ref(failed),
+                                 std::ref(print_mutex));
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        std::cout << scenes[env_id].name << " (environment " << env_id << "): " << solved << " paths solved, " << failed
+                  << " not solved in " << elapsed << "s" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,294 @@
+/**
+# distance field of the environment and conservative advancement motion checks
+**/
+
+#include "mpnet_distance_field.hpp"
+#include <ompl/base/spaces/SE3StateSpace.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+DistanceField::DistanceField(const std::vector<Triangle3>& triangles, int grid_size)
+  : resolution_(3)
+  , n_(grid_size)
+{
+    if (triangles.empty())
+        throw std::runtime_error("DistanceField: no triangles");
+    std::vector<float> upper;
+    Voxelizer::triangleBounds(triangles, lower_, upper);
+    for (int a = 0; a < 3; a++)
+    {
+        // the upper bound itself is outside the voxelizer grid, leave room for the last triangles
+        upper[a] += 1e-3f * (upper[a] - lower_[a]) + 1e-6f;
+        resolution_[a] = ((double)upper[a] - lower_[a]) / n_;
+    }
+    std::vector<float> surface = Voxelizer(lower_, upper, n_).fromTriangles(triangles);
+
+    // squared distances of the cell centers to the nearest surface cell center, one axis at a time
+    const float far = 1e20f;
+    dist_.resize(surface.size());
+    for (std::size_t i = 0; i < surface.size(); i++)
+        dist_[i] = surface[i] > 0.5f ? 0.f : far;
+    for (int a = 0; a < 3; a++)
+        transformAxis(dist_, a, resolution_[a]);
+
+    double diagonal = std::sqrt(resolution_[0]*resolution_[0] + resolution_[1]*resolution_[1] +
+                                resolution_[2]*resolution_[2]);
+    for (float& d : dist_)
+        d = std::max(0., std::sqrt((double)d) - diagonal);
+}
+
+void DistanceField::transformAxis(std::vector<float>& f, int axis, double h) const
+/**
+* lower envelope of parabolas (Felzenszwalb and Huttenlocher) on every grid line along axis
+**/
+{
+    int stride = axis == 0 ? n_ * n_ : axis == 1 ? n_ : 1;
+    std::vector<double> line(n_), out(n_), z(n_ + 1);
+    std::vector<int> v(n_);
+    for (int i = 0; i < n_; i++)
+        for (int j = 0; j < n_; j++)
+        {
+            // first cell of the line: the two coordinates other than axis are (i, j)
+            int base = axis == 0 ? i * n_ + j : axis == 1 ? i * n_ * n_ + j : (i * n_ + j) * n_;
+            for (int q = 0; q < n_; q++)
+                line[q] = f[base + q * stride];
+            int k = 0;
+            v[0] = 0;
+            z[0] = -std::numeric_limits<double>::infinity();
+            z[1] = std::numeric_limits<double>::infinity();
+            auto intersection = [&](int q, int r) {
+                double xq = q * h, xr = r * h;
+                return ((line[q] + xq * xq) - (line[r] + xr * xr)) / (2 * (xq - xr));
+            };
+            for (int q = 1; q < n_; q++)
+            {
+                double s = intersection(q, v[k]);
+                while (s <= z[k])
+                {
+                    k--;
+                    s = intersection(q, v[k]);
+                }
+                k++;
+                v[k] = q;
+                z[k] = s;
+                z[k + 1] = std::numeric_limits<double>::infinity();
+            }
+            k = 0;
+            for (int q = 0; q < n_; q++)
+            {
+                while (z[k + 1] < q * h)
+                    k++;
+                double dx = (q - v[k]) * h;
+                out[q] = line[v[k]] + dx * dx;
+            }
+            for (int q = 0; q < n_; q++)
+                f[base + q * stride] = std::min(out[q], (double)std::numeric_limits<float>::max());
+        }
+}
+
+double DistanceField::clearance(const double* p) const
+{
+    int idx[3];
+    for (int a = 0; a < 3; a++)
+    {
+        double offset = p[a] - lower_[a];
+        if (offset < 0. || offset >= n_ * resolution_[a])
+            return 0.;
+        idx[a] = std::min(n_ - 1, (int)(offset / resolution_[a]));
+    }
+    return dist_[(idx[0] * n_ + idx[1]) * n_ + idx[2]];
+}
+
+void DistanceField::write(std::ostream& out) const
+{
+    int32_t n = n_;
+    out.write((const char*)&n, sizeof(n));
+    out.write((const char*)lower_.data(), 3 * sizeof(float));
+    out.write((const char*)resolution_.data(), 3 * sizeof(double));
+    out.write((const char*)dist_.data(), dist_.size() * sizeof(float));
+}
+
+bool DistanceField::read(std::istream& in)
+{
+    int32_t n = 0;
+    if (!in.read((char*)&n, sizeof(n)) || n <= 0 || n > 2048)
+        return false;
+    n_ = n;
+    lower_.resize(3);
+    resolution_.resize(3);
+    dist_.resize((std::size_t)n_ * n_ * n_);
+    in.read((char*)lower_.data(), 3 * sizeof(float));
+    in.read((char*)resolution_.data(), 3 * sizeof(double));
+    if (!in.read((char*)dist_.data(), dist_.size() * sizeof(float)))
+    {
+        dist_.clear();
+        return false;
+    }
+    return true;
+}
+
+DistanceFieldMotionValidator::DistanceFieldMotionValidator(const ompl::base::SpaceInformationPtr& si,
+                                                           const std::shared_ptr<const DistanceField>& field,
+                                                           const std::vector<BoundingSphere>& spheres)
+  : ompl::base::MotionValidator(si)
+  , field_(field)
+  , spheres_(spheres)
+{
+}
+
+double DistanceFieldMotionValidator::safeStep(const ompl::base::State* state, double translation, double angle) const
+{
+    const auto* se3 = state->as<ompl::base::SE3StateSpace::StateType>();
+    const auto& q = se3->rotation();
+    double step = std::numeric_limits<double>::infinity();
+    for (const BoundingSphere& sphere : spheres_)
+    {
+        // v' = v + 2w (q x v) + 2 q x (q x v)
+        double v[3] = {sphere.center[0], sphere.center[1], sphere.center[2]};
+        double c[3] = {q.y * v[2] - q.z * v[1], q.z * v[0] - q.x * v[2], q.x * v[1] - q.y * v[0]};
+        double cc[3] = {q.y * c[2] - q.z * c[1], q.z * c[0] - q.x * c[2], q.x * c[1] - q.y * c[0]};
+        double p[3] = {se3->getX() + v[0] + 2 * (q.w * c[0] + cc[0]), se3->getY() + v[1] + 2 * (q.w * c[1] + cc[1]),
+                       se3->getZ() + v[2] + 2 * (q.w * c[2] + cc[2])};
+        double free = field_->clearance(p) - sphere.radius;
+        if (free <= 0.)
+            return 0.;
+        // the center moves at most this far per unit of interpolation time
+        double speed = translation + std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]) * angle;
+        if (speed > 0.)
+            step = std::min(step, free / speed);
+    }
+    return step;
+}
+
+bool DistanceFieldMotionValidator::checkMotion(const ompl::base::State* s1, const ompl::base::State* s2,
+                                               double segment_factor, CheckCounts& counts,
+                                               double* last_valid_time) const
+/**
+* s1 is assumed valid, as for the other motion validators
+**/
+{
+    const auto* a = s1->as<ompl::base::SE3StateSpace::StateType>();
+    const auto* b = s2->as<ompl::base::SE3StateSpace::StateType>();
+    double dx = b->getX() - a->getX(), dy = b->getY() - a->getY(), dz = b->getZ() - a->getZ();
+    double translation = std::sqrt(dx * dx + dy * dy + dz * dz);
+    double dot = std::fabs(a->rotation().x * b->rotation().x + a->rotation().y * b->rotation().y +
+                           a->rotation().z * b->rotation().z + a->rotation().w * b->rotation().w);
+    // rotation angle of the shortest path slerp
+    double angle = 2 * std::acos(std::min(1., dot));
+
+    int nd = std::max(1, (int)std::ceil(si_->getStateSpace()->validSegmentCount(s1, s2) * segment_factor));
+    double du = 1. / nd;
+    ompl::base::State* test = si_->allocState();
+    si_->copyState(test, s1);
+    double u = 0.;
+    bool valid = true;
+    while (u < 1.)
+    {
+        counts.clearance_queries += 1;
+        double step = safeStep(test, translation, angle);
+        if (step >= du)
+        {
+            u = std::min(1., u + step);
+            if (u < 1.)
+                si_->getStateSpace()->interpolate(s1, s2, u, test);
+            continue;
+        }
+        // close to the surface: next state of the discrete validator, checked exactly
+        double next = std::min(1., u + du);
+        si_->getStateSpace()->interpolate(s1, s2, next, test);
+        counts.exact_checks += 1;
+        if (!si_->isValid(test))
+        {
+            valid = false;
+            break;
+        }
+        u = next;
+    }
+    si_->freeState(test);
+    // the swept spheres are free, the end state still has to be in the bounds
+    valid = valid && si_->satisfiesBounds(s2);
+    if (last_valid_time != nullptr)
+        *last_valid_time = valid ? 1. : u;
+    return valid;
+}
+
+bool DistanceFieldMotionValidator::checkMotion(const ompl::base::State* s1, const ompl::base::State* s2) const
+{
+    CheckCounts counts;
+    bool valid = checkMotion(s1, s2, 1., counts);
+    if (valid)
+        valid_++;
+    else
+        invalid_++;
+    return valid;
+}
+
+bool DistanceFieldMotionValidator::checkMotion(const ompl::base::State* s1, const ompl::base::State* s2,
+                                               std::pair<ompl::base::State*, double>& lastValid) const
+{
+    CheckCounts counts;
+    double last_valid_time = 0.;
+    bool valid = checkMotion(s1, s2, 1., counts, &last_valid_time);
+    if (valid)
+    {
+        valid_++;
+        return true;
+    }
+    if (lastValid.first != nullptr)
+        si_->getStateSpace()->interpolate(s1, s2, last_valid_time, lastValid.first);
+    lastValid.second = last_valid_time;
+    invalid_++;
+    return false;
+}
+
+std::vector<BoundingSphere> DistanceFieldMotionValidator::coverMesh(const std::vector<Triangle3>& triangles,
+                                                                    const Point3& shift, int cells)
+{
+    std::vector<Triangle3> shifted = triangles;
+    for (Triangle3& tri : shifted)
+        for (Point3& vertex : tri)
+            for (int a = 0; a < 3; a++)
+                vertex[a] -= shift[a];
+    std::vector<float> lower, upper;
+    Voxelizer::triangleBounds(shifted, lower, upper);
+    double size[3];
+    for (int a = 0; a < 3; a++)
+        size[a] = std::max(1e-6, ((double)upper[a] - lower[a]) / cells);
+
+    std::vector<std::vector<const Triangle3*>> groups(cells * cells * cells);
+    for (const Triangle3& tri : shifted)
+    {
+        int idx[3];
+        for (int a = 0; a < 3; a++)
+        {
+            double centroid = (tri[0][a] + tri[1][a] + tri[2][a]) / 3.;
+            idx[a] = std::min(cells - 1, std::max(0, (int)((centroid - lower[a]) / size[a])));
+        }
+        groups[(idx[0] * cells + idx[1]) * cells + idx[2]].push_back(&tri);
+    }
+    std::vector<BoundingSphere> spheres;
+    for (int i = 0; i < groups.size(); i++)
+    {
+        if (groups[i].empty())
+            continue;
+        int idx[3] = {i / (cells * cells), (i / cells) % cells, i % cells};
+        BoundingSphere sphere;
+        for (int a = 0; a < 3; a++)
+            sphere.center[a] = lower[a] + (idx[a] + 0.5) * size[a];
+        // the triangles are the convex hulls of their vertices, so containing the vertices is enough
+        double radius = 0.;
+        for (const Triangle3* tri : groups[i])
+            for (const Point3& vertex : *tri)
+            {
+                double d2 = 0.;
+                for (int a = 0; a < 3; a++)
+                    d2 += (vertex[a] - sphere.center[a]) * (vertex[a] - sphere.center[a]);
+                radius = std::max(radius, std::sqrt(d2));
+            }
+        sphere.radius = radius * (1. + 1e-6) + 1e-6;
+        spheres.push_back(sphere);
+    }
+    return spheres;
+}
@@ -0,0 +1,149 @@
+/**
+# library of solved paths for warm-starting repeated queries
+**/
+
+#include "mpnet_experience_library.hpp"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+    /** \brief distance of two (x, y, z, qx, qy, qz, qw) states, q and -q being the same orientation */
+    double stateDistance(const float* a, const float* b)
+    {
+        double pos = 0., same = 0., opposite = 0.;
+        for (int i = 0; i < 3; i++)
+            pos += (a[i] - b[i]) * (a[i] - b[i]);
+        for (int i = 3; i < 7; i++)
+        {
+            same += (a[i] - b[i]) * (a[i] - b[i]);
+            opposite += (a[i] + b[i]) * (a[i] + b[i]);
+        }
+        return std::sqrt(pos) + std::sqrt(std::min(same, opposite));
+    }
+}
+
+ExperienceLibrary::ExperienceLibrary(const std::string& fname)
+  : fname_(fname)
+{
+    nn_.setDistanceFunction([](const Experience* a, const Experience* b) { return keyDistance(a->key, b->key); });
+    if (!fname_.empty())
+        load(fname_);
+}
+
+double ExperienceLibrary::keyDistance(const std::vector<float>& a, const std::vector<float>& b)
+{
+    return stateDistance(a.data(), b.data()) + stateDistance(a.data() + 7, b.data() + 7);
+}
+
+void ExperienceLibrary::insert(const std::shared_ptr<Experience>& experience)
+{
+    experiences_.push_back(experience);
+    nn_.add(experience.get());
+}
+
+bool ExperienceLibrary::load(const std::string& fname)
+{
+    std::ifstream infile(fname);
+    if (!infile.is_open())
+        return false;
+    std::lock_guard<std::mutex> lock(mutex_);
+    int n;
+    while (infile >> n)
+    {
+        auto experience = std::make_shared<Experience>();
+        experience->key.resize(14);
+        for (float& v : experience->key)
+            infile >> v;
+        experience->path.assign(n, std::vector<float>(7));
+        for (auto& state : experience->path)
+            for (float& v : state)
+                infile >> v;
+        if (!infile)
+            break;
+        insert(experience);
+    }
+    return true;
+}
+
+bool ExperienceLibrary::save(const std::string& fname) const
+{
+    std::ofstream outfile(fname);
+    if (!outfile.is_open())
+        return false;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& experience : experiences_)
+    {
+        outfile << experience->path.size() << "\n";
+        for (int i = 0; i < experience->key.size(); i++)
+            outfile << experience->key[i] << (i+1 < experience->key.size() ? " " : "\n");
+        for (const auto& state : experience->path)
+            for (int i = 0; i < state.size(); i++)
+                outfile << state[i] << (i+1 < state.size() ? " " : "\n");
+    }
+    return true;
+}
+
+bool ExperienceLibrary::save() const
+{
+    return !fname_.empty() && save(fname_);
+}
+
+void ExperienceLibrary::add(const std::vector<float>& key, const std::vector<std::vector<float>>& path,
+                            double min_spacing)
+{
+    if (key.size() != 14 || path.size() < 2)
+        return;
+    auto experience = std::make_shared<Experience>();
+    experience->key = key;
+    experience->path = path;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (nn_.size() > 0 && keyDistance(nn_.nearest(experience.get())->key, key) < min_spacing)
+        return;
+    insert(experience);
+}
+
+bool ExperienceLibrary::nearest(const std::vector<float>& key, double max_distance, Experience& res, bool count)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    lookups_ += count;
+    if (nn_.size() == 0)
+        return false;
+    Experience query;
+    query.key = key;
+    const Experience* closest = nn_.nearest(&query);
+    if (keyDistance(closest->key, key) > max_distance)
+        return false;
+    candidates_ += count;
+    res = *closest;
+    return true;
+}
+
+void ExperienceLibrary::reportLookup(bool candidate)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    lookups_ += 1;
+    candidates_ += candidate;
+}
+
+void ExperienceLibrary::reportRepair(bool repaired)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    repaired_ += repaired;
+}
+
+std::size_t ExperienceLibrary::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return experiences_.size();
+}
+
+void ExperienceLibrary::getStats(int& lookups, int& candidates, int& repaired) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    lookups = lookups_;
+    candidates = candidates_;
+    repaired = repaired_;
+}
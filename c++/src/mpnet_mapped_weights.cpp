@@ -0,0 +1,190 @@
+/**
+# native weight file, mapped read-only and shared by the planner processes
+**/
+
+#include "mpnet_mapped_weights.hpp"
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MPNET_HAVE_MMAP
+#endif
+
+namespace
+{
+    const uint32_t FORMAT_VERSION = 1;
+    const std::size_t NAME_SIZE = 48;
+
+    /** \brief one entry of the array table */
+    struct Entry
+    {
+        char name[NAME_SIZE];
+        uint32_t type;
+        uint32_t reserved;
+        uint64_t count;
+        uint64_t offset;
+    };
+
+    std::size_t typeSize(uint32_t type)
+    {
+        return type == MappedWeights::INT8 ? 1 : 4;
+    }
+
+    std::size_t alignUp(std::size_t offset, std::size_t alignment)
+    {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+}
+
+constexpr std::size_t MappedWeights::PAGE;
+constexpr std::size_t MappedWeights::ALIGNMENT;
+
+void MappedWeights::Writer::add(const std::string& name, const float* data, std::size_t count)
+{
+    add(name, FLOAT32, data, count, sizeof(float));
+}
+
+void MappedWeights::Writer::add(const std::string& name, const int8_t* data, std::size_t count)
+{
+    add(name, INT8, data, count, sizeof(int8_t));
+}
+
+void MappedWeights::Writer::add(const std::string& name, const int32_t* data, std::size_t count)
+{
+    add(name, INT32, data, count, sizeof(int32_t));
+}
+
+void MappedWeights::Writer::add(const std::string& name, Type type, const void* data, std::size_t count,
+                                std::size_t size)
+{
+    if (name.size() >= NAME_SIZE)
+        throw std::runtime_error("MappedWeights: array name too long: " + name);
+    Array& array = arrays_[name];
+    array.type = type;
+    array.count = count;
+    array.bytes.assign((const char*)data, (const char*)data + count * size);
+}
+
+bool MappedWeights::Writer::save(const std::string& fname) const
+{
+    std::ofstream outfile(fname, std::ios::binary);
+    if (!outfile.is_open())
+        return false;
+    uint32_t header[3] = {FORMAT_VERSION, (uint32_t)arrays_.size(), 0};
+    std::vector<Entry> entries;
+    // the data starts on the page after the table
+    std::size_t offset = alignUp(4 + sizeof(header) + arrays_.size() * sizeof(Entry), PAGE);
+    for (const auto& array : arrays_)
+    {
+        Entry entry;
+        std::memset(&entry, 0, sizeof(entry));
+        std::strncpy(entry.name, array.first.c_str(), NAME_SIZE - 1);
+        entry.type = array.second.type;
+        entry.count = array.second.count;
+        offset = alignUp(offset, array.second.bytes.size() >= PAGE ? PAGE : ALIGNMENT);
+        entry.offset = offset;
+        offset += array.second.bytes.size();
+        entries.push_back(entry);
+    }
+    outfile.write("MPNW", 4);
+    outfile.write((const char*)header, sizeof(header));
+    outfile.write((const char*)entries.data(), entries.size() * sizeof(Entry));
+    std::size_t written = 4 + sizeof(header) + entries.size() * sizeof(Entry);
+    int e = 0;
+    for (const auto& array : arrays_)
+    {
+        std::vector<char> padding(entries[e].offset - written, 0);
+        outfile.write(padding.data(), padding.size());
+        outfile.write(array.second.bytes.data(), array.second.bytes.size());
+        written = entries[e].offset + array.second.bytes.size();
+        e++;
+    }
+    return (bool)outfile;
+}
+
+MappedWeights::MappedWeights(const std::string& fname, bool copy)
+{
+#ifdef MPNET_HAVE_MMAP
+    if (!copy)
+    {
+        int fd = ::open(fname.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (addr != MAP_FAILED)
+            {
+                data_ = static_cast<const char*>(addr);
+                size_ = st.st_size;
+                mapped_ = true;
+            }
+        }
+        if (fd >= 0)
+            ::close(fd);
+    }
+#endif
+    if (!mapped_)
+    {
+        std::ifstream infile(fname, std::ios::binary | std::ios::ate);
+        if (!infile.is_open())
+            throw std::runtime_error("MappedWeights: cannot read " + fname);
+        size_ = infile.tellg();
+        infile.seekg(0);
+        // the private copy keeps the alignment of the file
+        buffer_.resize(size_ + PAGE);
+        char* data = buffer_.data() + (PAGE - (uintptr_t)buffer_.data() % PAGE) % PAGE;
+        infile.read(data, size_);
+        data_ = data;
+    }
+
+    uint32_t header[3];
+    if (size_ < 4 + sizeof(header) || std::memcmp(data_, "MPNW", 4) != 0)
+    {
+        unmap();
+        throw std::runtime_error("MappedWeights: " + fname + " is not a weight file");
+    }
+    std::memcpy(header, data_ + 4, sizeof(header));
+    const Entry* entries = reinterpret_cast<const Entry*>(data_ + 4 + sizeof(header));
+    bool valid = header[0] == FORMAT_VERSION && 4 + sizeof(header) + header[1] * sizeof(Entry) <= size_;
+    for (uint32_t i = 0; valid && i < header[1]; i++)
+    {
+        const Entry& entry = entries[i];
+        valid = entry.type <= INT32 && entry.offset % ALIGNMENT == 0 &&
+                entry.offset + entry.count * typeSize(entry.type) <= size_;
+        arrays_[std::string(entry.name, strnlen(entry.name, NAME_SIZE))] = {(Type)entry.type, entry.count, entry.offset};
+    }
+    if (!valid)
+    {
+        unmap();
+        throw std::runtime_error("MappedWeights: " + fname + " is truncated or of another version");
+    }
+}
+
+MappedWeights::~MappedWeights()
+{
+    unmap();
+}
+
+void MappedWeights::unmap()
+{
+#ifdef MPNET_HAVE_MMAP
+    if (mapped_)
+        munmap(const_cast<char*>(data_), size_);
+#endif
+    mapped_ = false;
+}
+
+const void* MappedWeights::get(const std::string& name, Type type, std::size_t* count) const
+{
+    auto array = arrays_.find(name);
+    if (array == arrays_.end() || array->second.type != type)
+        throw std::runtime_error("MappedWeights: no array " + name + " of the expected type");
+    if (count)
+        *count = array->second.count;
+    return data_ + array->second.offset;
+}
@@ -0,0 +1,44 @@
+/**
+# Linear/PReLU parameters of the annotated MPNet MLP, shared by the native MLP backends
+**/
+
+#include "mpnet_mlp_layers.hpp"
+#include <stdexcept>
+
+std::vector<MLPLayerParams> mlpLayerParams(const torch::jit::script::Module& mlp, at::DeviceType device,
+                                           const std::string& owner)
+{
+    std::vector<MLPLayerParams> layers;
+    // parameters are registered as fc1.0.weight, fc1.0.bias, fc1.1.weight (PReLU), ..., fcN.weight, fcN.bias
+    for (const auto& param : mlp.named_parameters(/*recurse=*/true))
+    {
+        torch::Tensor t = param.value.detach().to(device).contiguous();
+        if (t.dim() == 2)
+        {
+            MLPLayerParams layer;
+            layer.weight = t;
+            layers.push_back(layer);
+            continue;
+        }
+        if (layers.empty())
+            throw std::runtime_error(owner + ": unexpected parameter before the first Linear layer: " + param.name);
+        const std::string& name = param.name;
+        if (name.size() >= 4 && name.compare(name.size() - 4, 4, "bias") == 0)
+            layers.back().bias = t;
+        else
+            layers.back().prelu = t;
+    }
+    if (layers.size() < 2)
+        throw std::runtime_error(owner + ": expected at least two Linear layers");
+    for (int l = 0; l < layers.size(); l++)
+    {
+        MLPLayerParams& layer = layers[l];
+        if (!layer.bias.defined() || layer.bias.numel() != layer.weight.size(0))
+            throw std::runtime_error(owner + ": missing bias for layer " + std::to_string(l));
+        if (l > 0 && layers[l-1].weight.size(0) != layer.weight.size(1))
+            throw std::runtime_error(owner + ": layer sizes do not chain at layer " + std::to_string(l));
+        // the annotated MLP applies dropout after every hidden layer except the last one
+        layer.dropout = l + 2 < layers.size();
+    }
+    return layers;
+}
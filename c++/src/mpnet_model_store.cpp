@@ -0,0 +1,69 @@
+/**
+# atomically replaced encoder/MLP pair for long-running planner processes
+**/
+
+#include "mpnet_model_store.hpp"
+
+ModelStore::ModelStore(at::DeviceType mlp_device)
+  : mlp_device_(mlp_device)
+{
+}
+
+int ModelStore::load(const std::string& encoder_fname, const std::string& mlp_fname)
+{
+    // torch::jit::load throws before anything is published
+    std::shared_ptr<torch::jit::script::Module> encoder(new torch::jit::script::Module(torch::jit::load(encoder_fname)));
+    std::shared_ptr<torch::jit::script::Module> mlp(new torch::jit::script::Module(torch::jit::load(mlp_fname)));
+    return publish(encoder, mlp);
+}
+
+std::future<int> ModelStore::loadAsync(const std::string& encoder_fname, const std::string& mlp_fname)
+{
+    return std::async(std::launch::async, [this, encoder_fname, mlp_fname]() { return load(encoder_fname, mlp_fname); });
+}
+
+int ModelStore::publish(const std::shared_ptr<torch::jit::script::Module>& encoder,
+                        const std::shared_ptr<torch::jit::script::Module>& mlp)
+{
+    std::lock_guard<std::mutex> lock(publish_mutex_);
+    auto model = std::make_shared<Model>();
+    model->encoder = encoder;
+    model->mlp = mlp;
+    if (!int8_calib_.empty())
+    {
+        // calibration and the deviation check run here, not in the first solve after the swap
+        auto qmlp = std::make_shared<QuantizedMLP>(*mlp);
+        qmlp->calibrate(int8_calib_);
+        model->int8_deviation = qmlp->evaluate(int8_calib_);
+        if (qmlp->isCalibrated() && model->int8_deviation.max_abs <= int8_max_deviation_)
+            model->qmlp = qmlp;
+    }
+    model->mlp->to(mlp_device_);
+    model->mlp_device = mlp_device_;
+    // the planners of these environments start on the new weights without running the encoder
+    torch::NoGradGuard no_grad;
+    for (const auto& environment : environments_)
+    {
+        std::vector<float> voxels = environment.second;
+        std::vector<torch::jit::IValue> inputs = {torch::from_blob(voxels.data(), {1, 1, 32, 32, 32})};
+        at::Tensor enc = model->encoder->forward(inputs).toTensor().clone();
+        model->environments[environment.first] = std::make_pair(environment.second, enc);
+    }
+    model->version = version_.load(std::memory_order_relaxed) + 1;
+    std::atomic_store(&model_, std::shared_ptr<const Model>(model));
+    version_.store(model->version, std::memory_order_release);
+    return model->version;
+}
+
+void ModelStore::setInt8Calibration(const std::vector<std::vector<float>>& samples, float max_deviation)
+{
+    std::lock_guard<std::mutex> lock(publish_mutex_);
+    int8_calib_ = samples;
+    int8_max_deviation_ = max_deviation;
+}
+
+void ModelStore::setEnvironment(int env_id, const std::vector<float>& voxels)
+{
+    std::lock_guard<std::mutex> lock(publish_mutex_);
+    environments_[env_id] = voxels;
+}
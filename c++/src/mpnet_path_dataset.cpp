@@ -0,0 +1,104 @@
+/**
+# packed binary dataset of demonstration paths
+**/
+
+#include "mpnet_path_dataset.hpp"
+#include <cstring>
+#include <unistd.h>
+
+namespace
+{
+    const char kMagic[4] = {'M', 'P', 'P', 'D'};
+    const int32_t kVersion = 1;
+    const int kStateSize = 7;
+}
+
+PathDataset::PathDataset(const std::string& fname)
+{
+    std::vector<Record> records;
+    std::streamoff valid_end = 0;
+    bool exists = std::ifstream(fname).good();
+    if (exists && !read(fname, records, valid_end))
+    {
+        // an empty file can be started over, anything else is not ours
+        std::ifstream infile(fname, std::ios::binary | std::ios::ate);
+        if (infile.tellg() > 0)
+            return;
+        exists = false;
+    }
+    if (exists)
+    {
+        // drop the record an interruption left incomplete
+        if (truncate(fname.c_str(), valid_end) != 0)
+            return;
+        for (const Record& record : records)
+            done_.insert({record.env_id, record.index});
+        out_.open(fname, std::ios::binary | std::ios::app);
+    }
+    else
+    {
+        out_.open(fname, std::ios::binary | std::ios::trunc);
+        out_.write(kMagic, 4);
+        out_.write((const char*)&kVersion, sizeof(kVersion));
+        out_.flush();
+    }
+}
+
+bool PathDataset::contains(int env_id, int index) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return done_.count({env_id, index}) > 0;
+}
+
+std::size_t PathDataset::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return done_.size();
+}
+
+void PathDataset::append(const Record& record)
+{
+    std::vector<char> buf(3 * sizeof(int32_t) + record.path.size() * kStateSize * sizeof(float));
+    int32_t header[3] = {record.env_id, record.index, (int32_t)record.path.size()};
+    std::memcpy(buf.data(), header, sizeof(header));
+    char* data = buf.data() + sizeof(header);
+    for (const auto& state : record.path)
+    {
+        std::memcpy(data, state.data(), kStateSize * sizeof(float));
+        data += kStateSize * sizeof(float);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    out_.write(buf.data(), buf.size());
+    out_.flush();
+    done_.insert({record.env_id, record.index});
+}
+
+bool PathDataset::read(const std::string& fname, std::vector<Record>& records)
+{
+    std::streamoff valid_end;
+    return read(fname, records, valid_end);
+}
+
+bool PathDataset::read(const std::string& fname, std::vector<Record>& records, std::streamoff& valid_end)
+{
+    std::ifstream infile(fname, std::ios::binary);
+    char magic[4];
+    int32_t version = 0;
+    if (!infile.read(magic, 4) || std::memcmp(magic, kMagic, 4) != 0 ||
+        !infile.read((char*)&version, sizeof(version)) || version != kVersion)
+        return false;
+    records.clear();
+    valid_end = infile.tellg();
+    int32_t header[3];
+    while (infile.read((char*)header, sizeof(header)) && header[2] >= 0 && header[2] < (1 << 20))
+    {
+        Record record{header[0], header[1], std::vector<std::vector<float>>(header[2], std::vector<float>(kStateSize))};
+        for (auto& state : record.path)
+            infile.read((char*)state.data(), kStateSize * sizeof(float));
+        if (!infile)
+            break;
+        records.push_back(std::move(record));
+        valid_end = infile.tellg();
+    }
+    return true;
+}
@@ -0,0 +1,185 @@
+/**
+# hardware counters of the planner phases
+**/
+
+#include "mpnet_perf_counters.hpp"
+#include <algorithm>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+#ifdef __linux__
+    int openCounter(uint32_t type, uint64_t config, int group_fd)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = group_fd == -1 ? 1 : 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        // this thread on any CPU
+        return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+    }
+#endif
+}
+
+PerfRecorder& PerfRecorder::instance()
+{
+    static PerfRecorder recorder;
+    return recorder;
+}
+
+const char* PerfRecorder::counterName(Counter counter)
+{
+    static const char* names[NUM_COUNTERS] = {"cycles", "instructions", "llc misses", "branch misses"};
+    return names[counter];
+}
+
+bool PerfRecorder::enable(bool enabled)
+{
+    if (!enabled)
+    {
+        enabled_.store(false, std::memory_order_relaxed);
+        return true;
+    }
+    ThreadCounters* local = counters();
+    if (local == nullptr || local->leader < 0)
+        return false;
+    for (int c = 0; c < NUM_COUNTERS; c++)
+        available_[c] = local->slot[c] >= 0;
+    enabled_.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+PerfRecorder::ThreadCounters* PerfRecorder::counters()
+{
+    thread_local ThreadOwner owner;
+    if (!owner.counters)
+    {
+        owner.counters.reset(new ThreadCounters());
+        open(*owner.counters);
+        std::lock_guard<std::mutex> lock(mutex_);
+        threads_.push_back(owner.counters.get());
+    }
+    return owner.counters.get();
+}
+
+PerfRecorder::ThreadOwner::~ThreadOwner()
+{
+    if (counters)
+        PerfRecorder::instance().retire(counters.get());
+}
+
+PerfRecorder::ThreadCounters::~ThreadCounters()
+{
+#ifdef __linux__
+    // the group members first, then the leader
+    for (int i = fds.size() - 1; i >= 0; i--)
+        close(fds[i]);
+#endif
+}
+
+void PerfRecorder::retire(ThreadCounters* counters)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    threads_.erase(std::remove(threads_.begin(), threads_.end(), counters), threads_.end());
+    std::lock_guard<std::mutex> thread_lock(counters->mutex);
+    for (const auto& phase : counters->phases)
+    {
+        PhaseCounts& total = finished_[phase.first];
+        total.calls += phase.second.calls;
+        for (int c = 0; c < NUM_COUNTERS; c++)
+            total.values[c] += phase.second.values[c];
+    }
+}
+
+void PerfRecorder::open(ThreadCounters& counters)
+{
+#ifdef __linux__
+    const uint64_t configs[NUM_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    counters.leader = openCounter(PERF_TYPE_HARDWARE, configs[0], -1);
+    if (counters.leader < 0)
+        return;
+    counters.fds.push_back(counters.leader);
+    counters.slot[0] = 0;
+    for (int c = 1; c < NUM_COUNTERS; c++)
+    {
+        // a counter the PMU does not have is left out of the group
+        int fd = openCounter(PERF_TYPE_HARDWARE, configs[c], counters.leader);
+        if (fd < 0)
+            continue;
+        counters.slot[c] = counters.fds.size();
+        counters.fds.push_back(fd);
+    }
+    ioctl(counters.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(counters.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+bool PerfRecorder::read(uint64_t* values)
+{
+#ifdef __linux__
+    ThreadCounters* local = counters();
+    if (local->leader < 0)
+        return false;
+    // PERF_FORMAT_GROUP: the number of counters, then their values in the order they were opened
+    uint64_t buf[1 + NUM_COUNTERS];
+    if (::read(local->leader, buf, sizeof(uint64_t) * (1 + local->fds.size())) <= 0)
+        return false;
+    for (int c = 0; c < NUM_COUNTERS; c++)
+        values[c] = local->slot[c] >= 0 ? buf[1 + local->slot[c]] : 0;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void PerfRecorder::add(const char* phase, const uint64_t* start, const uint64_t* end)
+{
+    ThreadCounters* local = counters();
+    std::lock_guard<std::mutex> lock(local->mutex);
+    PhaseCounts& counts = local->phases[phase];
+    counts.calls += 1;
+    for (int c = 0; c < NUM_COUNTERS; c++)
+        counts.values[c] += end[c] - start[c];
+}
+
+std::map<std::string, PerfRecorder::PhaseCounts> PerfRecorder::totals() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<std::string, PhaseCounts> totals = finished_;
+    for (const auto& thread : threads_)
+    {
+        std::lock_guard<std::mutex> thread_lock(thread->mutex);
+        for (const auto& phase : thread->phases)
+        {
+            PhaseCounts& total = totals[phase.first];
+            total.calls += phase.second.calls;
+            for (int c = 0; c < NUM_COUNTERS; c++)
+                total.values[c] += phase.second.values[c];
+        }
+    }
+    return totals;
+}
+
+void PerfRecorder::reset()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_.clear();
+    for (const auto& thread : threads_)
+    {
+        std::lock_guard<std::mutex> thread_lock(thread->mutex);
+        thread->phases.clear();
+    }
+}
@@ -17,18 +17,26 @@
 #include "ompl/tools/config/SelfConfig.h"
 #include "ompl/util/GeometricEquations.h"
 #include "ompl/base/spaces/RealVectorStateSpace.h"
+#include "ompl/datastructures/NearestNeighborsLinear.h"
 #include <ompl/base/goals/GoalStates.h>
 #include <ompl/base/spaces/SE3StateSpace.h>
 
 #include <torch/torch.h>
 #include <torch/script.h>
 #include "mpnet_planner.hpp"
+#include "mpnet_trace.hpp"
 #include <iostream>
+#include <chrono>
 #include <cmath>
+#include <atomic>
+#include <queue>
+#include <algorithm>
+#include <thread>
 
 #include <iterator>
 
 #define DEFAULT_STEP 0.01
+#define STOP_POLL_INTERVAL 8
 using namespace ompl;
 using namespace std;
 //#define DEBUG
@@ -39,6 +47,12 @@ using namespace std;
   typedef std::chrono::duration<float> fsec;
 #endif
 MPNetPlanner::MPNetPlanner(const base::SpaceInformationPtr &si, bool addIntermediateStates, int max_replan, int max_length)
+  : MPNetPlanner(si, addIntermediateStates, max_replan, max_length, StartupOptions())
+{
+}
+
+MPNetPlanner::MPNetPlanner(const base::SpaceInformationPtr &si, bool addIntermediateStates, int max_replan, int max_length,
+                           const StartupOptions& startup)
   : base::Planner(si, addIntermediateStates ? "MPNetPlannerintermediate" : "MPNetPlanner")
   , _max_replan(max_replan)  // in exp: we use 1001
   , _max_length(max_length)  // in exp: we use 3000
@@ -50,8 +64,19 @@ MPNetPlanner::MPNetPlanner(const base::SpaceInformationPtr &si, bool addIntermed
     Planner::declareParam<double>("goal_bias", this, &MPNetPlanner::setGoalBias, &MPNetPlanner::getGoalBias, "0.:.05:1.");
     Planner::declareParam<bool>("intermediate_states", this, &MPNetPlanner::setIntermediateStates, &MPNetPlanner::getIntermediateStates,
                                 "0,1");
+    Planner::declareParam<int>("connect_k", this, &MPNetPlanner::setConnectNearest, &MPNetPlanner::getConnectNearest, "0:1:16");
+    Planner::declareParam<bool>("lazy", this, &MPNetPlanner::setLazy, &MPNetPlanner::getLazy, "0,1");
+    Planner::declareParam<int>("portfolio", this, &MPNetPlanner::setPortfolio, &MPNetPlanner::getPortfolio, "1:1:64");
+    Planner::declareParam<double>("segment_time", this, &MPNetPlanner::setSegmentTimeLimit,
+                                  &MPNetPlanner::getSegmentTimeLimit, "0.:0.1:60.");
+    Planner::declareParam<int>("max_goal_samples", this, &MPNetPlanner::setMaxGoalSamples, &MPNetPlanner::getMaxGoalSamples,
+                               "1:1:64");
+    addPlannerProgressProperty("collision checks INTEGER", [this] { return std::to_string(_collision_checks); });
+    addPlannerProgressProperty("prediction cache hit rate REAL", [this] { return std::to_string(getPredictionCacheHitRate()); });
 
     addIntermediateStates_ = addIntermediateStates;
+    // dropout of the native MLP backends follows the OMPL seed
+    _dropout_gen.seed(rng_.uniformInt(0, std::numeric_limits<int>::max()));
 
     // state information
     for (int i=0; i < 3; i++)
@@ -59,20 +84,55 @@ MPNetPlanner::MPNetPlanner(const base::SpaceInformationPtr &si, bool addIntermed
         bound[i] = (upper_bound[i]-lower_bound[i]) / 2;
     }
 
+    auto startup_t0 = std::chrono::steady_clock::now();
     // MPNet specific: load network structure and parameters
     // here there might be a version issue
     // -----
     // ***use the below for newer version (~CUDA 10.0)
-    encoder.reset(new torch::jit::script::Module(torch::jit::load("../encoder_annotated_test_cpu_2.pt")));
-    MLP.reset(new torch::jit::script::Module(torch::jit::load("../mlp_annotated_test_gpu_2.pt")));
+    // the networks are loaded on their own threads while the environment is read
+    // CPU-only deployments keep the TorchScript MLP on the CPU
+    _mlp_device = torch::cuda::is_available() ? at::kCUDA : at::kCPU;
+    at::DeviceType mlp_device = _mlp_device;
+    _encoder_backend = startup.encoder_backend;
+    std::string mlp_fname = startup.mlp_fname;
+    std::future<std::shared_ptr<torch::jit::script::Module>> mlp_loading;
+    // the int8 MLP of a native weight file is used in place, the TorchScript MLP is not loaded then
+    std::shared_ptr<const MappedWeights> weights;
+    if (startup.load_networks && !startup.weights_fname.empty())
+    {
+        try
+        {
+            weights = std::make_shared<MappedWeights>(startup.weights_fname);
+            _qmlp = std::make_shared<QuantizedMLP>(weights);
+        }
+        catch (const std::exception& e)
+        {
+            OMPL_WARN("%s: %s, loading the TorchScript MLP", getName().c_str(), e.what());
+            weights.reset();
+            _qmlp.reset();
+        }
+    }
+    if (startup.load_networks)
+    {
+        if (!_qmlp && startup.load_mlp)
+        {
+            mlp_loading = std::async(std::launch::async, [mlp_fname, mlp_device]() {
+                std::shared_ptr<torch::jit::script::Module> mlp(new torch::jit::script::Module(torch::jit::load(mlp_fname)));
+                mlp->to(mlp_device);
+                return mlp;
+            });
+        }
+        std::string encoder_fname = startup.encoder_fname;
+        _encoder_loading = std::async(std::launch::async, [encoder_fname]() {
+            return std::shared_ptr<torch::jit::script::Module>(new torch::jit::script::Module(torch::jit::load(encoder_fname)));
+        }).share();
+    }
     // -----
     // below works for CUDA 9.0
     //encoder = torch::jit::load("../encoder_annotated_test_cpu_2.pt");
     //MLP = torch::jit::load("../mlp_annotated_test_gpu_2.pt");
-    MLP->to(at::kCUDA);
 
     // obtain obstacle representation
-    std::vector<torch::jit::IValue> inputs;
     // variable for loading file
     std::ifstream infile;
     // ---- edit: write new get_encoding code for this
@@ -99,26 +159,246 @@ MPNetPlanner::MPNetPlanner(const base::SpaceInformationPtr &si, bool addIntermed
         infile.close();
     #endif
 
-    std::string pcd_fname = "../obs_voxel.txt";
-    std::cout << "PCD file: " << pcd_fname << "\n\n\n";
-    infile.open(pcd_fname);
-
-    std::string line;
     std::vector<float> tt;
-    while (getline(infile, line)){
-        tt.push_back(std::atof(line.c_str()));
+    std::vector<float> snapshot_enc;
+    std::shared_ptr<DistanceField> snapshot_field;
+    std::vector<BoundingSphere> snapshot_spheres;
+    bool from_snapshot = !startup.snapshot_fname.empty() &&
+                         loadSnapshot(startup.snapshot_fname, tt, snapshot_enc, snapshot_field, snapshot_spheres);
+    if (!from_snapshot && weights && weights->has("env.voxels") && weights->has("env.obs_enc"))
+    {
+        // the environment of the weight file is used like a snapshot
+        std::size_t n = 0;
+        const float* voxels = weights->getFloat("env.voxels", &n);
+        tt.assign(voxels, voxels + n);
+        const float* enc = weights->getFloat("env.obs_enc", &n);
+        snapshot_enc.assign(enc, enc + n);
+        from_snapshot = tt.size() == 32*32*32;
     }
-    torch::Tensor torch_tensor = torch::from_blob(tt.data(), {1,1,32,32,32});
-    #ifdef DEBUG
-        std::cout << "after reading in obs and store in torch tensor" << std::endl;
-    #endif
-    inputs.push_back(torch_tensor);
-    obs_enc = encoder->forward(inputs).toTensor();
-    #ifdef DEBUG
-        std::cout << "after using encoder to forward on the obs" << std::endl;
-    #endif
+    if (!from_snapshot && startup.load_networks)
+    {
+        std::string pcd_fname = startup.voxel_fname;
+        std::cout << "PCD file: " << pcd_fname << "\n\n\n";
+        infile.open(pcd_fname);
+
+        std::string line;
+        while (getline(infile, line)){
+            tt.push_back(std::atof(line.c_str()));
+        }
+        infile.close();
+        if (tt.size() != 32*32*32)
+        {
+            // the grid can also be built from the scene geometry, see Voxelizer and setObstacleVoxels
+            OMPL_WARN("%s: no voxel grid in %s, starting from an empty environment", getName().c_str(), pcd_fname.c_str());
+            tt.assign(32*32*32, 0.);
+        }
+    }
+    if (!startup.load_networks)
+    {
+        // replay only: the predictions come from the log
+        obs_enc = from_snapshot ? torch::from_blob(snapshot_enc.data(), {1, (int64_t)snapshot_enc.size()}).clone()
+                                : torch::zeros({1, 0});
+        if (snapshot_field)
+        {
+            setDistanceField(snapshot_field, snapshot_spheres);
+        }
+        _startup_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - startup_t0).count();
+        OMPL_INFORM("%s: started without networks", getName().c_str());
+        return;
+    }
+    if (mlp_loading.valid())
+        MLP = mlp_loading.get();
+    if (from_snapshot)
+    {
+        // the encoder is only waited for when the environment changes
+        _obs_voxel = tt;
+        obs_enc = torch::from_blob(snapshot_enc.data(), {1, (int64_t)snapshot_enc.size()}).clone();
+        if (snapshot_field)
+        {
+            setDistanceField(snapshot_field, snapshot_spheres);
+        }
+    }
+    else
+    {
+        setObstacleVoxels(tt);
+    }
+    if (weights)
+    {
+        _qmlp->setEnvironmentEncoding(obs_enc.contiguous().data_ptr<float>());
+        _mlp_backend = INT8_MLP;
+    }
+    else
+    {
+        warmUp(startup.warm_up_runs);
+    }
+    _startup_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - startup_t0).count();
+    OMPL_INFORM("%s: started in %f s%s", getName().c_str(), _startup_time, from_snapshot ? " from snapshot" : "");
+}
+
+MPNetPlanner::MPNetPlanner(const MPNetPlanner& parent, std::uint_fast32_t seed)
+  : base::Planner(parent.si_, parent.getName() + "_attempt")
+  , _max_replan(parent._max_replan)
+  , _max_length(parent._max_length)
+{
+    specs_.approximateSolutions = true;
+    specs_.directed = true;
+    addIntermediateStates_ = parent.addIntermediateStates_;
+    _dropout_gen.seed(seed);
+    bound = parent.bound;
+    // read-only during solves: the networks and the environment are shared, not copied
+    obs_enc = parent.obs_enc;
+    encoder = parent.encoder;
+    MLP = parent.MLP;
+    _mlp_device = parent._mlp_device;
+    _mlp_backend = parent._mlp_backend;
+    _qmlp = parent._qmlp;
+    _batched_mlp = parent._batched_mlp;
+    _sdf_validator = parent._sdf_validator;
+    _experience = parent._experience;
+    _experience_max_distance = parent._experience_max_distance;
+    _schedule = parent._schedule;
+    _lazy = parent._lazy;
+    _lazy_resolution = parent._lazy_resolution;
+    _connect_k = parent._connect_k;
+    _max_goal_samples = parent._max_goal_samples;
+    _segment_time_limit = parent._segment_time_limit;
+    _cache_pool = parent._cache_pool;
+    _cache_quantum = parent._cache_quantum;
+    _portfolio_attempt = true;
+}
+
+void MPNetPlanner::shareNetworks(const MPNetPlanner& other)
+{
+    // the modules are read-only during solves, and obs_enc is replaced when the environment changes,
+    // never written in place
+    encoder = other.encoder;
+    _encoder_loading = other._encoder_loading;
+    _encoder_backend = other._encoder_backend;
+    _voxel_encoder.reset();
+    MLP = other.MLP;
+    _mlp_device = other._mlp_device;
+    _mlp_backend = other._mlp_backend;
+    // the int8 MLP keeps the environment it was given, so each planner gets one sharing the weights
+    _qmlp.reset();
+    if (other._qmlp)
+        _qmlp = std::make_shared<QuantizedMLP>(std::shared_ptr<const QuantizedMLP>(other._qmlp));
+    _obs_voxel = other._obs_voxel;
+    obs_enc = other.obs_enc;
+}
+
+void MPNetPlanner::waitEncoder()
+{
+    if (!encoder && _encoder_loading.valid())
+        encoder = _encoder_loading.get();
+    if (!encoder)
+        throw Exception(getName(), "started without networks, the environment cannot be encoded");
+}
+
+void MPNetPlanner::warmUp(int runs)
+{
+    if (!MLP)
+        return;
+    torch::NoGradGuard no_grad;
+    torch::Tensor sg = torch::zeros({1, 14});
+    std::vector<torch::jit::IValue> mlp_input;
+    mlp_input.push_back(torch::cat({obs_enc, sg}, 1).to(_mlp_device));
+    for (int i=0; i < runs; i++)
+    {
+        // copying the result back also waits for the CUDA kernels
+        MLP->forward(mlp_input).toTensor().to(at::kCPU);
+    }
+}
+
+bool MPNetPlanner::saveSnapshot(const std::string& fname) const
+/**
+* binary layout: "MPNS", voxel count, voxels, encoding size, encoding (int32 sizes, float32 values),
+* then optionally "SDF1", sphere count, spheres (center, radius) and the DistanceField
+**/
+{
+    std::ofstream outfile(fname, std::ios::binary);
+    if (!outfile.is_open())
+        return false;
+    torch::Tensor enc = obs_enc.to(at::kCPU).contiguous();
+    int32_t n_voxels = _obs_voxel.size();
+    int32_t n_enc = enc.numel();
+    outfile.write("MPNS", 4);
+    outfile.write((const char*)&n_voxels, sizeof(n_voxels));
+    outfile.write((const char*)_obs_voxel.data(), n_voxels * sizeof(float));
+    outfile.write((const char*)&n_enc, sizeof(n_enc));
+    outfile.write((const char*)enc.data_ptr<float>(), n_enc * sizeof(float));
+    if (_sdf_validator)
+    {
+        const std::vector<BoundingSphere>& spheres = _sdf_validator->getSpheres();
+        int32_t n_spheres = spheres.size();
+        outfile.write("SDF1", 4);
+        outfile.write((const char*)&n_spheres, sizeof(n_spheres));
+        for (const BoundingSphere& sphere : spheres)
+        {
+            outfile.write((const char*)sphere.center.data(), 3 * sizeof(float));
+            outfile.write((const char*)&sphere.radius, sizeof(float));
+        }
+        _sdf_validator->getDistanceField()->write(outfile);
+    }
+    return (bool)outfile;
+}
+
+bool MPNetPlanner::exportWeights(const std::string& fname) const
+{
+    if (!_qmlp || !_qmlp->isCalibrated())
+        return false;
+    MappedWeights::Writer writer;
+    _qmlp->exportWeights(writer);
+    torch::Tensor enc = obs_enc.to(at::kCPU).contiguous();
+    writer.add("env.voxels", _obs_voxel.data(), _obs_voxel.size());
+    writer.add("env.obs_enc", enc.data_ptr<float>(), enc.numel());
+    return writer.save(fname);
+}
 
+bool MPNetPlanner::loadSnapshot(const std::string& fname, std::vector<float>& voxels, std::vector<float>& enc,
+                                std::shared_ptr<DistanceField>& field, std::vector<BoundingSphere>& spheres)
+{
+    std::ifstream infile(fname, std::ios::binary);
+    char magic[4];
+    int32_t n_voxels = 0, n_enc = 0;
+    if (!infile.read(magic, 4) || std::string(magic, 4) != "MPNS")
+        return false;
+    if (!infile.read((char*)&n_voxels, sizeof(n_voxels)) || n_voxels != 32*32*32)
+        return false;
+    voxels.resize(n_voxels);
+    infile.read((char*)voxels.data(), n_voxels * sizeof(float));
+    if (!infile.read((char*)&n_enc, sizeof(n_enc)) || n_enc <= 0)
+        return false;
+    enc.resize(n_enc);
+    if (!infile.read((char*)enc.data(), n_enc * sizeof(float)))
+        return false;
+    // the distance field is optional, snapshots without one end here
+    int32_t n_spheres = 0;
+    if (!infile.read(magic, 4) || std::string(magic, 4) != "SDF1" || !infile.read((char*)&n_spheres, sizeof(n_spheres)))
+        return true;
+    spheres.resize(std::max(0, n_spheres));
+    for (BoundingSphere& sphere : spheres)
+    {
+        infile.read((char*)sphere.center.data(), 3 * sizeof(float));
+        infile.read((char*)&sphere.radius, sizeof(float));
+    }
+    field = std::make_shared<DistanceField>();
+    if (!infile || !field->read(infile))
+    {
+        field.reset();
+        spheres.clear();
+    }
+    return true;
+}
 
+void MPNetPlanner::setDistanceField(const std::shared_ptr<const DistanceField>& field,
+                                    const std::vector<BoundingSphere>& spheres)
+{
+    if (!field || field->empty())
+    {
+        _sdf_validator.reset();
+        return;
+    }
+    _sdf_validator = std::make_shared<DistanceFieldMotionValidator>(si_, field, spheres);
 }
 
 MPNetPlanner::~MPNetPlanner()
@@ -164,19 +444,382 @@ void MPNetPlanner::freeMemory()
     }
 }
 
+bool MPNetPlanner::setMLPBackend(MLPBackend backend, const std::string& calib_fname, float max_deviation)
+{
+    if (!MLP && backend == TORCH_MLP)
+    {
+        OMPL_WARN("%s: no TorchScript MLP loaded", getName().c_str());
+        return false;
+    }
+    if (!MLP && !_qmlp)
+    {
+        OMPL_WARN("%s: no TorchScript MLP loaded to quantize and no int8 MLP", getName().c_str());
+        return false;
+    }
+    if (backend == TORCH_MLP)
+    {
+        _mlp_backend = TORCH_MLP;
+        return true;
+    }
+    if (!_qmlp)
+        _qmlp = std::make_shared<QuantizedMLP>(*MLP);
+    std::vector<std::vector<float>> samples;
+    if (!calib_fname.empty())
+        samples = QuantizedMLP::loadSamples(calib_fname, _qmlp->inputSize());
+    if (samples.empty())
+        samples = _int8_calib;
+    if (samples.empty())
+        samples = _mlp_inputs;
+    // kept for the MLPs published by the model store and the continual trainer
+    _int8_calib = samples;
+    _int8_max_deviation = max_deviation;
+    if (samples.empty())
+    {
+        OMPL_WARN("%s: no calibration inputs for the int8 MLP, keeping the TorchScript MLP", getName().c_str());
+        return false;
+    }
+    _qmlp->calibrate(samples);
+    _int8_deviation = _qmlp->evaluate(samples);
+    OMPL_INFORM("%s: int8 MLP on %d calibration inputs: max abs deviation %f, mean abs deviation %f",
+                getName().c_str(), _int8_deviation.samples, _int8_deviation.max_abs, _int8_deviation.mean_abs);
+    if (!_qmlp->isCalibrated() || _int8_deviation.max_abs > max_deviation)
+    {
+        OMPL_WARN("%s: int8 MLP deviates more than %f from fp32, keeping the TorchScript MLP", getName().c_str(),
+                  max_deviation);
+        return false;
+    }
+    _qmlp->setEnvironmentEncoding(obs_enc.contiguous().data_ptr<float>());
+    _mlp_backend = INT8_MLP;
+    if (_model_store)
+        _model_store->setInt8Calibration(_int8_calib, _int8_max_deviation);
+    if (_trainer)
+        _trainer->setInt8Calibration(_int8_calib, _int8_max_deviation);
+    return true;
+}
+
+void MPNetPlanner::saveMLPInputs(const std::string& fname) const
+{
+    std::ofstream outfile(fname);
+    for (const auto& sample : _mlp_inputs)
+    {
+        for (int i = 0; i < sample.size(); i++)
+            outfile << sample[i] << (i+1 < sample.size() ? " " : "\n");
+    }
+}
+
+void MPNetPlanner::addDemonstration(const std::vector<base::State*>& path)
+{
+    if (!_trainer)
+        return;
+    std::vector<std::vector<float>> normalized_path;
+    for (const base::State* state : path)
+    {
+        std::vector<float> state_vec;
+        stateToVector(state, state_vec);
+        std::vector<float> normalized_state_vec;
+        normalize(state_vec, normalized_state_vec, 7);
+        // the training data keeps the quaternion in the w >= 0 hemisphere
+        if (normalized_state_vec[6] < 0)
+        {
+            for (int i=3; i<7; i++)
+                normalized_state_vec[i] = -normalized_state_vec[i];
+        }
+        normalized_path.push_back(normalized_state_vec);
+    }
+    torch::Tensor enc = obs_enc.contiguous();
+    std::vector<float> enc_vec(enc.data_ptr<float>(), enc.data_ptr<float>() + enc.numel());
+    _trainer->addDemonstration(_env_id, enc_vec, normalized_path);
+}
+
+void MPNetPlanner::stateToVector(const base::State* state, std::vector<float>& res) const
+{
+    const auto* se3 = state->as<base::SE3StateSpace::StateType>();
+    res = {(float)se3->getX(), (float)se3->getY(), (float)se3->getZ(), (float)se3->rotation().x,
+           (float)se3->rotation().y, (float)se3->rotation().z, (float)se3->rotation().w};
+}
+
+void MPNetPlanner::vectorToState(const std::vector<float>& vec, base::State* state)
+{
+    auto* se3 = state->as<base::SE3StateSpace::StateType>();
+    se3->setX(vec[0]);
+    se3->setY(vec[1]);
+    se3->setZ(vec[2]);
+    std::vector<float> angle;
+    q_to_axis_angle(vec[6], vec[3], vec[4], vec[5], angle);
+    se3->rotation().setAxisAngle(angle[0], angle[1], angle[2], angle[3]);
+}
+
+std::vector<float> MPNetPlanner::experienceKey(const base::State* start, const base::State* goal)
+{
+    std::vector<float> start_vec, goal_vec, key;
+    stateToVector(start, start_vec);
+    stateToVector(goal, goal_vec);
+    normalize(start_vec, key, 7);
+    normalize(goal_vec, key, 7);
+    return key;
+}
+
+void MPNetPlanner::updatePublishedMLP()
+{
+    if (!_trainer)
+        return;
+    std::shared_ptr<const ContinualTrainer::Published> published = _trainer->takePublished(_mlp_version);
+    if (!published)
+        return;
+    // moved to the inference device by the trainer, the module is shared with the other planners
+    MLP = published->mlp;
+    _mlp_device = _trainer->publishDevice();
+    OMPL_INFORM("%s: using MLP version %d from the continual trainer", getName().c_str(), _mlp_version);
+    if (_mlp_backend == INT8_MLP && published->qmlp)
+    {
+        // quantized and calibrated by the trainer, only the environment is folded in here
+        _qmlp = std::make_shared<QuantizedMLP>(published->qmlp);
+        _qmlp->setEnvironmentEncoding(obs_enc.contiguous().data_ptr<float>());
+        _int8_deviation = published->int8_deviation;
+    }
+    else if (_mlp_backend == INT8_MLP)
+    {
+        OMPL_WARN("%s: MLP version %d has no int8 MLP, using the TorchScript MLP", getName().c_str(), _mlp_version);
+        _qmlp.reset();
+        _mlp_backend = TORCH_MLP;
+    }
+}
+
+void MPNetPlanner::setModelStore(const std::shared_ptr<ModelStore>& store, int env_id)
+{
+    _model_store = store;
+    _env_id = env_id;
+    if (_model_store && !_obs_voxel.empty())
+        _model_store->setEnvironment(_env_id, _obs_voxel);
+    if (_model_store && _mlp_backend == INT8_MLP)
+        _model_store->setInt8Calibration(_int8_calib, _int8_max_deviation);
+}
+
+void MPNetPlanner::updateStoredModel()
+{
+    // one atomic load per solve while the version is unchanged
+    if (!_model_store || _model_store->version() == _model_version)
+        return;
+    std::shared_ptr<const ModelStore::Model> model = _model_store->current();
+    _model_version = model->version;
+    // the modules of the previous model are released with the last planner that held them
+    encoder = model->encoder;
+    MLP = model->mlp;
+    _mlp_device = model->mlp_device;
+    _voxel_encoder.reset();
+    auto environment = model->environments.find(_env_id);
+    if (_encoder_backend == TORCH_ENCODER && environment != model->environments.end() &&
+        environment->second.first == _obs_voxel)
+    {
+        obs_enc = environment->second.second;
+    }
+    else if (!_obs_voxel.empty())
+    {
+        setObstacleVoxels(_obs_voxel);
+    }
+    if (_mlp_backend == INT8_MLP && model->qmlp)
+    {
+        // quantized and calibrated by the publisher, only the environment is folded in here
+        _qmlp = std::make_shared<QuantizedMLP>(model->qmlp);
+        _qmlp->setEnvironmentEncoding(obs_enc.contiguous().data_ptr<float>());
+        _int8_deviation = model->int8_deviation;
+    }
+    else if (_mlp_backend == INT8_MLP)
+    {
+        OMPL_WARN("%s: model version %d has no int8 MLP, using the TorchScript MLP", getName().c_str(), _model_version);
+        _qmlp.reset();
+        _mlp_backend = TORCH_MLP;
+    }
+    OMPL_INFORM("%s: using model version %d of the model store", getName().c_str(), _model_version);
+}
+
+void MPNetPlanner::setObstacleVoxels(const std::vector<float>& voxels)
+{
+    _obs_voxel = voxels;
+    if (_model_store)
+        _model_store->setEnvironment(_env_id, _obs_voxel);
+    if (_encoder_backend == NATIVE_ENCODER)
+    {
+        if (!_voxel_encoder)
+        {
+            waitEncoder();
+            _voxel_encoder = std::make_shared<VoxelEncoder>(*encoder);
+        }
+        std::vector<float> enc(_voxel_encoder->outputSize());
+        _voxel_encoder->encode(_obs_voxel.data(), enc.data());
+        obs_enc = torch::from_blob(enc.data(), {1, (int64_t)enc.size()}).clone();
+        if (_qmlp)
+            _qmlp->setEnvironmentEncoding(enc.data());
+        return;
+    }
+    std::vector<torch::jit::IValue> inputs;
+    torch::Tensor torch_tensor = torch::from_blob(_obs_voxel.data(), {1,1,32,32,32});
+    #ifdef DEBUG
+        std::cout << "after reading in obs and store in torch tensor" << std::endl;
+    #endif
+    inputs.push_back(torch_tensor);
+    waitEncoder();
+    torch::NoGradGuard no_grad;
+    obs_enc = encoder->forward(inputs).toTensor();
+    #ifdef DEBUG
+        std::cout << "after using encoder to forward on the obs" << std::endl;
+    #endif
+    // the incremental encoder is rebuilt from the new grid on the next update
+    _voxel_encoder.reset();
+    if (_qmlp)
+        _qmlp->setEnvironmentEncoding(obs_enc.contiguous().data_ptr<float>());
+}
+
+void MPNetPlanner::updateObstacles(const std::vector<VoxelFlip>& flips)
+{
+    std::vector<float> enc;
+    if (!_voxel_encoder)
+    {
+        // from here on obs_enc comes from the native encoder, so that updates stay consistent
+        waitEncoder();
+        _voxel_encoder = std::make_shared<VoxelEncoder>(*encoder);
+        enc.resize(_voxel_encoder->outputSize());
+        _voxel_encoder->encode(_obs_voxel.data(), enc.data());
+    }
+    enc.resize(_voxel_encoder->outputSize());
+    _voxel_encoder->update(flips, enc.data());
+    _obs_voxel = _voxel_encoder->voxels();
+    if (_model_store)
+        _model_store->setEnvironment(_env_id, _obs_voxel);
+    obs_enc = torch::from_blob(enc.data(), {1, (int64_t)enc.size()}).clone();
+    if (_qmlp)
+        _qmlp->setEnvironmentEncoding(enc.data());
+}
+
+bool MPNetPlanner::isStateValid(const base::State* state)
+{
+    TraceSpan span("isValid");
+    if (_replay_log)
+        return loggedCheck(state, nullptr, 0.);
+    _collision_checks += 1;
+    return si_->isValid(state);
+}
+
+bool MPNetPlanner::checkMotion(const base::State* s1, const base::State* s2, double resolution)
+{
+    if (_replay_log)
+        return loggedCheck(s1, s2, resolution);
+    return checkMotionLive(s1, s2, resolution);
+}
+
+bool MPNetPlanner::loggedCheck(const base::State* s1, const base::State* s2, double resolution)
+{
+    // the resolution is part of the key, lazy and full resolution checks of a segment differ
+    std::vector<float> vec;
+    stateToVector(s1, vec);
+    if (s2 != nullptr)
+    {
+        std::vector<float> s2_vec;
+        stateToVector(s2, s2_vec);
+        vec.insert(vec.end(), s2_vec.begin(), s2_vec.end());
+        vec.push_back((float)resolution);
+    }
+    uint32_t key = ReplayLog::hash(vec.data(), vec.size());
+    bool valid;
+    uint32_t count = 0;
+    if ((_replay_mode & ReplayLog::REPLAY_COLLISION) && _replay_log->nextCheck(key, valid, count))
+    {
+        _collision_checks += count;
+        return valid;
+    }
+    unsigned long checks = _collision_checks;
+    if (s2 != nullptr)
+    {
+        valid = checkMotionLive(s1, s2, resolution);
+    }
+    else
+    {
+        _collision_checks += 1;
+        valid = si_->isValid(s1);
+    }
+    if (_replay_mode == ReplayLog::RECORD)
+        _replay_log->addCheck(key, valid, _collision_checks - checks);
+    return valid;
+}
+
+bool MPNetPlanner::checkMotionLive(const base::State* s1, const base::State* s2, double resolution)
+/**
+* same order of checks as ompl's DiscreteMotionValidator: the end state, then the intermediate
+* states by bisection. The number of segments is scaled from the resolution of si_.
+**/
+{
+    TraceSpan span("checkMotion");
+    if (_sdf_validator)
+    {
+        DistanceFieldMotionValidator::CheckCounts counts;
+        bool valid = _sdf_validator->checkMotion(s1, s2, si_->getStateValidityCheckingResolution() / resolution, counts);
+        _collision_checks += counts.exact_checks;
+        _clearance_queries += counts.clearance_queries;
+        return valid;
+    }
+    auto valid_state = [this](const base::State* state) {
+        _collision_checks += 1;
+        return si_->isValid(state);
+    };
+    if (!valid_state(s2))
+        return false;
+    double factor = si_->getStateValidityCheckingResolution() / resolution;
+    int nd = std::max(1, (int)std::ceil(si_->getStateSpace()->validSegmentCount(s1, s2) * factor));
+    if (nd < 2)
+        return true;
+    base::State* test = si_->allocState();
+    bool valid = true;
+    std::queue<std::pair<int, int>> pos;
+    pos.emplace(1, nd - 1);
+    while (!pos.empty())
+    {
+        std::pair<int, int> x = pos.front();
+        pos.pop();
+        int mid = (x.first + x.second) / 2;
+        si_->getStateSpace()->interpolate(s1, s2, (double)mid / nd, test);
+        if (!valid_state(test))
+        {
+            valid = false;
+            break;
+        }
+        if (x.first < mid)
+            pos.emplace(x.first, mid - 1);
+        if (x.second > mid)
+            pos.emplace(mid + 1, x.second);
+    }
+    si_->freeState(test);
+    return valid;
+}
+
+bool MPNetPlanner::checkSegment(const base::State* s1, const base::State* s2)
+{
+    // keyed by the states themselves, since freed states may be reallocated at the same address
+    std::vector<float> key, s2_vec;
+    stateToVector(s1, key);
+    stateToVector(s2, s2_vec);
+    key.insert(key.end(), s2_vec.begin(), s2_vec.end());
+    auto it = _segment_cache.find(key);
+    if (it != _segment_cache.end())
+        return it->second;
+    bool valid = checkMotion(s1, s2, DEFAULT_STEP);
+    _segment_cache[key] = valid;
+    return valid;
+}
+
 void MPNetPlanner::neural_replan(StatePtrVec& path, StatePtrVec& res_path, int max_length)
 /**
 * replan the entire path by checking each segment, if not connectable
 * do local plan
 **/
 {
+    TraceSpan span("neural_replan");
     #ifdef DEBUG
         std::cout << "starting neural replan..." << std::endl;
     #endif
 
     StatePtrVec new_path;
     for (int i = 0; i < path.size()-1; i++){
-        if (si_->isValid(path[i])){
+        if (isStateValid(path[i])){
             new_path.push_back(path[i]);
         }
     }
@@ -186,12 +829,21 @@ void MPNetPlanner::neural_replan(StatePtrVec& path, StatePtrVec& res_path, int m
     res_path.push_back(path[0]);
     for (int i=0; i < new_path.size()-1; i++)
     {
+        if (stopRequested())
+        {
+            // out of time: the rest of the path is kept as it is
+            res_path.push_back(new_path[i+1]);
+            continue;
+        }
         // check each segment of the path if it is connectable
-        bool connected = si_->checkMotion(new_path[i], new_path[i+1]);
+        // in lazy mode this is the full check of the contracted path, failing segments are replanned
+        bool connected = _lazy ? checkSegment(new_path[i], new_path[i+1])
+                               : checkMotion(new_path[i], new_path[i+1], _check_resolution);
         if (!connected)
         {
             // if not, use MPNet to do local replanning
             StatePtrVec minipath;
+            TraceSpan segment_span("neural_replanner", i);
             neural_replanner(new_path[i], new_path[i+1], minipath, max_length);
             for (int j=1; j < minipath.size(); j++)
             {
@@ -227,7 +879,40 @@ void MPNetPlanner::neural_replanner(base::State* start, base::State* goal, State
     //StatePtrVec minipath;  // store the result
     base::State* temp = si_->allocState(); // free by freeState(temp)
     bool connected = false;
-    while (iter < max_length)
+    // the trees are connected between start_tree[start_end] and goal_tree[goal_end]
+    int start_end = 0;
+    int goal_end = 0;
+
+    // with _connect_k > 0, a new node tries the k nearest nodes of the opposite tree, nearest first.
+    // Nodes are ids: i for start_tree[i], -i-1 for goal_tree[i]
+    auto node = [&](int id) { return id >= 0 ? start_tree[id] : goal_tree[-id-1]; };
+    NearestNeighborsLinear<int> start_nn, goal_nn;
+    start_nn.setDistanceFunction([&](const int& a, const int& b) { return si_->distance(node(a), node(b)); });
+    goal_nn.setDistanceFunction([&](const int& a, const int& b) { return si_->distance(node(a), node(b)); });
+    start_nn.add(0);
+    goal_nn.add(-1);
+    auto connect_nearest = [&](int id, NearestNeighbors<int>& other_nn) {
+        std::vector<int> nearest;
+        other_nn.nearestK(id, _connect_k, nearest);
+        for (int other_id : nearest)
+        {
+            if (checkMotion(node(id), node(other_id), _check_resolution))
+            {
+                start_end = id >= 0 ? id : other_id;
+                goal_end = id >= 0 ? -other_id-1 : -id-1;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    if (_segment_time_limit > 0.)
+    {
+        deadline = std::chrono::steady_clock::now() +
+                   std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(_segment_time_limit));
+    }
+    while (iter < max_length && !stopRequested(deadline))
     {
         // start planning tree
         if (tree==0)
@@ -235,12 +920,22 @@ void MPNetPlanner::neural_replanner(base::State* start, base::State* goal, State
             // use the last node of start tree to try to connect to the first node of goal tree
             mpnet_predict(start, goal, temp);
             // check if the new state is in collision, if not, create a new motion in the start tree
-            if (si_->isValid(temp))
+            if (isStateValid(temp))
             {
                 base::State* state = si_->allocState();
                 si_->copyState(state, temp);
                 start_tree.push_back(state);
                 start = state;
+                if (_connect_k > 0)
+                {
+                    int id = start_tree.size()-1;
+                    connected = connect_nearest(id, goal_nn);
+                    if (connected)
+                    {
+                        break;
+                    }
+                    start_nn.add(id);
+                }
             }
             tree = 1;
         }
@@ -251,26 +946,42 @@ void MPNetPlanner::neural_replanner(base::State* start, base::State* goal, State
             // use the first node of goal tree to try to connect to the last node of goal tree
             mpnet_predict(goal, start, temp);
             // check if the new state is in collision, if not, create a new motion in the start tree
-            if (si_->isValid(temp))
+            if (isStateValid(temp))
             {
                 base::State* state = si_->allocState();
                 si_->copyState(state, temp);
                 goal_tree.push_back(state);
                 goal = state;
+                if (_connect_k > 0)
+                {
+                    int id = -(int)goal_tree.size();
+                    connected = connect_nearest(id, start_nn);
+                    if (connected)
+                    {
+                        break;
+                    }
+                    goal_nn.add(id);
+                }
             }
             tree = 0;
         }
         // check if start and goal can connect, if so, return the path with connected entire path
-        connected = si_->checkMotion(start, goal);
-        if (connected)
+        if (_connect_k == 0)
         {
-            break;
+            connected = checkMotion(start, goal, _check_resolution);
+            if (connected)
+            {
+                start_end = start_tree.size()-1;
+                goal_end = goal_tree.size()-1;
+                break;
+            }
         }
         iter ++;
     }
     si_->freeState(temp);
     if (!connected)
     {
+        _connect_failures += 1;
         // remove intermediate states, and connect start and goal
         for (int i=1; i < start_tree.size(); i++)
         {
@@ -287,48 +998,199 @@ void MPNetPlanner::neural_replanner(base::State* start, base::State* goal, State
     }
     else
     {
-        for (int i=0; i < start_tree.size(); i++)
+        _connect_iterations += iter + 1;
+        _connect_calls += 1;
+        // nodes past the connection are not part of the path
+        for (int i=0; i <= start_end; i++)
         {
             minipath.push_back(start_tree[i]);
         }
-        for (int i=goal_tree.size()-1; i>-1; i--)
+        for (int i=start_end+1; i < start_tree.size(); i++)
+        {
+            si_->freeState(start_tree[i]);
+        }
+        for (int i=goal_end; i>-1; i--)
         {
             minipath.push_back(goal_tree[i]);
         }
+        for (int i=goal_end+1; i < goal_tree.size(); i++)
+        {
+            si_->freeState(goal_tree[i]);
+        }
         //return minipath;
     }
 }
 
-void MPNetPlanner::lvc(StatePtrVec& path, StatePtrVec& res)
+bool MPNetPlanner::multi_rollout(const StatePtrVec& starts, const StatePtrVec& goals, StatePtrVec& path, int max_length,
+                                 int& start_idx, int& goal_idx)
+/**
+* neural_replanner for all start/goal pairs at once: pair p is starts[p / #goals], goals[p % #goals].
+* Each step extends the start trees of all pairs with one batched prediction, then the goal trees,
+* and checks the tips of the extended pairs, or with _connect_k > 0 every new node against the k
+* nearest nodes of the opposite tree of its pair, as neural_replanner does.
+**/
 {
-    for (int i=0; i < path.size()-1; i++)
+    int n = starts.size() * goals.size();
+    std::vector<StatePtrVec> start_trees(n), goal_trees(n);
+    std::vector<NearestNeighborsLinear<base::State*>> start_nn(n), goal_nn(n);
+    for (int p=0; p < n; p++)
     {
-        for (int j=path.size()-1; j>i+1; j--)
+        start_trees[p].push_back(starts[p / goals.size()]);
+        goal_trees[p].push_back(goals[p % goals.size()]);
+        if (_connect_k > 0)
         {
-            bool ind = 0;
-            ind = si_->checkMotion(path[i], path[j]);
-
-            #ifdef DEBUG
-                std::cout << "i: " << i << ", j: " << j << " ind: " << ind << "\n";
-                std::cout << "path length: " << path.size() << "\n";
-            #endif
-
-            if (ind)
+            start_nn[p].setDistanceFunction([this](base::State* const& a, base::State* const& b) { return si_->distance(a, b); });
+            goal_nn[p].setDistanceFunction([this](base::State* const& a, base::State* const& b) { return si_->distance(a, b); });
+            start_nn[p].add(start_trees[p][0]);
+            goal_nn[p].add(goal_trees[p][0]);
+        }
+    }
+    StatePtrVec from(n), to(n), next(n);
+    for (int p=0; p < n; p++)
+    {
+        next[p] = si_->allocState();
+    }
+    int connected = -1;
+    // the trees of the connected pair are connected between these two nodes
+    base::State* start_end = nullptr;
+    base::State* goal_end = nullptr;
+    int iter = 0;
+    for (; iter < max_length && connected < 0 && !stopRequested(); iter++)
+    {
+        std::vector<bool> extended(n, false);
+        for (int tree=0; tree < 2 && connected < 0; tree++)
+        {
+            std::vector<StatePtrVec>& grow = tree == 0 ? start_trees : goal_trees;
+            std::vector<StatePtrVec>& other = tree == 0 ? goal_trees : start_trees;
+            for (int p=0; p < n; p++)
             {
-                #ifdef DEBUG
-                    std::cout << "calling LSC again... \n";
-                #endif
-
-                StatePtrVec pc;
-                for (size_t k = 0; k < i+1; k++){
-                    pc.push_back(path[k]);
+                from[p] = grow[p].back();
+                to[p] = other[p].back();
+            }
+            mpnet_predict_batch(from, to, next);
+            for (int p=0; p < n && connected < 0; p++)
+            {
+                if (!isStateValid(next[p]))
+                {
+                    continue;
                 }
-                for (size_t k = j; k < path.size(); k++){
-                    pc.push_back(path[k]);
+                base::State* state = next[p];
+                grow[p].push_back(state);
+                next[p] = si_->allocState();
+                extended[p] = true;
+                if (_connect_k > 0)
+                {
+                    std::vector<base::State*> nearest;
+                    (tree == 0 ? goal_nn : start_nn)[p].nearestK(state, _connect_k, nearest);
+                    for (base::State* other_state : nearest)
+                    {
+                        if (checkMotion(state, other_state, _check_resolution))
+                        {
+                            connected = p;
+                            start_end = tree == 0 ? state : other_state;
+                            goal_end = tree == 0 ? other_state : state;
+                            break;
+                        }
+                    }
+                    (tree == 0 ? start_nn : goal_nn)[p].add(state);
                 }
-                lvc(pc, res);
-                return;
-                //return lvc(pc);
+            }
+        }
+        // pairs whose tips did not move were checked already
+        for (int p=0; _connect_k == 0 && p < n && connected < 0; p++)
+        {
+            if (extended[p] && checkMotion(start_trees[p].back(), goal_trees[p].back(), _check_resolution))
+            {
+                connected = p;
+                start_end = start_trees[p].back();
+                goal_end = goal_trees[p].back();
+            }
+        }
+    }
+    // nodes past the connection are not part of the path
+    if (connected >= 0)
+    {
+        StatePtrVec& start_tree = start_trees[connected];
+        StatePtrVec& goal_tree = goal_trees[connected];
+        path.assign(start_tree.begin(), std::find(start_tree.begin(), start_tree.end(), start_end) + 1);
+        start_tree.erase(start_tree.begin() + 1, start_tree.begin() + path.size());
+        auto goal_last = std::find(goal_tree.begin(), goal_tree.end(), goal_end) + 1;
+        path.insert(path.end(), std::reverse_iterator<StatePtrVec::iterator>(goal_last), goal_tree.rend());
+        goal_tree.erase(goal_tree.begin() + 1, goal_last);
+    }
+    for (int p=0; p < n; p++)
+    {
+        si_->freeState(next[p]);
+        for (int i=1; i < start_trees[p].size(); i++)
+        {
+            si_->freeState(start_trees[p][i]);
+        }
+        for (int i=1; i < goal_trees[p].size(); i++)
+        {
+            si_->freeState(goal_trees[p][i]);
+        }
+    }
+    if (connected < 0)
+    {
+        return false;
+    }
+    _connect_iterations += iter;
+    _connect_calls += 1;
+    start_idx = connected / goals.size();
+    goal_idx = connected % goals.size();
+    return true;
+}
+
+bool MPNetPlanner::stopRequested(std::chrono::steady_clock::time_point deadline)
+{
+    if (_stop_requested)
+        return true;
+    if (++_stop_polls % STOP_POLL_INTERVAL != 0)
+        return false;
+    if (_ptc != nullptr && (*_ptc)())
+    {
+        _stop_requested = true;
+        return true;
+    }
+    return deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() > deadline;
+}
+
+void MPNetPlanner::lvc(StatePtrVec& path, StatePtrVec& res)
+{
+    for (int i=0; i < path.size()-1; i++)
+    {
+        for (int j=path.size()-1; j>i+1; j--)
+        {
+            if (stopRequested())
+            {
+                // out of time: the path is returned as shortened so far
+                res = path;
+                return;
+            }
+            bool ind = 0;
+            ind = checkMotion(path[i], path[j], _check_resolution);
+
+            #ifdef DEBUG
+                std::cout << "i: " << i << ", j: " << j << " ind: " << ind << "\n";
+                std::cout << "path length: " << path.size() << "\n";
+            #endif
+
+            if (ind)
+            {
+                #ifdef DEBUG
+                    std::cout << "calling LSC again... \n";
+                #endif
+
+                StatePtrVec pc;
+                for (size_t k = 0; k < i+1; k++){
+                    pc.push_back(path[k]);
+                }
+                for (size_t k = j; k < path.size(); k++){
+                    pc.push_back(path[k]);
+                }
+                lvc(pc, res);
+                return;
+                //return lvc(pc);
             }
         }
     }
@@ -414,6 +1276,7 @@ void MPNetPlanner::mpnet_predict(const base::State* start, const base::State* go
     // given the start and goal, and the internal obstacle representation
     // convert them to torch::Tensor, and feed into MPNet
     // return the next state to the "next" parameter
+    TraceSpan span("predict");
     #ifdef DEBUG
         std::cout << "starting mpnet_predict..." << std::endl;
     #endif
@@ -430,20 +1293,65 @@ void MPNetPlanner::mpnet_predict(const base::State* start, const base::State* go
 
     torch::Tensor mlp_input_tensor;
     // Note the order of the cat
-    mlp_input_tensor = torch::cat({obs_enc,sg}, 1).to(at::kCUDA);
-    //mlp_input_tensor = torch::cat({obs_enc,sg}, 1);
-
-    std::vector<torch::jit::IValue> mlp_input;
-    mlp_input.push_back(mlp_input_tensor);
-    auto mlp_output = MLP->forward(mlp_input);
-    torch::Tensor res = mlp_output.toTensor().to(at::kCPU);
-
-    auto res_a = res.accessor<float,2>(); // accesor for the tensor
+    if (_record_mlp_inputs)
+    {
+        std::vector<float> sample(obs_enc.data_ptr<float>(), obs_enc.data_ptr<float>() + obs_enc.numel());
+        sample.insert(sample.end(), sg.data_ptr<float>(), sg.data_ptr<float>() + sg.numel());
+        _mlp_inputs.push_back(sample);
+    }
 
-    std::vector<float> state_vec;
-    for (int i = 0; i < dim; i++)
+    std::vector<float> state_vec(dim), recorded(dim);
+    bool cached = cachedPrediction(sg.data_ptr<float>(), state_vec.data());
+    bool served = !cached && replayPrediction(sg.data_ptr<float>(), recorded.data());
+    bool networks = MLP || _batched_mlp || _mlp_backend == INT8_MLP;
+    if (!cached && !served && !networks)
+    {
+        // off the replay log without the networks: step to the goal, the checks decide
+        si_->copyState(next, goal);
+        return;
+    }
+    if (cached)
+    {
+        // an output predicted earlier in this solve for the same input
+    }
+    else if (served && !(networks && (_replay_mode & ReplayLog::COMPARE_INFERENCE)))
+    {
+        // the output is the recorded one
+    }
+    else if (_mlp_backend == INT8_MLP)
+    {
+        // the obstacle part of the input is already folded into the quantized model
+        _qmlp->forward(sg.data_ptr<float>(), state_vec.data(), _dropout_gen);
+    }
+    else if (_batched_mlp)
+    {
+        // blocks until the shared MLP has run the batch this input was gathered into
+        std::vector<float> input(obs_enc.data_ptr<float>(), obs_enc.data_ptr<float>() + obs_enc.numel());
+        input.insert(input.end(), sg.data_ptr<float>(), sg.data_ptr<float>() + sg.numel());
+        _batched_mlp->predict(input.data(), state_vec.data());
+    }
+    else
+    {
+        mlp_input_tensor = torch::cat({obs_enc,sg}, 1).to(_mlp_device);
+        //mlp_input_tensor = torch::cat({obs_enc,sg}, 1);
+
+        std::vector<torch::jit::IValue> mlp_input;
+        mlp_input.push_back(mlp_input_tensor);
+        // inference only, no autograd graph is recorded
+        torch::NoGradGuard no_grad;
+        auto mlp_output = MLP->forward(mlp_input);
+        torch::Tensor res = mlp_output.toTensor().to(at::kCPU);
+
+        auto res_a = res.accessor<float,2>(); // accesor for the tensor
+        for (int i = 0; i < dim; i++)
+        {
+            state_vec[i] = res_a[0][i];
+        }
+    }
+    if (!cached)
     {
-        state_vec.push_back(res_a[0][i]);
+        logPrediction(sg.data_ptr<float>(), recorded.data(), served, state_vec.data());
+        cachePrediction(sg.data_ptr<float>(), state_vec.data());
     }
     std::vector<float> unnormalized_state_vec;
     unnormalize(state_vec, unnormalized_state_vec, dim);
@@ -456,7 +1364,7 @@ void MPNetPlanner::mpnet_predict(const base::State* start, const base::State* go
         //TODO: better assign by using angleAxis
         //next->as<base::RealVectorStateSpace::StateType>()->values[i] = res_a[0][i];
         #ifdef DEBUG
-            std::cout << "res_a[0][" << i << "]: " << res_a[0][i] << std::endl;
+            std::cout << "state_vec[" << i << "]: " << state_vec[i] << std::endl;
         #endif
     }
     next->as<base::SE3StateSpace::StateType>()->setX(unnormalized_state_vec[0]);
@@ -482,6 +1390,159 @@ void MPNetPlanner::mpnet_predict(const base::State* start, const base::State* go
     #endif
 
 }
+void MPNetPlanner::mpnet_predict_batch(const StatePtrVec& from, const StatePtrVec& to, StatePtrVec& next)
+{
+    TraceSpan span("predict_batch", from.size());
+    int dim = 7;
+    int64_t n = from.size();
+    std::vector<torch::Tensor> rows;
+    for (int i = 0; i < n; i++)
+    {
+        rows.push_back(getStartGoalTensor(from[i], to[i], dim));
+    }
+    torch::Tensor sg = torch::cat(rows, 0).contiguous();
+    const float* sg_data = sg.data_ptr<float>();
+    const float* enc_data = obs_enc.data_ptr<float>();
+    int64_t enc_size = obs_enc.numel();
+    if (_record_mlp_inputs)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            std::vector<float> sample(enc_data, enc_data + enc_size);
+            sample.insert(sample.end(), sg_data + i*2*dim, sg_data + (i+1)*2*dim);
+            _mlp_inputs.push_back(sample);
+        }
+    }
+
+    std::vector<float> state_vecs(n*dim), recorded(n*dim);
+    // the outputs of cached and served rows go to recorded
+    std::vector<char> cached(n), served(n);
+    bool all_served = true;
+    for (int i = 0; i < n; i++)
+    {
+        cached[i] = cachedPrediction(sg_data + i*2*dim, recorded.data() + i*dim);
+        served[i] = !cached[i] && replayPrediction(sg_data + i*2*dim, recorded.data() + i*dim);
+        all_served = all_served && (cached[i] || served[i]);
+    }
+    bool networks = MLP || _batched_mlp || _mlp_backend == INT8_MLP;
+    if (!networks || (all_served && !(_replay_mode & ReplayLog::COMPARE_INFERENCE)))
+    {
+        // the outputs are the recorded ones
+    }
+    else if (_mlp_backend == INT8_MLP)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            _qmlp->forward(sg_data + i*2*dim, state_vecs.data() + i*dim, _dropout_gen);
+        }
+    }
+    else if (_batched_mlp)
+    {
+        std::vector<float> inputs;
+        for (int i = 0; i < n; i++)
+        {
+            inputs.insert(inputs.end(), enc_data, enc_data + enc_size);
+            inputs.insert(inputs.end(), sg_data + i*2*dim, sg_data + (i+1)*2*dim);
+        }
+        _batched_mlp->predict(inputs.data(), n, state_vecs.data());
+    }
+    else
+    {
+        std::vector<torch::jit::IValue> mlp_input;
+        mlp_input.push_back(torch::cat({obs_enc.expand({n, enc_size}), sg}, 1).to(_mlp_device));
+        torch::NoGradGuard no_grad;
+        torch::Tensor res = MLP->forward(mlp_input).toTensor().to(at::kCPU);
+        auto res_a = res.accessor<float,2>();
+        for (int i = 0; i < n; i++)
+        {
+            for (int j = 0; j < dim; j++)
+            {
+                state_vecs[i*dim+j] = res_a[i][j];
+            }
+        }
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (!cached[i] && !served[i] && !networks)
+        {
+            // off the replay log without the networks, see mpnet_predict
+            si_->copyState(next[i], to[i]);
+            continue;
+        }
+        if (cached[i])
+        {
+            std::copy_n(recorded.data() + i*dim, dim, state_vecs.data() + i*dim);
+        }
+        else
+        {
+            logPrediction(sg_data + i*2*dim, recorded.data() + i*dim, served[i], state_vecs.data() + i*dim);
+            cachePrediction(sg_data + i*2*dim, state_vecs.data() + i*dim);
+        }
+        std::vector<float> state_vec(state_vecs.begin() + i*dim, state_vecs.begin() + (i+1)*dim);
+        std::vector<float> unnormalized_state_vec;
+        unnormalize(state_vec, unnormalized_state_vec, dim);
+        vectorToState(unnormalized_state_vec, next[i]);
+    }
+}
+
+std::vector<int64_t> MPNetPlanner::cacheKey(const float* input) const
+{
+    int dim = 7;
+    std::vector<int64_t> key(2*dim);
+    for (int i = 0; i < 2*dim; i++)
+    {
+        key[i] = std::llround(input[i] / _cache_quantum);
+    }
+    return key;
+}
+
+bool MPNetPlanner::cachedPrediction(const float* input, float* output)
+{
+    if (_cache_pool <= 0)
+        return false;
+    int dim = 7;
+    _cache_lookups++;
+    auto it = _prediction_cache.find(cacheKey(input));
+    if (it == _prediction_cache.end() || it->second.first.size() < _cache_pool * dim)
+        return false;
+    // the pool is served in turn, so that replays of the solve see the same outputs
+    std::pair<std::vector<float>, unsigned int>& entry = it->second;
+    std::copy_n(entry.first.data() + (entry.second++ % _cache_pool) * dim, dim, output);
+    _cache_hits++;
+    return true;
+}
+
+void MPNetPlanner::cachePrediction(const float* input, const float* output)
+{
+    if (_cache_pool <= 0)
+        return;
+    int dim = 7;
+    std::vector<float>& outputs = _prediction_cache[cacheKey(input)].first;
+    if (outputs.size() < _cache_pool * dim)
+        outputs.insert(outputs.end(), output, output + dim);
+}
+
+bool MPNetPlanner::replayPrediction(const float* input, float* output)
+{
+    return _replay_log && (_replay_mode & ReplayLog::REPLAY_INFERENCE) && _replay_log->nextPrediction(input, output);
+}
+
+void MPNetPlanner::logPrediction(const float* input, const float* recorded, bool served, float* output)
+{
+    if (!_replay_log)
+        return;
+    if (served)
+    {
+        if ((_replay_mode & ReplayLog::COMPARE_INFERENCE) && (MLP || _batched_mlp || _mlp_backend == INT8_MLP))
+            _replay_log->comparePrediction(recorded, output);
+        std::copy_n(recorded, ReplayLog::kOutputSize, output);
+    }
+    else if (_replay_mode == ReplayLog::RECORD)
+    {
+        _replay_log->addPrediction(input, output);
+    }
+}
+
 torch::Tensor MPNetPlanner::getStartGoalTensor(const base::State *start_state, const base::State *goal_state, int dim){
     //convert to torch tensor by getting data from states
     std::vector<float> goal_vec;
@@ -534,9 +1595,172 @@ torch::Tensor MPNetPlanner::getStartGoalTensor(const base::State *start_state, c
 }
 
 
+base::PlannerStatus MPNetPlanner::solvePortfolio(const base::PlannerTerminationCondition &ptc)
+/**
+* every attempt is a planner of its own with a copy of the problem, so the attempts share nothing
+* that solve() writes. The attempts are rebuilt on every solve and pick up the current networks.
+**/
+{
+    TraceSpan span("portfolio", _portfolio);
+    checkValidity();
+    updatePublishedMLP();
+    updateStoredModel();
+    std::atomic<bool> found(false);
+    std::atomic<int> winner(-1);
+    base::PlannerTerminationCondition attempt_ptc([&ptc, &found] { return found.load() || ptc(); });
+    // sampleGoal() changes the state of the goal (e.g. the position of GoalStates), so the goal states are
+    // sampled here once and every attempt gets a GoalStates of its own
+    base::GoalPtr goal = pdef_->getGoal();
+    auto *goal_s = dynamic_cast<base::GoalSampleableRegion *>(goal.get());
+    StatePtrVec goal_states;
+    unsigned int goal_samples = goal_s == nullptr ? 0 : std::min(goal_s->maxSampleCount(), (unsigned int)_max_goal_samples);
+    for (unsigned int i=0; i < goal_samples; i++)
+    {
+        goal_states.push_back(si_->allocState());
+        goal_s->sampleGoal(goal_states.back());
+    }
+    std::vector<std::shared_ptr<MPNetPlanner>> attempts;
+    for (int r=0; r < _portfolio; r++)
+    {
+        std::shared_ptr<MPNetPlanner> attempt(new MPNetPlanner(*this, rng_.uniformInt(0, std::numeric_limits<int>::max())));
+        auto pdef = std::make_shared<base::ProblemDefinition>(si_);
+        for (unsigned int i=0; i < pdef_->getStartStateCount(); i++)
+        {
+            pdef->addStartState(pdef_->getStartState(i));
+        }
+        if (goal_s)
+        {
+            auto attempt_goal = std::make_shared<base::GoalStates>(si_);
+            attempt_goal->setThreshold(goal_s->getThreshold());
+            for (base::State *state : goal_states)
+            {
+                attempt_goal->addState(state);
+            }
+            pdef->setGoal(attempt_goal);
+        }
+        else
+        {
+            // goals that cannot be sampled are only queried, which does not change them
+            pdef->setGoal(goal);
+        }
+        attempt->setProblemDefinition(pdef);
+        attempt->setup();
+        attempts.push_back(attempt);
+    }
+    std::vector<base::PlannerStatus> status(_portfolio);
+    std::vector<std::thread> threads;
+    for (int r=0; r < _portfolio; r++)
+    {
+        threads.emplace_back([&, r] {
+            status[r] = attempts[r]->solve(attempt_ptc);
+            if (status[r] == base::PlannerStatus::EXACT_SOLUTION)
+            {
+                int none = -1;
+                winner.compare_exchange_strong(none, r);
+                found = true;
+            }
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    for (base::State *state : goal_states)
+    {
+        si_->freeState(state);
+    }
+
+    _collision_checks = 0;
+    _clearance_queries = 0;
+    _connect_iterations = 0;
+    _connect_calls = 0;
+    _cache_lookups = 0;
+    _cache_hits = 0;
+    for (const auto& attempt : attempts)
+    {
+        _cache_lookups += attempt->_cache_lookups;
+        _cache_hits += attempt->_cache_hits;
+        _collision_checks += attempt->_collision_checks;
+        _clearance_queries += attempt->_clearance_queries;
+        _connect_iterations += attempt->_connect_iterations;
+        _connect_calls += attempt->_connect_calls;
+    }
+    _portfolio_winner = winner;
+    // without a feasible path, the partial path that ends closest to the goal is returned
+    int r = _portfolio_winner;
+    if (r < 0)
+    {
+        for (int a=0; a < _portfolio; a++)
+        {
+            if (attempts[a]->getProblemDefinition()->hasSolution() && (r < 0 ||
+                attempts[a]->getProblemDefinition()->getSolutionDifference() <
+                attempts[r]->getProblemDefinition()->getSolutionDifference()))
+            {
+                r = a;
+            }
+        }
+    }
+    if (r < 0)
+    {
+        // no attempt found a path at all
+        r = 0;
+    }
+    // the attempts look up the same key, the library counts the lookup of the portfolio once
+    if (_experience && attempts[r]->_experience_lookup)
+    {
+        _experience->reportLookup(attempts[r]->_experience_candidate);
+        if (attempts[r]->_experience_repaired >= 0)
+            _experience->reportRepair(attempts[r]->_experience_repaired != 0);
+    }
+    base::PathPtr path = attempts[r]->getProblemDefinition()->getSolutionPath();
+    if (!path)
+    {
+        return status[r];
+    }
+    bool approximate = status[r] != base::PlannerStatus::EXACT_SOLUTION;
+    pdef_->addSolutionPath(path, approximate, attempts[r]->getProblemDefinition()->getSolutionDifference(), getName());
+    if (!approximate)
+    {
+        std::vector<base::State*>& states = std::static_pointer_cast<ompl::geometric::PathGeometric>(path)->getStates();
+        addDemonstration(states);
+        if (_experience)
+        {
+            std::vector<std::vector<float>> path_vec(states.size());
+            for (int i=0; i<states.size(); i++)
+            {
+                stateToVector(states[i], path_vec[i]);
+            }
+            _experience->add(experienceKey(states.front(), states.back()), path_vec, _experience_min_spacing);
+        }
+    }
+    return status[r];
+}
+
 base::PlannerStatus MPNetPlanner::solve(const base::PlannerTerminationCondition &ptc)
 {
+    if (_portfolio > 1 && !_portfolio_attempt)
+    {
+        return solvePortfolio(ptc);
+    }
+    TraceSpan span("solve");
     checkValidity();
+    updatePublishedMLP();
+    updateStoredModel();
+    beginSolve(ptc);
+    if (_replay_log && _replay_mode == ReplayLog::RECORD)
+    {
+        std::vector<std::vector<float>> start_vecs(pdef_->getStartStateCount());
+        for (unsigned int i=0; i < start_vecs.size(); i++)
+        {
+            stateToVector(pdef_->getStartState(i), start_vecs[i]);
+        }
+        _replay_log->beginQuery(start_vecs, std::vector<float>(obs_enc.data_ptr<float>(),
+                                                               obs_enc.data_ptr<float>() + obs_enc.numel()));
+    }
+    else if (_replay_log && !_replay_log->nextQuery())
+    {
+        OMPL_WARN("%s: every query of the replay log was replayed, the checks and predictions run live", getName().c_str());
+    }
     base::Goal *goal = pdef_->getGoal().get();
     auto *goal_s = dynamic_cast<base::GoalSampleableRegion *>(goal);
 
@@ -550,6 +1774,7 @@ base::PlannerStatus MPNetPlanner::solve(const base::PlannerTerminationCondition
     if (nn_->size() == 0)
     {
         OMPL_ERROR("%s: There are no valid initial states!", getName().c_str());
+        _ptc = nullptr;
         return base::PlannerStatus::INVALID_START;
     }
 
@@ -572,45 +1797,132 @@ base::PlannerStatus MPNetPlanner::solve(const base::PlannerTerminationCondition
     #endif
 
     // initialize the path
-    auto temp_goal = goal->as<base::GoalState>();
-    #ifdef DEBUG
-        std::cout << "used temp" << std::endl;
-    #endif
-
-    const base::State *const_goal_state = goal->as<base::GoalState>()->getState();
-    #ifdef DEBUG
-        std::cout << "obtained goal state." << std::endl;
-    #endif
-
-    base::State *goal_state = si_->allocState();
-    #ifdef DEBUG
-        std::cout << "alocated goal state." << std::endl;
-    #endif
-
-    si_->copyState(goal_state, const_goal_state);
-    #ifdef DEBUG
-        std::cout << "copied goal." << std::endl;
-    #endif
-
-    base::State *start_state = si_->allocState();
-    si_->copyState(start_state, pdef_->getStartState(0));
+    // candidate starts and goals: every start of the problem, and the valid goals sampled from the goal region
+    StatePtrVec starts;
+    for (unsigned int i=0; i < pdef_->getStartStateCount(); i++)
+    {
+        base::State *state = si_->allocState();
+        si_->copyState(state, pdef_->getStartState(i));
+        starts.push_back(state);
+    }
+    StatePtrVec goals;
+    unsigned int goal_samples = goal_s == nullptr ? 0 : std::min(goal_s->maxSampleCount(), (unsigned int)_max_goal_samples);
+    for (unsigned int i=0; i < goal_samples; i++)
+    {
+        base::State *state = si_->allocState();
+        goal_s->sampleGoal(state);
+        if (_replay_log && _replay_mode == ReplayLog::RECORD)
+        {
+            std::vector<float> goal_vec;
+            stateToVector(state, goal_vec);
+            _replay_log->addGoal(goal_vec);
+        }
+        // an invalid goal is kept only if it is the only one, as a single GoalState always was
+        if (isStateValid(state) || (goals.empty() && i+1 == goal_samples))
+            goals.push_back(state);
+        else
+            si_->freeState(state);
+    }
     #ifdef DEBUG
-        std::cout << "copied start." << std::endl;
+        std::cout << "obtained " << starts.size() << " starts and " << goals.size() << " goals." << std::endl;
     #endif
 
     StatePtrVec path;
-    path.push_back(start_state);
-    path.push_back(goal_state);
+    base::State *start_state = nullptr;
+    base::State *goal_state = nullptr;
+    if (goals.empty())
+    {
+        OMPL_ERROR("%s: No goal state could be sampled", getName().c_str());
+    }
+    else if (starts.size() * goals.size() == 1)
+    {
+        start_state = starts[0];
+        goal_state = goals[0];
+        path.push_back(start_state);
+        path.push_back(goal_state);
+    }
+    else
+    {
+        // one batched rollout over all pairs replaces the first neural_replan of each pair
+        TraceSpan multi_span("multi_rollout", starts.size() * goals.size());
+        _check_resolution = _lazy ? _lazy_resolution : 4*DEFAULT_STEP;
+        int start_idx = 0, goal_idx = 0;
+        if (!multi_rollout(starts, goals, path, _max_length, start_idx, goal_idx))
+        {
+            // no pair connected, plan for the closest one
+            double closest = std::numeric_limits<double>::infinity();
+            for (int i=0; i < starts.size(); i++)
+            {
+                for (int j=0; j < goals.size(); j++)
+                {
+                    double d = si_->distance(starts[i], goals[j]);
+                    if (d < closest)
+                    {
+                        closest = d;
+                        start_idx = i;
+                        goal_idx = j;
+                    }
+                }
+            }
+            path = {starts[start_idx], goals[goal_idx]};
+        }
+        start_state = starts[start_idx];
+        goal_state = goals[goal_idx];
+    }
+    for (base::State *state : starts)
+    {
+        if (state != start_state)
+            si_->freeState(state);
+    }
+    for (base::State *state : goals)
+    {
+        if (state != goal_state)
+            si_->freeState(state);
+    }
+    if (goal_state == nullptr)
+    {
+        si_->freeState(xstate);
+        si_->freeState(rmotion->state);
+        delete rmotion;
+        _ptc = nullptr;
+        return base::PlannerStatus::INVALID_GOAL;
+    }
     #ifdef DEBUG
         std::cout << "pushed back path." << std::endl;
     #endif
 
+    // warm start from the closest solved query, with the actual start and goal as endpoints
+    bool from_experience = false;
+    if (_experience && path.size() == 2)
+    {
+        TraceSpan experience_span("experience");
+        ExperienceLibrary::Experience experience;
+        _experience_lookup = true;
+        if (_experience->nearest(experienceKey(start_state, goal_state), _experience_max_distance, experience,
+                                 !_portfolio_attempt))
+        {
+            _experience_candidate = true;
+            path.pop_back();
+            for (int i=1; i+1 < experience.path.size(); i++)
+            {
+                base::State* state = si_->allocState();
+                vectorToState(experience.path[i], state);
+                path.push_back(state);
+            }
+            path.push_back(goal_state);
+            from_experience = true;
+        }
+    }
+
 
     // reference to python planning methods
     int iter = 0;
     int max_length = _max_length;
 
-    bool feasible = true;
+    // no iteration runs when the condition fired already
+    bool feasible = false;
+    // states of the path up to its first invalid segment, the partial solution when time runs out
+    int valid_prefix = 1;
     #ifdef DEBUG
         std::cout << "before solving..." << std::endl;
     #endif
@@ -618,45 +1930,94 @@ base::PlannerStatus MPNetPlanner::solve(const base::PlannerTerminationCondition
     #ifdef DEBUG
       auto plan_t0 = Time::now();
     #endif
-    while (!ptc)
+    while (!_stop_requested && !ptc)
     {
+        TraceSpan iteration_span("iteration", iter);
         #ifdef DEBUG
           auto t0 = Time::now();
         #endif
-        if (iter==0)
+        ReplanSchedule::Stage stage = ReplanSchedule::stage(iter, _max_replan);
+        int arm = -1;
+        auto iteration_t0 = std::chrono::steady_clock::now();
+        if (_schedule)
+        {
+            arm = _schedule->choose(stage);
+            max_length = _max_length*_schedule->getArms()[arm].length_factor;
+            _check_resolution = _schedule->getArms()[arm].step_factor*DEFAULT_STEP;
+        }
+        else if (iter==0)
         {
             max_length = _max_length;
-            si_->setStateValidityCheckingResolution(4*DEFAULT_STEP);
+            _check_resolution = 4*DEFAULT_STEP;
         }
         else if (iter<0.30*_max_replan)
         {
             max_length = _max_length*2;
-            si_->setStateValidityCheckingResolution(2*DEFAULT_STEP);
+            _check_resolution = 2*DEFAULT_STEP;
         }
         else
         {
             max_length = _max_length*3;
-            si_->setStateValidityCheckingResolution(DEFAULT_STEP);
+            _check_resolution = DEFAULT_STEP;
 
         }
+        if (_lazy)
+        {
+            // rollouts and lvc are optimistic, the path segments are checked at full resolution
+            _check_resolution = _lazy_resolution;
+        }
         #ifdef DEBUG
           std::cout << "solving... iteration: " << iter << std::endl;
         #endif
 
         // use neural replan to plan path
         StatePtrVec replanned_path;
+        long connect_failures = _connect_failures;
         neural_replan(path, replanned_path, max_length);
-        lvc(replanned_path, path);
+        {
+            TraceSpan lvc_span("lvc");
+            lvc(replanned_path, path);
+        }
         // collision check for the entire path to see if it is feasible
         feasible = true;
-        // feasibility check for the path, set to the real resolution
-        si_->setStateValidityCheckingResolution(DEFAULT_STEP);
-        for (int i=0; i<path.size()-1; i++)
+        // feasibility check for the path, at the real resolution
         {
-            if (!si_->checkMotion(path[i], path[i+1]))
+            TraceSpan feasibility_span("feasibility");
+            valid_prefix = path.size();
+            for (int i=0; i<path.size()-1; i++)
             {
-                feasible = false;
-                break;
+                bool valid = _lazy ? checkSegment(path[i], path[i+1]) : checkMotion(path[i], path[i+1], DEFAULT_STEP);
+                if (!valid)
+                {
+                    feasible = false;
+                    valid_prefix = i+1;
+                    break;
+                }
+            }
+        }
+        if (_schedule && !_stop_requested)
+        {
+            // iterations cut short by the termination condition say little about their arm
+            bool connected = _connect_failures == connect_failures;
+            _schedule->report(stage, arm, connected, feasible,
+                              std::chrono::duration<double>(std::chrono::steady_clock::now() - iteration_t0).count());
+        }
+        if (from_experience)
+        {
+            // the retrieved path gets one repair, after that plan from {start, goal} as usual
+            from_experience = false;
+            _experience_repaired = feasible;
+            if (!_portfolio_attempt)
+                _experience->reportRepair(feasible);
+            if (!feasible)
+            {
+                for (int i=1; i+1 < path.size(); i++)
+                {
+                    si_->freeState(path[i]);
+                }
+                path = {path.front(), path.back()};
+                valid_prefix = 1;
+                continue;
             }
         }
         if (feasible)
@@ -685,11 +2046,30 @@ base::PlannerStatus MPNetPlanner::solve(const base::PlannerTerminationCondition
     {
         solved = true;
         approximate = false;
+        if (!_portfolio_attempt)
+        {
+            addDemonstration(path);
+        }
+        if (_experience && !_portfolio_attempt)
+        {
+            std::vector<std::vector<float>> path_vec(path.size());
+            for (int i=0; i<path.size(); i++)
+            {
+                stateToVector(path[i], path_vec[i]);
+            }
+            _experience->add(experienceKey(start_state, goal_state), path_vec, _experience_min_spacing);
+        }
     }
     /* set the solution path */
     auto sol_path(std::make_shared<ompl::geometric::PathGeometric>(si_));
-    for (int i=0; i<path.size(); i++)
+    // an infeasible path is cut at its first invalid segment, its end is the closest valid state
+    int solution_size = feasible ? path.size() : std::min(valid_prefix, (int)path.size());
+    for (int i=0; i<solution_size; i++)
         sol_path->append(path[i]);
+    if (!feasible)
+    {
+        pdef_->getGoal()->isSatisfied(path[solution_size-1], &approxdif);
+    }
     //TODO: modify approxdif to be the approximate difference to real solution
     pdef_->addSolutionPath(sol_path, approximate, approxdif, getName());
     solved = true;
@@ -705,9 +2085,199 @@ base::PlannerStatus MPNetPlanner::solve(const base::PlannerTerminationCondition
     {
         si_->freeState(path[i]);
     }
+    _ptc = nullptr;
     return {solved, approximate};
 }
 
+void MPNetPlanner::beginSolve(const base::PlannerTerminationCondition &ptc)
+{
+    _ptc = &ptc;
+    _stop_requested = false;
+    _stop_polls = 0;
+    _prediction_cache.clear();
+    _cache_lookups = 0;
+    _cache_hits = 0;
+    _collision_checks = 0;
+    _clearance_queries = 0;
+    _segment_cache.clear();
+    _connect_iterations = 0;
+    _connect_calls = 0;
+    _connect_failures = 0;
+    _experience_lookup = false;
+    _experience_candidate = false;
+    _experience_repaired = -1;
+}
+
+bool MPNetPlanner::segmentInRegion(const base::State* s1, const base::State* s2, const ChangedRegion& region) const
+{
+    std::vector<float> v1, v2;
+    stateToVector(s1, v1);
+    stateToVector(s2, v2);
+    for (int k=0; k < 3; k++)
+    {
+        if (std::max(v1[k], v2[k]) + region.margin < region.low[k] || std::min(v1[k], v2[k]) - region.margin > region.high[k])
+            return false;
+    }
+    return true;
+}
+
+base::PlannerStatus MPNetPlanner::repair(const geometric::PathGeometric& previous, const ChangedRegion& region,
+                                         const base::PlannerTerminationCondition& ptc, geometric::PathGeometric& result)
+/**
+* the segments away from the region are valid as they were. The others are checked at full
+* resolution, and replaced by the minipath of neural_replanner when they fail; the new segments
+* are checked in the next iteration, as the feasibility check of solve() does. The rollouts check
+* their connections at full resolution, so that a connected minipath is usually valid at once.
+**/
+{
+    TraceSpan span("repair");
+    _repair_checked = 0;
+    _repair_replanned = 0;
+    if (previous.getStateCount() < 2)
+    {
+        OMPL_ERROR("%s: The path to repair has less than two states", getName().c_str());
+        return base::PlannerStatus::ABORT;
+    }
+    updatePublishedMLP();
+    updateStoredModel();
+    beginSolve(ptc);
+    // the checks of a repair are not part of a recorded query
+    std::shared_ptr<ReplayLog> replay_log;
+    std::swap(replay_log, _replay_log);
+    _check_resolution = DEFAULT_STEP;
+
+    StatePtrVec path;
+    for (std::size_t i=0; i < previous.getStateCount(); i++)
+    {
+        path.push_back(si_->cloneState(previous.getState(i)));
+    }
+    // dirty[i]: segment path[i], path[i+1] has to be checked; repaired[i]: it was replanned
+    std::vector<bool> dirty, repaired;
+    for (int i=0; i+1 < path.size(); i++)
+    {
+        dirty.push_back(segmentInRegion(path[i], path[i+1], region));
+        _repair_checked += dirty.back();
+    }
+    // intermediate states in the region that became invalid are dropped, their segments merged
+    {
+        StatePtrVec kept = {path[0]};
+        std::vector<bool> kept_dirty;
+        bool merged_dirty = false;
+        for (int i=1; i < path.size(); i++)
+        {
+            merged_dirty = merged_dirty || dirty[i-1];
+            if (i+1 < path.size() && (dirty[i-1] || dirty[i]) && !isStateValid(path[i]))
+            {
+                si_->freeState(path[i]);
+                continue;
+            }
+            kept.push_back(path[i]);
+            kept_dirty.push_back(merged_dirty);
+            merged_dirty = false;
+        }
+        path = kept;
+        dirty = kept_dirty;
+        repaired.assign(dirty.size(), false);
+    }
+
+    bool feasible = std::find(dirty.begin(), dirty.end(), true) == dirty.end();
+    for (int iter=0; !feasible && iter <= _max_replan && !_stop_requested && !ptc; iter++)
+    {
+        TraceSpan iteration_span("iteration", iter);
+        int max_length = iter == 0 ? _max_length : iter < 0.30*_max_replan ? _max_length*2 : _max_length*3;
+        StatePtrVec next_path = {path[0]};
+        std::vector<bool> next_dirty, next_repaired;
+        feasible = true;
+        for (int i=0; i+1 < path.size(); i++)
+        {
+            if (!dirty[i] || stopRequested() || checkMotion(path[i], path[i+1], DEFAULT_STEP))
+            {
+                // a segment left unchecked when out of time stays dirty
+                next_path.push_back(path[i+1]);
+                next_dirty.push_back(dirty[i] && _stop_requested);
+                next_repaired.push_back(repaired[i]);
+                feasible = feasible && !next_dirty.back();
+                continue;
+            }
+            feasible = false;
+            _repair_replanned += 1;
+            StatePtrVec minipath;
+            TraceSpan segment_span("neural_replanner", i);
+            neural_replanner(path[i], path[i+1], minipath, max_length);
+            for (int j=1; j < minipath.size(); j++)
+            {
+                next_path.push_back(minipath[j]);
+                next_dirty.push_back(true);
+                next_repaired.push_back(true);
+            }
+        }
+        path = next_path;
+        dirty = next_dirty;
+        repaired = next_repaired;
+        if (feasible)
+        {
+            break;
+        }
+    }
+
+    if (feasible)
+    {
+        // lvc over each repaired span with one unchanged state on each side
+        TraceSpan lvc_span("lvc");
+        StatePtrVec shortened = {path[0]};
+        int window_end = 0;
+        for (int a=0; a+1 < path.size(); )
+        {
+            if (!repaired[a])
+            {
+                shortened.push_back(path[a+1]);
+                a++;
+                continue;
+            }
+            int b = a;
+            while (b+1 < path.size() && repaired[b])
+            {
+                b++;
+            }
+            // the start of the window is the last state of shortened, or the one before it
+            int first = std::max(window_end, a-1);
+            int last = std::min((int)path.size()-1, b+1);
+            StatePtrVec window(path.begin()+first, path.begin()+last+1), window_res;
+            lvc(window, window_res);
+            for (base::State* state : window)
+            {
+                if (std::find(window_res.begin(), window_res.end(), state) == window_res.end())
+                    si_->freeState(state);
+            }
+            shortened.resize(shortened.size() - (a - first));
+            shortened.insert(shortened.end(), window_res.begin()+1, window_res.end());
+            window_end = last;
+            a = last;
+        }
+        path = shortened;
+    }
+
+    // an infeasible path is cut at its first segment not known to be valid
+    int solution_size = path.size();
+    if (!feasible)
+    {
+        solution_size = std::find(dirty.begin(), dirty.end(), true) - dirty.begin() + 1;
+    }
+    result = geometric::PathGeometric(si_);
+    for (int i=0; i < solution_size; i++)
+    {
+        result.append(path[i]);
+    }
+    for (base::State* state : path)
+    {
+        si_->freeState(state);
+    }
+    std::swap(replay_log, _replay_log);
+    _ptc = nullptr;
+    OMPL_INFORM("%s: Repaired %u of %u checked segments", getName().c_str(), _repair_replanned, _repair_checked);
+    return feasible ? base::PlannerStatus::EXACT_SOLUTION : base::PlannerStatus::APPROXIMATE_SOLUTION;
+}
+
 void MPNetPlanner::getPlannerData(base::PlannerData &data) const
 {
     Planner::getPlannerData(data);
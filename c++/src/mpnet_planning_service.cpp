@@ -0,0 +1,129 @@
+/**
+# concurrent MPNet solves sharing one dynamically batched MLP
+**/
+
+#include "mpnet_planning_service.hpp"
+#include <ompl/base/spaces/SE3StateSpace.h>
+#include <cmath>
+
+namespace
+{
+    void setSE3State(const std::vector<float>& vec, ompl::base::State* state)
+    {
+        auto* se3 = state->as<ompl::base::SE3StateSpace::StateType>();
+        se3->setXYZ(vec[0], vec[1], vec[2]);
+        double norm = std::sqrt(vec[3]*vec[3] + vec[4]*vec[4] + vec[5]*vec[5] + vec[6]*vec[6]);
+        se3->rotation().x = vec[3] / norm;
+        se3->rotation().y = vec[4] / norm;
+        se3->rotation().z = vec[5] / norm;
+        se3->rotation().w = vec[6] / norm;
+    }
+}
+
+PlanningService::PlanningService(const SetupFactory& make_setup, const Options& options)
+{
+    torch::jit::script::Module mlp = torch::jit::load(options.mlp_fname);
+    mlp_ = std::make_shared<BatchedMLP>(mlp, options.batching);
+    // the first worker loads the encoder and the environment, the others share them; the predictions
+    // of all of them go through mlp_, so none of them loads the TorchScript MLP
+    MPNetPlanner::StartupOptions startup;
+    startup.load_mlp = false;
+    MPNetPlanner* first = nullptr;
+    // setups are built here, one after the other, since the factory usually loads meshes
+    for (int i = 0; i < options.workers; i++)
+    {
+        ompl::geometric::SimpleSetupPtr setup = make_setup();
+        startup.load_networks = first == nullptr;
+        auto* planner = new MPNetPlanner(setup->getSpaceInformation(), false, 1001, 3000, startup);
+        if (first)
+            planner->shareNetworks(*first);
+        else
+            first = planner;
+        planner->setBatchedMLP(mlp_);
+        setup->setPlanner(ompl::base::PlannerPtr(planner));
+        setup->setup();
+        setups_.push_back(setup);
+    }
+    for (const auto& setup : setups_)
+        workers_.emplace_back(&PlanningService::run, this, setup);
+}
+
+PlanningService::~PlanningService()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cond_.notify_all();
+    for (auto& worker : workers_)
+        worker.join();
+}
+
+std::future<PlanningResult> PlanningService::submit(const PlanningQuery& query)
+{
+    Task task;
+    task.query = query;
+    task.submitted = std::chrono::steady_clock::now();
+    std::future<PlanningResult> result = task.result.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(std::move(task));
+    }
+    cond_.notify_one();
+    return result;
+}
+
+void PlanningService::run(const ompl::geometric::SimpleSetupPtr& setup)
+{
+    while (true)
+    {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this]() { return !running_ || !queue_.empty(); });
+            // queued queries are still solved when the service is stopped
+            if (queue_.empty())
+                return;
+            task = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        try
+        {
+            PlanningResult result = solve(*setup, task.query);
+            result.latency = std::chrono::duration<float>(std::chrono::steady_clock::now() - task.submitted).count();
+            task.result.set_value(result);
+        }
+        catch (...)
+        {
+            task.result.set_exception(std::current_exception());
+        }
+    }
+}
+
+PlanningResult PlanningService::solve(ompl::geometric::SimpleSetup& setup, const PlanningQuery& query)
+{
+    // drop the solutions of the previous query, the planner keeps its networks
+    setup.clear();
+    ompl::base::ScopedState<ompl::base::SE3StateSpace> start(setup.getSpaceInformation());
+    ompl::base::ScopedState<ompl::base::SE3StateSpace> goal(setup.getSpaceInformation());
+    setSE3State(query.start, start.get());
+    setSE3State(query.goal, goal.get());
+    setup.setStartAndGoalStates(start, goal);
+
+    PlanningResult result;
+    auto t0 = std::chrono::steady_clock::now();
+    ompl::base::PlannerStatus status = setup.solve(query.time_limit);
+    result.plan_time = std::chrono::duration<float>(std::chrono::steady_clock::now() - t0).count();
+    result.exact = status == ompl::base::PlannerStatus::EXACT_SOLUTION;
+    if (setup.haveSolutionPath())
+    {
+        for (const ompl::base::State* state : setup.getSolutionPath().getStates())
+        {
+            const auto* se3 = state->as<ompl::base::SE3StateSpace::StateType>();
+            result.path.push_back({(float)se3->getX(), (float)se3->getY(), (float)se3->getZ(),
+                                   (float)se3->rotation().x, (float)se3->rotation().y,
+                                   (float)se3->rotation().z, (float)se3->rotation().w});
+        }
+    }
+    return result;
+}
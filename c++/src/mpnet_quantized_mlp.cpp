@@ -0,0 +1,368 @@
+/**
+# int8 post-training quantization of the MPNet planning network for CPU inference
+**/
+
+#include "mpnet_quantized_mlp.hpp"
+#include "mpnet_mlp_layers.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+QuantizedMLP::QuantizedMLP(const torch::jit::script::Module& mlp, int obs_size, float dropout_p)
+  : obs_size_(obs_size)
+  , dropout_p_(dropout_p)
+{
+    for (const MLPLayerParams& params : mlpLayerParams(mlp, at::kCPU, "QuantizedMLP"))
+    {
+        Layer layer;
+        layer.out = params.weight.size(0);
+        layer.in = params.weight.size(1);
+        const float* weight = params.weight.data_ptr<float>();
+        layer.weight = own(std::vector<float>(weight, weight + params.weight.numel()));
+        const float* bias = params.bias.data_ptr<float>();
+        layer.bias = own(std::vector<float>(bias, bias + params.bias.numel()));
+        if (params.prelu.defined())
+        {
+            const float* prelu = params.prelu.data_ptr<float>();
+            layer.prelu = own(std::vector<float>(prelu, prelu + params.prelu.numel()));
+            layer.prelu_size = params.prelu.numel();
+        }
+        layer.dropout = params.dropout;
+        if (!layers_.empty())
+            quantizeWeights(layer);
+        layers_.push_back(layer);
+    }
+    input_size_ = layers_.front().in;
+    output_size_ = layers_.back().out;
+    if (obs_size_ >= input_size_)
+        throw std::runtime_error("QuantizedMLP: obstacle encoding does not fit in the MLP input");
+    // until an environment is set, the obstacle part contributes nothing
+    env_bias_.assign(layers_.front().bias, layers_.front().bias + layers_.front().out);
+}
+
+QuantizedMLP::QuantizedMLP(const std::shared_ptr<const MappedWeights>& weights, const std::string& prefix)
+  : weights_(weights)
+{
+    std::size_t count = 0;
+    const int32_t* meta = weights_->getInt32(prefix + "meta", &count);
+    if (count != 4)
+        throw std::runtime_error("QuantizedMLP: unexpected " + prefix + "meta");
+    // layer count, obs_size, calibrated, dropout_p (bits of the float)
+    int n_layers = meta[0];
+    obs_size_ = meta[1];
+    calibrated_ = meta[2] != 0;
+    std::memcpy(&dropout_p_, &meta[3], sizeof(float));
+    for (int l = 0; l < n_layers; l++)
+    {
+        std::string name = prefix + std::to_string(l) + ".";
+        const int32_t* shape = weights_->getInt32(name + "shape", &count);
+        Layer layer;
+        layer.in = shape[0];
+        layer.out = shape[1];
+        layer.dropout = shape[2] != 0;
+        layer.weight = weights_->getFloat(name + "weight", &count);
+        if (count != (std::size_t)layer.in * layer.out)
+            throw std::runtime_error("QuantizedMLP: unexpected size of " + name + "weight");
+        layer.bias = weights_->getFloat(name + "bias");
+        if (weights_->has(name + "prelu"))
+        {
+            std::size_t n = 0;
+            layer.prelu = weights_->getFloat(name + "prelu", &n);
+            layer.prelu_size = n;
+        }
+        if (l > 0)
+        {
+            layer.qweight = weights_->getInt8(name + "qweight");
+            layer.wscale = weights_->getFloat(name + "wscale");
+            layer.ascale = *weights_->getFloat(name + "ascale");
+        }
+        layers_.push_back(layer);
+    }
+    if (layers_.size() < 2)
+        throw std::runtime_error("QuantizedMLP: expected at least two Linear layers");
+    input_size_ = layers_.front().in;
+    output_size_ = layers_.back().out;
+    env_bias_.assign(layers_.front().bias, layers_.front().bias + layers_.front().out);
+}
+
+QuantizedMLP::QuantizedMLP(const std::shared_ptr<const QuantizedMLP>& shared)
+  : layers_(shared->layers_)
+  , shared_(shared)
+  , env_bias_(shared->env_bias_)
+  , obs_size_(shared->obs_size_)
+  , input_size_(shared->input_size_)
+  , output_size_(shared->output_size_)
+  , dropout_p_(shared->dropout_p_)
+  , calibrated_(shared->calibrated_)
+{
+}
+
+void QuantizedMLP::exportWeights(MappedWeights::Writer& writer, const std::string& prefix) const
+{
+    int32_t meta[4] = {(int32_t)layers_.size(), obs_size_, calibrated_ ? 1 : 0, 0};
+    std::memcpy(&meta[3], &dropout_p_, sizeof(float));
+    writer.add(prefix + "meta", meta, 4);
+    for (int l = 0; l < layers_.size(); l++)
+    {
+        const Layer& layer = layers_[l];
+        std::string name = prefix + std::to_string(l) + ".";
+        int32_t shape[3] = {layer.in, layer.out, layer.dropout ? 1 : 0};
+        writer.add(name + "shape", shape, 3);
+        writer.add(name + "weight", layer.weight, (std::size_t)layer.in * layer.out);
+        writer.add(name + "bias", layer.bias, layer.out);
+        if (layer.prelu)
+            writer.add(name + "prelu", layer.prelu, layer.prelu_size);
+        if (l > 0)
+        {
+            writer.add(name + "qweight", layer.qweight, (std::size_t)layer.in * layer.out);
+            writer.add(name + "wscale", layer.wscale, layer.out);
+            writer.add(name + "ascale", &layer.ascale, 1);
+        }
+    }
+}
+
+const float* QuantizedMLP::own(std::vector<float>&& values)
+{
+    // moving the vectors of float_arrays_ keeps their buffers in place
+    float_arrays_.push_back(std::move(values));
+    return float_arrays_.back().data();
+}
+
+const int8_t* QuantizedMLP::own(std::vector<int8_t>&& values)
+{
+    int8_arrays_.push_back(std::move(values));
+    return int8_arrays_.back().data();
+}
+
+void QuantizedMLP::quantizeWeights(Layer& layer)
+{
+    std::vector<int8_t> qweight((std::size_t)layer.in * layer.out);
+    std::vector<float> wscale(layer.out);
+    for (int c = 0; c < layer.out; c++)
+    {
+        const float* w = &layer.weight[c * layer.in];
+        float max_abs = 0.f;
+        for (int k = 0; k < layer.in; k++)
+            max_abs = std::max(max_abs, std::fabs(w[k]));
+        float scale = max_abs > 0.f ? max_abs / 127.f : 1.f;
+        wscale[c] = scale;
+        int8_t* q = &qweight[c * layer.in];
+        for (int k = 0; k < layer.in; k++)
+            q[k] = (int8_t)std::max(-127.f, std::min(127.f, std::nearbyint(w[k] / scale)));
+    }
+    layer.qweight = own(std::move(qweight));
+    layer.wscale = own(std::move(wscale));
+}
+
+void QuantizedMLP::calibrate(const std::vector<std::vector<float>>& inputs)
+{
+    std::vector<float> max_abs(layers_.size(), 0.f);
+    std::vector<float> out(output_size_);
+    std::vector<float> x;
+    for (const auto& input : inputs)
+    {
+        if (input.size() != input_size_)
+            continue;
+        x.resize(layers_.front().out);
+        firstLayer(input.data(), layers_.front().bias, 0, x.data());
+        hiddenLayers(x, out.data(), nullptr, false, &max_abs);
+    }
+    calibrated_ = false;
+    for (int l = 1; l < layers_.size(); l++)
+    {
+        if (max_abs[l] <= 0.f)
+            return;
+        layers_[l].ascale = max_abs[l] / 127.f;
+    }
+    calibrated_ = true;
+}
+
+QuantizedMLP::DeviationReport QuantizedMLP::evaluate(const std::vector<std::vector<float>>& inputs) const
+{
+    DeviationReport report;
+    std::vector<float> ref(output_size_), quant(output_size_);
+    double sum_abs = 0.;
+    for (const auto& input : inputs)
+    {
+        if (input.size() != input_size_)
+            continue;
+        forwardFull(input.data(), ref.data(), false);
+        forwardFull(input.data(), quant.data(), true);
+        for (int i = 0; i < output_size_; i++)
+        {
+            float diff = std::fabs(quant[i] - ref[i]);
+            report.max_abs = std::max(report.max_abs, diff);
+            report.max_rel = std::max(report.max_rel, diff / std::max(std::fabs(ref[i]), 1e-3f));
+            sum_abs += diff;
+        }
+        report.samples += 1;
+    }
+    if (report.samples > 0)
+        report.mean_abs = sum_abs / (report.samples * output_size_);
+    return report;
+}
+
+void QuantizedMLP::setEnvironmentEncoding(const float* obs_enc)
+{
+    const Layer& layer = layers_.front();
+    env_bias_.resize(layer.out);
+    for (int c = 0; c < layer.out; c++)
+    {
+        const float* w = &layer.weight[c * layer.in];
+        float acc = 0.f;
+        for (int k = 0; k < obs_size_; k++)
+            acc += w[k] * obs_enc[k];
+        env_bias_[c] = acc + layer.bias[c];
+    }
+}
+
+void QuantizedMLP::forward(const float* sg, float* out, std::mt19937& gen, bool dropout, bool quantized) const
+{
+    std::vector<float> x(layers_.front().out);
+    firstLayer(sg, env_bias_.data(), obs_size_, x.data());
+    hiddenLayers(x, out, dropout ? &gen : nullptr, quantized, nullptr);
+}
+
+void QuantizedMLP::forwardFull(const float* input, float* out, bool quantized) const
+{
+    std::vector<float> x(layers_.front().out);
+    firstLayer(input, layers_.front().bias, 0, x.data());
+    hiddenLayers(x, out, nullptr, quantized, nullptr);
+}
+
+void QuantizedMLP::firstLayer(const float* input, const float* env_bias, int offset, float* out) const
+/**
+* fp32 first layer over the input columns [offset, in); columns before offset are already in env_bias
+**/
+{
+    const Layer& layer = layers_.front();
+    int n = layer.in - offset;
+    for (int c = 0; c < layer.out; c++)
+    {
+        const float* w = &layer.weight[c * layer.in + offset];
+        float acc = 0.f;
+        for (int k = 0; k < n; k++)
+            acc += w[k] * input[k];
+        out[c] = acc + env_bias[c];
+    }
+    prelu(layer, out);
+}
+
+void QuantizedMLP::hiddenLayers(std::vector<float>& x, float* out, std::mt19937* gen, bool quantized,
+                                std::vector<float>* max_abs) const
+/**
+* run layers 1..N on the output x of the first layer. Dropped activations are zeroed and the
+* 1/(1-p) rescaling is folded into the next layer, so the activation scale calibrated without
+* dropout stays valid.
+**/
+{
+    std::bernoulli_distribution keep(1.0 - dropout_p_);
+    std::vector<float> y;
+    std::vector<int8_t> qx;
+    float pending = 1.f;
+    for (int l = 0; l < layers_.size(); l++)
+    {
+        const Layer& layer = layers_[l];
+        if (l > 0)
+        {
+            y.resize(layer.out);
+            if (max_abs)
+            {
+                for (int k = 0; k < layer.in; k++)
+                    (*max_abs)[l] = std::max((*max_abs)[l], std::fabs(x[k]));
+            }
+            if (quantized)
+            {
+                float scale = layer.ascale;
+                if (!calibrated_)
+                {
+                    float m = 0.f;
+                    for (int k = 0; k < layer.in; k++)
+                        m = std::max(m, std::fabs(x[k]));
+                    scale = m / 127.f;
+                }
+                qx.resize(layer.in);
+                if (scale > 0.f)
+                {
+                    float inv = 1.f / scale;
+                    for (int k = 0; k < layer.in; k++)
+                        qx[k] = (int8_t)std::max(-127.f, std::min(127.f, std::nearbyint(x[k] * inv)));
+                }
+                else
+                    std::fill(qx.begin(), qx.end(), 0);
+                for (int c = 0; c < layer.out; c++)
+                {
+                    const int8_t* w = &layer.qweight[c * layer.in];
+                    int32_t acc = 0;
+                    for (int k = 0; k < layer.in; k++)
+                        acc += (int32_t)w[k] * (int32_t)qx[k];
+                    y[c] = acc * (layer.wscale[c] * scale * pending) + layer.bias[c];
+                }
+            }
+            else
+            {
+                for (int c = 0; c < layer.out; c++)
+                {
+                    const float* w = &layer.weight[c * layer.in];
+                    float acc = 0.f;
+                    for (int k = 0; k < layer.in; k++)
+                        acc += w[k] * x[k];
+                    y[c] = acc * pending + layer.bias[c];
+                }
+            }
+            if (layer.prelu)
+                prelu(layer, y.data());
+            x.swap(y);
+        }
+        pending = 1.f;
+        if (gen && layer.dropout)
+        {
+            for (int k = 0; k < layer.out; k++)
+            {
+                if (!keep(*gen))
+                    x[k] = 0.f;
+            }
+            pending = 1.f / (1.f - dropout_p_);
+        }
+    }
+    std::copy(x.begin(), x.begin() + output_size_, out);
+}
+
+void QuantizedMLP::prelu(const Layer& layer, float* x)
+{
+    bool shared = layer.prelu_size == 1;
+    for (int c = 0; c < layer.out; c++)
+    {
+        if (x[c] < 0.f)
+            x[c] *= shared ? layer.prelu[0] : layer.prelu[c];
+    }
+}
+
+std::size_t QuantizedMLP::quantizedWeightBytes() const
+{
+    const Layer& first = layers_.front();
+    std::size_t bytes = (std::size_t)(first.in - obs_size_) * first.out * sizeof(float);
+    for (int l = 1; l < layers_.size(); l++)
+        bytes += (std::size_t)layers_[l].in * layers_[l].out + layers_[l].out * sizeof(float);
+    return bytes;
+}
+
+std::vector<std::vector<float>> QuantizedMLP::loadSamples(const std::string& fname, int dim)
+{
+    std::vector<std::vector<float>> samples;
+    std::ifstream infile(fname);
+    std::vector<float> sample;
+    float value;
+    while (infile >> value)
+    {
+        sample.push_back(value);
+        if (sample.size() == dim)
+        {
+            samples.push_back(sample);
+            sample.clear();
+        }
+    }
+    return samples;
+}
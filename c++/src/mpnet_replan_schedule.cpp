@@ -0,0 +1,144 @@
+/**
+# bandit over the rollout budget and checking resolution of the replanning iterations
+**/
+
+#include "mpnet_replan_schedule.hpp"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+ReplanSchedule::ReplanSchedule(const std::string& fname, double exploration)
+  : fname_(fname)
+  , exploration_(exploration)
+  , arms_({{1, 4}, {2, 4}, {1, 2}, {2, 2}, {3, 2}, {2, 1}, {3, 1}})
+{
+    for (int s = 0; s < NUM_STAGES; s++)
+        stats_[s].resize(arms_.size());
+    if (!fname_.empty())
+        load(fname_);
+}
+
+bool ReplanSchedule::load(const std::string& fname)
+{
+    std::ifstream infile(fname);
+    if (!infile.is_open())
+        return false;
+    std::lock_guard<std::mutex> lock(mutex_);
+    int stage, length_factor, step_factor;
+    ArmStats stats;
+    while (infile >> stage >> length_factor >> step_factor >> stats.iterations >> stats.connected >> stats.feasible
+           >> stats.coarse_misses >> stats.seconds)
+    {
+        // arms that are no longer in the schedule are dropped
+        for (int a = 0; a < arms_.size(); a++)
+        {
+            if (stage >= 0 && stage < NUM_STAGES && arms_[a].length_factor == length_factor &&
+                arms_[a].step_factor == step_factor)
+                stats_[stage][a] = stats;
+        }
+    }
+    return true;
+}
+
+bool ReplanSchedule::save(const std::string& fname) const
+{
+    std::ofstream outfile(fname);
+    if (!outfile.is_open())
+        return false;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int s = 0; s < NUM_STAGES; s++)
+        for (int a = 0; a < arms_.size(); a++)
+        {
+            const ArmStats& stats = stats_[s][a];
+            outfile << s << " " << arms_[a].length_factor << " " << arms_[a].step_factor << " " << stats.iterations << " "
+                    << stats.connected << " " << stats.feasible << " " << stats.coarse_misses << " " << stats.seconds
+                    << "\n";
+        }
+    return true;
+}
+
+bool ReplanSchedule::save() const
+{
+    return !fname_.empty() && save(fname_);
+}
+
+ReplanSchedule::Stage ReplanSchedule::stage(int iter, int max_replan)
+{
+    if (iter == 0)
+        return FIRST;
+    return iter < 0.30 * max_replan ? EARLY : LATE;
+}
+
+int ReplanSchedule::defaultArm(Stage stage) const
+{
+    // max_length at 4x step, then 2x at 2x step, then 3x at the finest step
+    const Arm fixed[NUM_STAGES] = {{1, 4}, {2, 2}, {3, 1}};
+    for (int a = 0; a < arms_.size(); a++)
+    {
+        if (arms_[a].length_factor == fixed[stage].length_factor && arms_[a].step_factor == fixed[stage].step_factor)
+            return a;
+    }
+    return 0;
+}
+
+int ReplanSchedule::choose(Stage stage) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    const std::vector<ArmStats>& stats = stats_[stage];
+    int fixed = defaultArm(stage);
+    if (stats[fixed].iterations == 0)
+        return fixed;
+    unsigned long total = 0;
+    for (int a = 0; a < arms_.size(); a++)
+    {
+        if (stats[a].iterations == 0)
+            return a;
+        total += stats[a].iterations;
+    }
+    int best = fixed;
+    double best_score = -1.;
+    for (int a = 0; a < arms_.size(); a++)
+    {
+        // upper bound of the feasible rate per iteration, over the mean iteration time
+        double n = stats[a].iterations;
+        double p = (stats[a].feasible + 1.) / (n + 2.);
+        double upper = std::min(1., p + exploration_ * std::sqrt(2. * std::log((double)total) / n));
+        double score = upper / std::max(stats[a].seconds / n, 1e-9);
+        if (score > best_score)
+        {
+            best_score = score;
+            best = a;
+        }
+    }
+    return best;
+}
+
+void ReplanSchedule::report(Stage stage, int arm, bool connected, bool feasible, double seconds)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ArmStats& stats = stats_[stage][arm];
+    stats.iterations += 1;
+    stats.connected += connected;
+    stats.feasible += feasible;
+    stats.coarse_misses += connected && !feasible;
+    stats.seconds += seconds;
+}
+
+ReplanSchedule::ArmStats ReplanSchedule::getStats(Stage stage, int arm) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_[stage][arm];
+}
+
+int ReplanSchedule::getBest(Stage stage) const
+{
+    // the arm the bandit settled on is the one it played most
+    std::lock_guard<std::mutex> lock(mutex_);
+    int best = defaultArm(stage);
+    for (int a = 0; a < arms_.size(); a++)
+    {
+        if (stats_[stage][a].iterations > stats_[stage][best].iterations)
+            best = a;
+    }
+    return best;
+}
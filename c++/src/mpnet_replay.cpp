@@ -0,0 +1,193 @@
+/**
+* Replays the queries of a ReplayLog (home_ompl --record-log=<file>) through MPNetPlanner, with
+* the predictions and the collision checks served from the log. The rollouts, lvc and replanning
+* are timed on their own, and no models or meshes are needed unless --live-collision or --compare
+* is given. The planner settings (--lazy, --connect-k) have to be the ones of the recording.
+**/
+#include <omplapp/apps/SE3RigidBodyPlanning.h>
+#include <omplapp/config.h>
+#include <ompl/base/spaces/SE3StateSpace.h>
+#include <ompl/base/goals/GoalStates.h>
+#include "mpnet_planner.hpp"
+#include "mpnet_replay_log.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace ompl;
+
+namespace
+{
+    /** \brief the recorded floats as they are, so that the planner sees the same start/goal inputs */
+    void setSE3State(const std::vector<float>& vec, base::State* state)
+    {
+        auto* se3 = state->as<base::SE3StateSpace::StateType>();
+        se3->setXYZ(vec[0], vec[1], vec[2]);
+        se3->rotation().x = vec[3];
+        se3->rotation().y = vec[4];
+        se3->rotation().z = vec[5];
+        se3->rotation().w = vec[6];
+    }
+}
+
+int main(int argc, char** argv)
+{
+    // command line options:
+    //   --log=<file>        replay log to replay
+    //   --repeat=<n>        replay every query n times
+    //   --time=<s>          time limit of a solve
+    //   --lazy              lazy collision checking, as in the recording
+    //   --connect-k=<k>     connect_k of the recording
+    //   --live-collision    check collisions with the home meshes instead of the log
+    //   --compare           load the networks, run them on the recorded inputs and compare their outputs
+    //   --int8              with --compare, compare the int8 MLP backend
+    std::string log_fname = "";
+    int repeat = 1;
+    double max_time = 120.;
+    bool lazy = false;
+    int connect_k = 0;
+    bool live_collision = false;
+    bool compare = false;
+    bool use_int8 = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (arg.compare(0, 6, "--log=") == 0)
+            log_fname = arg.substr(6);
+        else if (arg.compare(0, 9, "--repeat=") == 0)
+            repeat = std::stoi(arg.substr(9));
+        else if (arg.compare(0, 7, "--time=") == 0)
+            max_time = std::stod(arg.substr(7));
+        else if (arg == "--lazy")
+            lazy = true;
+        else if (arg.compare(0, 12, "--connect-k=") == 0)
+            connect_k = std::stoi(arg.substr(12));
+        else if (arg == "--live-collision")
+            live_collision = true;
+        else if (arg == "--compare")
+            compare = true;
+        else if (arg == "--int8")
+            use_int8 = true;
+    }
+    auto log = std::make_shared<ReplayLog>();
+    if (log_fname.empty() || !log->load(log_fname))
+    {
+        std::cout << "expected --log=<replay log>" << std::endl;
+        return 1;
+    }
+
+    std::unique_ptr<geometric::SimpleSetup> setup;
+    if (live_collision)
+    {
+        auto* app = new app::SE3RigidBodyPlanning();
+        app->setRobotMesh(std::string(OMPLAPP_RESOURCE_DIR) + "/3D/Home_robot.dae");
+        app->setEnvironmentMesh(std::string(OMPLAPP_RESOURCE_DIR) + "/3D/Home_env.dae");
+        setup.reset(app);
+    }
+    else
+    {
+        // every check is served from the log; the bounds only have to contain the recorded states
+        auto space = std::make_shared<base::SE3StateSpace>();
+        std::vector<double> lower(3, std::numeric_limits<double>::infinity());
+        std::vector<double> upper(3, -std::numeric_limits<double>::infinity());
+        for (const ReplayLog::Query& query : log->queries())
+            for (const auto* states : {&query.starts, &query.goals})
+                for (const auto& state : *states)
+                    for (int a = 0; a < 3; a++)
+                    {
+                        lower[a] = std::min(lower[a], (double)state[a]);
+                        upper[a] = std::max(upper[a], (double)state[a]);
+                    }
+        base::RealVectorBounds bounds(3);
+        for (int a = 0; a < 3; a++)
+        {
+            double margin = lower[a] <= upper[a] ? (upper[a] - lower[a]) / 2 + 1. : 1.;
+            bounds.setLow(a, lower[a] <= upper[a] ? lower[a] - margin : -margin);
+            bounds.setHigh(a, lower[a] <= upper[a] ? upper[a] + margin : margin);
+        }
+        space->setBounds(bounds);
+        setup.reset(new geometric::SimpleSetup(space));
+        setup->setStateValidityChecker([](const base::State*) { return true; });
+    }
+    setup->getSpaceInformation()->setStateValidityCheckingResolution(0.01);
+
+    MPNetPlanner::StartupOptions startup;
+    startup.load_networks = compare;
+    MPNetPlanner* planner = new MPNetPlanner(setup->getSpaceInformation(), false, 1001, 3000, startup);
+    setup->setPlanner(base::PlannerPtr(planner));
+    if (compare && use_int8 && !planner->setMLPBackend(MPNetPlanner::INT8_MLP))
+    {
+        std::cout << "int8 MLP rejected, comparing the TorchScript MLP." << std::endl;
+    }
+    planner->setLazyCollisionChecking(lazy);
+    planner->setConnectNearest(connect_k);
+    int mode = ReplayLog::REPLAY_INFERENCE | (live_collision ? 0 : ReplayLog::REPLAY_COLLISION) |
+               (compare ? ReplayLog::COMPARE_INFERENCE : 0);
+    planner->setReplayLog(log, mode);
+
+    std::vector<double> plan_times;
+    int solved = 0;
+    for (int r = 0; r < repeat; r++)
+    {
+        log->rewind();
+        for (int q = 0; q < log->queries().size(); q++)
+        {
+            const ReplayLog::Query& query = log->queries()[q];
+            if (query.starts.empty() || query.goals.empty())
+            {
+                // no goal could be sampled when it was recorded, nothing to replay
+                log->nextQuery();
+                continue;
+            }
+            setup->clear();
+            setup->clearStartStates();
+            for (const auto& start_vec : query.starts)
+            {
+                base::ScopedState<base::SE3StateSpace> start(setup->getSpaceInformation());
+                setSE3State(start_vec, start.get());
+                setup->addStartState(start);
+            }
+            // the sampled goals in their order, GoalStates samples them again in that order
+            auto goals = std::make_shared<base::GoalStates>(setup->getSpaceInformation());
+            for (const auto& goal_vec : query.goals)
+            {
+                base::ScopedState<base::SE3StateSpace> goal(setup->getSpaceInformation());
+                setSE3State(goal_vec, goal.get());
+                goals->addState(goal);
+            }
+            setup->setGoal(goals);
+            auto plan_t0 = std::chrono::steady_clock::now();
+            base::PlannerStatus status = setup->solve(max_time);
+            plan_times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - plan_t0).count());
+            solved += status == base::PlannerStatus::EXACT_SOLUTION;
+            if (r == 0)
+            {
+                std::cout << "query " << q << ": " << (status == base::PlannerStatus::EXACT_SOLUTION ? "solved" : "not solved")
+                          << " in " << plan_times.back() << "s, " << planner->getCollisionChecks() << " collision checks"
+                          << std::endl;
+            }
+        }
+    }
+
+    std::sort(plan_times.begin(), plan_times.end());
+    const ReplayLog::ReplayStats& stats = log->stats();
+    if (!plan_times.empty())
+    {
+        std::cout << solved << "/" << plan_times.size() << " solves, plan time p50 " << plan_times[plan_times.size() / 2]
+                  << "s, p99 " << plan_times[std::min(plan_times.size() - 1, plan_times.size() * 99 / 100)] << "s" << std::endl;
+    }
+    std::cout << "served " << stats.predictions_served << " predictions (" << stats.prediction_mismatches
+              << " with other inputs than recorded) and " << stats.checks_served << " collision checks ("
+              << stats.check_mismatches << " run live)" << std::endl;
+    if (compare)
+    {
+        std::cout << "live MLP: " << stats.bit_identical << "/" << stats.compared
+                  << " outputs bit-identical to the recording, max deviation " << stats.max_deviation << std::endl;
+    }
+    return 0;
+}
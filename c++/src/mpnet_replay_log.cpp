@@ -0,0 +1,211 @@
+/**
+# record and replay of planner queries, predictions and collision checks
+**/
+
+#include "mpnet_replay_log.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+    const char kMagic[4] = {'M', 'P', 'R', 'L'};
+    const int32_t kVersion = 1;
+
+    template <typename T>
+    void writeArray(std::ostream& out, const std::vector<T>& values)
+    {
+        int32_t n = values.size();
+        out.write((const char*)&n, sizeof(n));
+        out.write((const char*)values.data(), n * sizeof(T));
+    }
+
+    template <typename T>
+    bool readArray(std::istream& in, std::vector<T>& values)
+    {
+        int32_t n = 0;
+        if (!in.read((char*)&n, sizeof(n)) || n < 0)
+            return false;
+        values.resize(n);
+        return (bool)in.read((char*)values.data(), n * sizeof(T));
+    }
+
+    void writeStates(std::ostream& out, const std::vector<std::vector<float>>& states)
+    {
+        std::vector<float> flat;
+        for (const auto& state : states)
+            flat.insert(flat.end(), state.begin(), state.end());
+        writeArray(out, flat);
+    }
+
+    bool readStates(std::istream& in, std::vector<std::vector<float>>& states)
+    {
+        std::vector<float> flat;
+        if (!readArray(in, flat) || flat.size() % ReplayLog::kOutputSize != 0)
+            return false;
+        states.clear();
+        for (std::size_t i = 0; i < flat.size(); i += ReplayLog::kOutputSize)
+            states.emplace_back(flat.begin() + i, flat.begin() + i + ReplayLog::kOutputSize);
+        return true;
+    }
+}
+
+bool ReplayLog::load(const std::string& fname)
+{
+    std::ifstream infile(fname, std::ios::binary);
+    char magic[4];
+    int32_t version = 0, n = 0;
+    if (!infile.read(magic, 4) || std::memcmp(magic, kMagic, 4) != 0 ||
+        !infile.read((char*)&version, sizeof(version)) || version != kVersion ||
+        !infile.read((char*)&n, sizeof(n)) || n < 0)
+        return false;
+    std::vector<Query> queries(n);
+    for (Query& query : queries)
+    {
+        if (!readStates(infile, query.starts) || !readStates(infile, query.goals) || !readArray(infile, query.enc) ||
+            !readArray(infile, query.inputs) || !readArray(infile, query.outputs) ||
+            !readArray(infile, query.check_keys) || !readArray(infile, query.check_counts) ||
+            !readArray(infile, query.check_results))
+            return false;
+        if (query.inputs.size() / kInputSize != query.outputs.size() / kOutputSize ||
+            query.check_keys.size() != query.check_counts.size() ||
+            query.check_keys.size() != query.check_results.size())
+            return false;
+    }
+    queries_ = std::move(queries);
+    rewind();
+    return true;
+}
+
+bool ReplayLog::save(const std::string& fname) const
+{
+    std::ofstream outfile(fname, std::ios::binary);
+    if (!outfile.is_open())
+        return false;
+    int32_t n = queries_.size();
+    outfile.write(kMagic, 4);
+    outfile.write((const char*)&kVersion, sizeof(kVersion));
+    outfile.write((const char*)&n, sizeof(n));
+    for (const Query& query : queries_)
+    {
+        writeStates(outfile, query.starts);
+        writeStates(outfile, query.goals);
+        writeArray(outfile, query.enc);
+        writeArray(outfile, query.inputs);
+        writeArray(outfile, query.outputs);
+        writeArray(outfile, query.check_keys);
+        writeArray(outfile, query.check_counts);
+        writeArray(outfile, query.check_results);
+    }
+    return (bool)outfile;
+}
+
+void ReplayLog::beginQuery(const std::vector<std::vector<float>>& starts, const std::vector<float>& enc)
+{
+    queries_.emplace_back();
+    queries_.back().starts = starts;
+    queries_.back().enc = enc;
+}
+
+void ReplayLog::addGoal(const std::vector<float>& goal)
+{
+    if (!queries_.empty())
+        queries_.back().goals.push_back(goal);
+}
+
+void ReplayLog::addPrediction(const float* input, const float* output)
+{
+    if (queries_.empty())
+        return;
+    Query& query = queries_.back();
+    query.inputs.insert(query.inputs.end(), input, input + kInputSize);
+    query.outputs.insert(query.outputs.end(), output, output + kOutputSize);
+}
+
+void ReplayLog::addCheck(uint32_t key, bool valid, uint32_t count)
+{
+    if (queries_.empty())
+        return;
+    Query& query = queries_.back();
+    query.check_keys.push_back(key);
+    query.check_counts.push_back(count);
+    query.check_results.push_back(valid ? 1 : 0);
+}
+
+bool ReplayLog::nextQuery()
+{
+    if (current_ + 1 >= (int)queries_.size())
+        return false;
+    current_++;
+    next_prediction_ = 0;
+    next_check_ = 0;
+    return true;
+}
+
+void ReplayLog::rewind()
+{
+    current_ = -1;
+    next_prediction_ = 0;
+    next_check_ = 0;
+}
+
+bool ReplayLog::nextPrediction(const float* input, float* output)
+/**
+* the recorded output is served even if the input differs, so that a replay without the
+* networks can go on; the mismatch is counted
+**/
+{
+    if (current_ < 0 || current_ >= (int)queries_.size())
+        return false;
+    const Query& query = queries_[current_];
+    if ((next_prediction_ + 1) * kOutputSize > query.outputs.size())
+        return false;
+    if (std::memcmp(input, query.inputs.data() + next_prediction_ * kInputSize, kInputSize * sizeof(float)) != 0)
+        stats_.prediction_mismatches++;
+    std::copy_n(query.outputs.data() + next_prediction_ * kOutputSize, kOutputSize, output);
+    next_prediction_++;
+    stats_.predictions_served++;
+    return true;
+}
+
+bool ReplayLog::nextCheck(uint32_t key, bool& valid, uint32_t& count)
+{
+    if (current_ < 0 || current_ >= (int)queries_.size() || next_check_ >= queries_[current_].check_keys.size())
+    {
+        stats_.check_mismatches++;
+        return false;
+    }
+    const Query& query = queries_[current_];
+    std::size_t i = next_check_++;
+    if (query.check_keys[i] != key)
+    {
+        stats_.check_mismatches++;
+        return false;
+    }
+    valid = query.check_results[i] != 0;
+    count = query.check_counts[i];
+    stats_.checks_served++;
+    return true;
+}
+
+void ReplayLog::comparePrediction(const float* recorded, const float* live)
+{
+    stats_.compared++;
+    if (std::memcmp(recorded, live, kOutputSize * sizeof(float)) == 0)
+        stats_.bit_identical++;
+    for (int i = 0; i < kOutputSize; i++)
+        stats_.max_deviation = std::max(stats_.max_deviation, (double)std::fabs(recorded[i] - live[i]));
+}
+
+uint32_t ReplayLog::hash(const float* data, int n, uint32_t seed)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint32_t h = seed;
+    for (std::size_t i = 0; i < n * sizeof(float); i++)
+    {
+        h ^= bytes[i];
+        h *= 16777619u;
+    }
+    return h;
+}
@@ -0,0 +1,135 @@
+/**
+# trace-event recording of the planner phases
+**/
+
+#include "mpnet_trace.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+namespace
+{
+    int64_t steadyMicroseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+TraceRecorder& TraceRecorder::instance()
+{
+    static TraceRecorder recorder;
+    return recorder;
+}
+
+TraceRecorder::TraceRecorder()
+  : epoch_(steadyMicroseconds())
+{
+}
+
+int64_t TraceRecorder::now() const
+{
+    return steadyMicroseconds() - epoch_;
+}
+
+TraceRecorder::ThreadBuffer& TraceRecorder::buffer()
+{
+    thread_local ThreadOwner owner;
+    if (owner.buffer == nullptr)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.empty())
+        {
+            buffers_.emplace_back(new ThreadBuffer());
+            buffers_.back()->events.resize(capacity_);
+            free_.push_back(buffers_.back().get());
+        }
+        owner.buffer = free_.back();
+        free_.pop_back();
+        owner.buffer->tid = next_tid_++;
+        owner.buffer->next.store(0, std::memory_order_relaxed);
+        active_.push_back(owner.buffer);
+    }
+    return *owner.buffer;
+}
+
+TraceRecorder::ThreadOwner::~ThreadOwner()
+{
+    if (buffer)
+        TraceRecorder::instance().release(buffer);
+}
+
+void TraceRecorder::release(ThreadBuffer* buffer)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t end = buffer->next.load(std::memory_order_relaxed);
+    uint64_t begin = end > capacity_ ? end - capacity_ : 0;
+    for (uint64_t i = begin; i < end; i++)
+        finished_.emplace_back(buffer->tid, buffer->events[i % capacity_]);
+    while (finished_.size() > max_finished_)
+        finished_.pop_front();
+    active_.erase(std::find(active_.begin(), active_.end(), buffer));
+    free_.push_back(buffer);
+}
+
+void TraceRecorder::record(const char* name, int64_t start_us, int64_t duration_us, int64_t arg)
+{
+    ThreadBuffer& buf = buffer();
+    uint64_t i = buf.next.load(std::memory_order_relaxed);
+    buf.events[i % capacity_] = {name, start_us, duration_us, arg};
+    // single writer per buffer: publishing the index is enough for save()
+    buf.next.store(i + 1, std::memory_order_release);
+}
+
+bool TraceRecorder::save(const std::string& fname) const
+{
+    std::ofstream outfile(fname);
+    if (!outfile.is_open())
+        return false;
+    outfile << "{\"traceEvents\":[\n";
+    bool first = true;
+    auto write = [&](int tid, const Event& event) {
+        outfile << (first ? "" : ",\n") << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                << tid << ",\"ts\":" << event.start << ",\"dur\":" << event.duration;
+        if (event.arg >= 0)
+            outfile << ",\"args\":{\"index\":" << event.arg << "}";
+        outfile << "}";
+        first = false;
+    };
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& finished : finished_)
+        write(finished.first, finished.second);
+    for (const ThreadBuffer* buf : active_)
+    {
+        uint64_t end = buf->next.load(std::memory_order_acquire);
+        uint64_t begin = end > capacity_ ? end - capacity_ : 0;
+        for (uint64_t i = begin; i < end; i++)
+            write(buf->tid, buf->events[i % capacity_]);
+    }
+    outfile << "\n]}\n";
+    return (bool)outfile;
+}
+
+TraceSpan::TraceSpan(const char* name, int64_t arg)
+  : name_(name)
+  , arg_(arg)
+  , active_(TraceRecorder::instance().enabled())
+  , perf_(PerfRecorder::instance().enabled())
+{
+    if (active_)
+        start_ = TraceRecorder::instance().now();
+    if (perf_)
+        perf_ = PerfRecorder::instance().read(perf_start_);
+}
+
+TraceSpan::~TraceSpan()
+{
+    if (active_)
+    {
+        TraceRecorder& recorder = TraceRecorder::instance();
+        recorder.record(name_, start_, recorder.now() - start_, arg_);
+    }
+    uint64_t perf_end[PerfRecorder::NUM_COUNTERS];
+    if (perf_ && PerfRecorder::instance().read(perf_end))
+        PerfRecorder::instance().add(name_, perf_start_, perf_end);
+}
@@ -0,0 +1,249 @@
+/**
+# conservative free/colliding tiers ahead of the exact state validity checker
+**/
+
+#include "mpnet_two_tier_checker.hpp"
+#include <ompl/base/spaces/SE3StateSpace.h>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <stdexcept>
+
+namespace
+{
+    void cross(const double* a, const double* b, double* out)
+    {
+        out[0] = a[1] * b[2] - a[2] * b[1];
+        out[1] = a[2] * b[0] - a[0] * b[2];
+        out[2] = a[0] * b[1] - a[1] * b[0];
+    }
+
+    double dot(const double* a, const double* b)
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+}
+
+TwoTierValidityChecker::TwoTierValidityChecker(const ompl::base::SpaceInformationPtr& si,
+                                               const ompl::base::StateValidityCheckerPtr& exact,
+                                               const std::shared_ptr<const DistanceField>& field,
+                                               const std::vector<BoundingSphere>& spheres,
+                                               const std::vector<Triangle3>& env_triangles,
+                                               const std::vector<Triangle3>& robot_triangles, const Point3& shift,
+                                               int grid_size, int probe_edges, int max_triangle_tests)
+  : ompl::base::StateValidityChecker(si)
+  , exact_(exact)
+  , field_(field)
+  , spheres_(spheres)
+  , max_triangle_tests_(max_triangle_tests)
+  , triangles_(env_triangles)
+  , resolution_(3)
+  , n_(grid_size)
+{
+    if (!exact_ || env_triangles.empty())
+        throw std::runtime_error("TwoTierValidityChecker: needs the exact checker and the environment triangles");
+
+    // the longest distinct edges of the robot, in the frame of the shifted robot
+    std::map<std::pair<Point3, Point3>, double> edges;
+    for (const Triangle3& tri : robot_triangles)
+        for (int e = 0; e < 3; e++)
+        {
+            Point3 a = tri[e], b = tri[(e + 1) % 3];
+            for (int k = 0; k < 3; k++)
+            {
+                a[k] -= shift[k];
+                b[k] -= shift[k];
+            }
+            if (b < a)
+                std::swap(a, b);
+            edges[{a, b}] = std::sqrt(std::pow(b[0] - a[0], 2) + std::pow(b[1] - a[1], 2) + std::pow(b[2] - a[2], 2));
+        }
+    std::vector<std::pair<double, std::pair<Point3, Point3>>> by_length;
+    for (const auto& edge : edges)
+        by_length.emplace_back(edge.second, edge.first);
+    std::sort(by_length.begin(), by_length.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+    for (int i = 0; i < std::min((int)by_length.size(), probe_edges); i++)
+        probe_edges_.push_back(by_length[i].second);
+
+    // triangles bucketed by the cells of their bounds
+    std::vector<float> upper;
+    Voxelizer::triangleBounds(env_triangles, lower_, upper);
+    for (int a = 0; a < 3; a++)
+    {
+        upper[a] += 1e-3f * (upper[a] - lower_[a]) + 1e-6f;
+        resolution_[a] = ((double)upper[a] - lower_[a]) / n_;
+    }
+    int cells = n_ * n_ * n_;
+    std::vector<std::vector<int>> buckets(cells);
+    for (int t = 0; t < (int)triangles_.size(); t++)
+    {
+        int lo[3], hi[3];
+        for (int a = 0; a < 3; a++)
+        {
+            float tmin = std::min({triangles_[t][0][a], triangles_[t][1][a], triangles_[t][2][a]});
+            float tmax = std::max({triangles_[t][0][a], triangles_[t][1][a], triangles_[t][2][a]});
+            lo[a] = std::max(0, (int)std::floor((tmin - lower_[a]) / resolution_[a]));
+            hi[a] = std::min(n_ - 1, (int)std::floor((tmax - lower_[a]) / resolution_[a]));
+        }
+        for (int i = lo[0]; i <= hi[0]; i++)
+            for (int j = lo[1]; j <= hi[1]; j++)
+                for (int k = lo[2]; k <= hi[2]; k++)
+                    buckets[(i * n_ + j) * n_ + k].push_back(t);
+    }
+    occupied_.assign((cells + 63) / 64, 0);
+    cell_offsets_.assign(cells + 1, 0);
+    for (int c = 0; c < cells; c++)
+    {
+        if (!buckets[c].empty())
+            occupied_[c / 64] |= uint64_t(1) << (c % 64);
+        cell_offsets_[c + 1] = cell_offsets_[c] + buckets[c].size();
+        cell_triangles_.insert(cell_triangles_.end(), buckets[c].begin(), buckets[c].end());
+    }
+}
+
+bool TwoTierValidityChecker::isValid(const ompl::base::State* state) const
+{
+    if (!si_->satisfiesBounds(state))
+    {
+        colliding_++;
+        return false;
+    }
+    const auto* se3 = state->as<ompl::base::SE3StateSpace::StateType>();
+    double t[3] = {se3->getX(), se3->getY(), se3->getZ()};
+    double q[4] = {se3->rotation().x, se3->rotation().y, se3->rotation().z, se3->rotation().w};
+    if (definitelyFree(t, q))
+    {
+        free_++;
+        return true;
+    }
+    if (definitelyColliding(t, q))
+    {
+        colliding_++;
+        return false;
+    }
+    exact_checks_++;
+    return exact_->isValid(state);
+}
+
+TwoTierValidityChecker::Counts TwoTierValidityChecker::getCounts() const
+{
+    Counts counts;
+    counts.free = free_;
+    counts.colliding = colliding_;
+    counts.exact = exact_checks_;
+    return counts;
+}
+
+void TwoTierValidityChecker::resetCounts()
+{
+    free_ = 0;
+    colliding_ = 0;
+    exact_checks_ = 0;
+}
+
+void TwoTierValidityChecker::transform(const double* t, const double* q, const Point3& p, double* out)
+{
+    // v + 2w (u x v) + 2 u x (u x v), u the vector part of q
+    double v[3] = {p[0], p[1], p[2]};
+    double uv[3], uuv[3];
+    cross(q, v, uv);
+    cross(q, uv, uuv);
+    for (int k = 0; k < 3; k++)
+        out[k] = t[k] + v[k] + 2. * (q[3] * uv[k] + uuv[k]);
+}
+
+bool TwoTierValidityChecker::definitelyFree(const double* t, const double* q) const
+{
+    if (!field_ || spheres_.empty())
+        return false;
+    double center[3];
+    for (const BoundingSphere& sphere : spheres_)
+    {
+        transform(t, q, sphere.center, center);
+        if (field_->clearance(center) <= sphere.radius)
+            return false;
+    }
+    return true;
+}
+
+bool TwoTierValidityChecker::definitelyColliding(const double* t, const double* q) const
+/**
+* the cells along each probe edge are visited at steps of half a cell; a cell the walk skips only
+* costs a collision that is then left to the exact checker
+**/
+{
+    double step = 0.5 * std::min({resolution_[0], resolution_[1], resolution_[2]});
+    int tests = 0;
+    double p0[3], p1[3], p[3];
+    for (const auto& edge : probe_edges_)
+    {
+        transform(t, q, edge.first, p0);
+        transform(t, q, edge.second, p1);
+        double length = std::sqrt((p1[0] - p0[0]) * (p1[0] - p0[0]) + (p1[1] - p0[1]) * (p1[1] - p0[1]) +
+                                  (p1[2] - p0[2]) * (p1[2] - p0[2]));
+        int samples = std::max(1, (int)std::ceil(length / step));
+        int last_cell = -1;
+        for (int s = 0; s <= samples; s++)
+        {
+            for (int k = 0; k < 3; k++)
+                p[k] = p0[k] + (p1[k] - p0[k]) * s / samples;
+            int cell = cellOf(p);
+            if (cell < 0 || cell == last_cell)
+                continue;
+            last_cell = cell;
+            if (!occupied(cell))
+                continue;
+            for (int i = cell_offsets_[cell]; i < cell_offsets_[cell + 1]; i++)
+            {
+                if (segmentCrossesTriangle(p0, p1, triangles_[cell_triangles_[i]]))
+                    return true;
+                if (++tests >= max_triangle_tests_)
+                    return false;
+            }
+        }
+    }
+    return false;
+}
+
+int TwoTierValidityChecker::cellOf(const double* p) const
+{
+    int idx[3];
+    for (int a = 0; a < 3; a++)
+    {
+        idx[a] = (int)std::floor((p[a] - lower_[a]) / resolution_[a]);
+        if (idx[a] < 0 || idx[a] >= n_)
+            return -1;
+    }
+    return (idx[0] * n_ + idx[1]) * n_ + idx[2];
+}
+
+bool TwoTierValidityChecker::segmentCrossesTriangle(const double* p0, const double* p1, const Triangle3& tri)
+/**
+* Moller-Trumbore; grazing and parallel configurations are not counted, the exact check decides them
+**/
+{
+    const double eps = 1e-6;
+    double v0[3] = {tri[0][0], tri[0][1], tri[0][2]};
+    double e1[3], e2[3], d[3], s[3], h[3], qv[3];
+    for (int k = 0; k < 3; k++)
+    {
+        e1[k] = tri[1][k] - v0[k];
+        e2[k] = tri[2][k] - v0[k];
+        d[k] = p1[k] - p0[k];
+        s[k] = p0[k] - v0[k];
+    }
+    cross(d, e2, h);
+    double det = dot(e1, h);
+    if (std::fabs(det) < 1e-12)
+        return false;
+    double inv = 1. / det;
+    double u = inv * dot(s, h);
+    if (u <= eps || u >= 1. - eps)
+        return false;
+    cross(s, e1, qv);
+    double v = inv * dot(d, qv);
+    if (v <= eps || u + v >= 1. - eps)
+        return false;
+    double x = inv * dot(e2, qv);
+    return x > eps && x < 1. - eps;
+}
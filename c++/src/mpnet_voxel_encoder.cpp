@@ -0,0 +1,339 @@
+/**
+# native voxel obstacle encoder with incremental updates
+**/
+
+#include "mpnet_voxel_encoder.hpp"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+    /** \brief output cells [lo, hi] of a strided window that contain input index x */
+    void affectedRange(int x, int kernel, int stride, int n, int& lo, int& hi)
+    {
+        lo = std::max(0, (x - kernel + stride) / stride);
+        hi = std::min(n - 1, x / stride);
+    }
+}
+
+VoxelEncoder::VoxelEncoder(const torch::jit::script::Module& encoder, int grid_size, int conv1_stride, int pool,
+                           int conv2_stride)
+  : s1_(conv1_stride)
+  , pool_(pool)
+  , s2_(conv2_stride)
+  , n0_(grid_size)
+{
+    // parameters are registered as encoder.0 (conv), encoder.1 (PReLU), encoder.3 (conv), encoder.4 (PReLU), head.0
+    int convs = 0;
+    std::vector<float>* last_bias = nullptr;
+    std::vector<float>* last_prelu = nullptr;
+    for (const auto& param : encoder.named_parameters(/*recurse=*/true))
+    {
+        at::Tensor t = param.value.to(at::kCPU).contiguous();
+        const float* data = t.data_ptr<float>();
+        std::vector<float> values(data, data + t.numel());
+        const std::string& name = param.name;
+        if (t.dim() == 5)
+        {
+            convs += 1;
+            if (convs == 1)
+            {
+                c1_ = t.size(0);
+                k1_ = t.size(2);
+                w1_ = values;
+                last_bias = &b1_;
+                last_prelu = &a1_;
+            }
+            else if (convs == 2)
+            {
+                c2_ = t.size(0);
+                k2_ = t.size(2);
+                w2_ = values;
+                last_bias = &b2_;
+                last_prelu = &a2_;
+            }
+            else
+                throw std::runtime_error("VoxelEncoder: expected two Conv3d layers");
+        }
+        else if (t.dim() == 2)
+        {
+            head_out_ = t.size(0);
+            wh_ = values;
+            last_bias = &bh_;
+            last_prelu = nullptr;
+        }
+        else if (last_bias && name.size() >= 4 && name.compare(name.size() - 4, 4, "bias") == 0)
+            *last_bias = values;
+        else if (last_prelu)
+            *last_prelu = values;
+        else
+            throw std::runtime_error("VoxelEncoder: unexpected parameter " + name);
+    }
+    init();
+}
+
+void VoxelEncoder::init()
+{
+    if (c1_ == 0 || c2_ == 0 || head_out_ == 0 || a1_.empty() || a2_.empty())
+        throw std::runtime_error("VoxelEncoder: missing encoder parameters");
+    n1_ = (n0_ - k1_) / s1_ + 1;
+    np_ = n1_ / pool_;
+    n2_ = (np_ - k2_) / s2_ + 1;
+    if (wh_.size() != (std::size_t)head_out_ * c2_ * n2_ * n2_ * n2_)
+        throw std::runtime_error("VoxelEncoder: head input size does not match the conv output, check the strides");
+    voxels_.assign(n0_ * n0_ * n0_, 0.f);
+    act1_.assign(c1_ * n1_ * n1_ * n1_, 0.f);
+    pooled_.assign(c1_ * np_ * np_ * np_, 0.f);
+    act2_.assign(c2_ * n2_ * n2_ * n2_, 0.f);
+    row_words_ = (n0_ + 63) / 64;
+    bits_.assign(n0_ * n0_ * row_words_, 0);
+    if (k1_ > 64)
+        packed_ = false;
+    // channels innermost, so that one voxel or input adds to all channel accumulators at once
+    int ksize1 = k1_ * k1_ * k1_;
+    w1t_.resize(w1_.size());
+    for (int c = 0; c < c1_; c++)
+        for (int t = 0; t < ksize1; t++)
+            w1t_[t * c1_ + c] = w1_[c * ksize1 + t];
+    int ksize2 = k2_ * k2_ * k2_;
+    w2t_.resize(w2_.size());
+    for (int c = 0; c < c2_; c++)
+        for (int ci = 0; ci < c1_; ci++)
+            for (int t = 0; t < ksize2; t++)
+                w2t_[(ci * ksize2 + t) * c2_ + c] = w2_[(c * c1_ + ci) * ksize2 + t];
+    acc_.assign(std::max(c1_, c2_), 0.f);
+}
+
+void VoxelEncoder::encode(const float* voxels, float* out)
+{
+    std::copy(voxels, voxels + voxels_.size(), voxels_.begin());
+    binary_ = std::all_of(voxels_.begin(), voxels_.end(), [](float v) { return v == 0.f || v == 1.f; });
+    if (binary_)
+    {
+        std::fill(bits_.begin(), bits_.end(), 0);
+        for (int x = 0; x < n0_; x++)
+            for (int y = 0; y < n0_; y++)
+                for (int z = 0; z < n0_; z++)
+                    if (voxels_[(x * n0_ + y) * n0_ + z] == 1.f)
+                        setBit(x, y, z, true);
+    }
+    for (int i = 0; i < n1_; i++)
+        for (int j = 0; j < n1_; j++)
+            for (int k = 0; k < n1_; k++)
+                conv1Cell(i, j, k);
+    for (int i = 0; i < np_; i++)
+        for (int j = 0; j < np_; j++)
+            for (int k = 0; k < np_; k++)
+                poolCell(i, j, k);
+    for (int i = 0; i < n2_; i++)
+        for (int j = 0; j < n2_; j++)
+            for (int k = 0; k < n2_; k++)
+                conv2Cell(i, j, k);
+    head(out);
+    last_cells_ = n1_ * n1_ * n1_;
+}
+
+void VoxelEncoder::update(const std::vector<VoxelFlip>& flips, float* out)
+/**
+* mark the cells of every layer whose receptive field contains a changed voxel, then recompute
+* only those, layer by layer. The head is a single small Linear and is always recomputed.
+**/
+{
+    std::vector<char> dirty1(n1_ * n1_ * n1_, 0);
+    bool changed = false;
+    for (const VoxelFlip& flip : flips)
+    {
+        if (flip.x < 0 || flip.y < 0 || flip.z < 0 || flip.x >= n0_ || flip.y >= n0_ || flip.z >= n0_)
+            continue;
+        float& voxel = voxels_[(flip.x * n0_ + flip.y) * n0_ + flip.z];
+        if (voxel == flip.value)
+            continue;
+        voxel = flip.value;
+        changed = true;
+        // a fractional occupancy leaves the packed grid, the dense conv gives the same sums for the rest
+        if (flip.value != 0.f && flip.value != 1.f)
+            binary_ = false;
+        if (binary_)
+            setBit(flip.x, flip.y, flip.z, flip.value == 1.f);
+        int xlo, xhi, ylo, yhi, zlo, zhi;
+        affectedRange(flip.x, k1_, s1_, n1_, xlo, xhi);
+        affectedRange(flip.y, k1_, s1_, n1_, ylo, yhi);
+        affectedRange(flip.z, k1_, s1_, n1_, zlo, zhi);
+        for (int i = xlo; i <= xhi; i++)
+            for (int j = ylo; j <= yhi; j++)
+                for (int k = zlo; k <= zhi; k++)
+                    dirty1[(i * n1_ + j) * n1_ + k] = 1;
+    }
+    last_cells_ = 0;
+    if (!changed)
+    {
+        head(out);
+        return;
+    }
+
+    std::vector<char> dirtyp(np_ * np_ * np_, 0);
+    for (int i = 0; i < n1_; i++)
+        for (int j = 0; j < n1_; j++)
+            for (int k = 0; k < n1_; k++)
+            {
+                if (!dirty1[(i * n1_ + j) * n1_ + k])
+                    continue;
+                conv1Cell(i, j, k);
+                last_cells_ += 1;
+                // cells past the last full pooling window are dropped by MaxPool3d
+                if (i / pool_ < np_ && j / pool_ < np_ && k / pool_ < np_)
+                    dirtyp[((i / pool_) * np_ + j / pool_) * np_ + k / pool_] = 1;
+            }
+
+    std::vector<char> dirty2(n2_ * n2_ * n2_, 0);
+    for (int i = 0; i < np_; i++)
+        for (int j = 0; j < np_; j++)
+            for (int k = 0; k < np_; k++)
+            {
+                if (!dirtyp[(i * np_ + j) * np_ + k])
+                    continue;
+                poolCell(i, j, k);
+                int xlo, xhi, ylo, yhi, zlo, zhi;
+                affectedRange(i, k2_, s2_, n2_, xlo, xhi);
+                affectedRange(j, k2_, s2_, n2_, ylo, yhi);
+                affectedRange(k, k2_, s2_, n2_, zlo, zhi);
+                for (int a = xlo; a <= xhi; a++)
+                    for (int b = ylo; b <= yhi; b++)
+                        for (int c = zlo; c <= zhi; c++)
+                            dirty2[(a * n2_ + b) * n2_ + c] = 1;
+            }
+
+    for (int i = 0; i < n2_; i++)
+        for (int j = 0; j < n2_; j++)
+            for (int k = 0; k < n2_; k++)
+            {
+                if (dirty2[(i * n2_ + j) * n2_ + k])
+                    conv2Cell(i, j, k);
+            }
+    head(out);
+}
+
+void VoxelEncoder::conv1Cell(int i, int j, int k)
+{
+    if (packed_ && binary_)
+    {
+        conv1CellPacked(i, j, k);
+        return;
+    }
+    int cell = n1_ * n1_ * n1_;
+    for (int c = 0; c < c1_; c++)
+    {
+        const float* w = &w1_[c * k1_ * k1_ * k1_];
+        float acc = b1_[c];
+        for (int a = 0; a < k1_; a++)
+            for (int b = 0; b < k1_; b++)
+            {
+                const float* v = &voxels_[((s1_ * i + a) * n0_ + s1_ * j + b) * n0_ + s1_ * k];
+                const float* wr = &w[(a * k1_ + b) * k1_];
+                for (int d = 0; d < k1_; d++)
+                    acc += wr[d] * v[d];
+            }
+        act1_[c * cell + (i * n1_ + j) * n1_ + k] = prelu(a1_, c, acc);
+    }
+}
+
+void VoxelEncoder::conv1CellPacked(int i, int j, int k)
+/**
+* the occupied voxels of the window in the order of conv1Cell, so that every channel adds the
+* same nonzero terms in the same order
+**/
+{
+    int cell = n1_ * n1_ * n1_;
+    float* acc = acc_.data();
+    std::copy(b1_.begin(), b1_.end(), acc);
+    for (int a = 0; a < k1_; a++)
+        for (int b = 0; b < k1_; b++)
+        {
+            uint64_t window = rowBits(s1_ * i + a, s1_ * j + b, s1_ * k, k1_);
+            for (int d = 0; window != 0; d++, window >>= 1)
+            {
+                if (!(window & 1))
+                    continue;
+                const float* w = &w1t_[((a * k1_ + b) * k1_ + d) * c1_];
+                for (int c = 0; c < c1_; c++)
+                    acc[c] += w[c];
+            }
+        }
+    for (int c = 0; c < c1_; c++)
+        act1_[c * cell + (i * n1_ + j) * n1_ + k] = prelu(a1_, c, acc[c]);
+}
+
+uint64_t VoxelEncoder::rowBits(int x, int y, int z, int count) const
+{
+    const uint64_t* row = &bits_[(x * n0_ + y) * row_words_];
+    int word = z / 64;
+    int shift = z % 64;
+    uint64_t bits = row[word] >> shift;
+    if (shift > 0 && shift + count > 64 && word + 1 < row_words_)
+        bits |= row[word + 1] << (64 - shift);
+    return count < 64 ? bits & ((uint64_t(1) << count) - 1) : bits;
+}
+
+void VoxelEncoder::setBit(int x, int y, int z, bool occupied)
+{
+    uint64_t& word = bits_[(x * n0_ + y) * row_words_ + z / 64];
+    uint64_t mask = uint64_t(1) << (z % 64);
+    word = occupied ? word | mask : word & ~mask;
+}
+
+void VoxelEncoder::poolCell(int i, int j, int k)
+{
+    int cell1 = n1_ * n1_ * n1_;
+    int cellp = np_ * np_ * np_;
+    for (int c = 0; c < c1_; c++)
+    {
+        float m = -std::numeric_limits<float>::infinity();
+        for (int a = 0; a < pool_; a++)
+            for (int b = 0; b < pool_; b++)
+                for (int d = 0; d < pool_; d++)
+                    m = std::max(m, act1_[c * cell1 + ((pool_ * i + a) * n1_ + pool_ * j + b) * n1_ + pool_ * k + d]);
+        pooled_[c * cellp + (i * np_ + j) * np_ + k] = m;
+    }
+}
+
+void VoxelEncoder::conv2Cell(int i, int j, int k)
+{
+    int cellp = np_ * np_ * np_;
+    int cell2 = n2_ * n2_ * n2_;
+    int ksize = k2_ * k2_ * k2_;
+    // every channel sums over (ci, a, b, d) in this order, one input at a time for all channels
+    float* acc = acc_.data();
+    std::copy(b2_.begin(), b2_.end(), acc);
+    for (int ci = 0; ci < c1_; ci++)
+    {
+        const float* w = &w2t_[ci * ksize * c2_];
+        const float* p = &pooled_[ci * cellp];
+        for (int a = 0; a < k2_; a++)
+            for (int b = 0; b < k2_; b++)
+                for (int d = 0; d < k2_; d++)
+                {
+                    float v = p[((s2_ * i + a) * np_ + s2_ * j + b) * np_ + s2_ * k + d];
+                    const float* wc = &w[((a * k2_ + b) * k2_ + d) * c2_];
+                    for (int c = 0; c < c2_; c++)
+                        acc[c] += wc[c] * v;
+                }
+    }
+    for (int c = 0; c < c2_; c++)
+        act2_[c * cell2 + (i * n2_ + j) * n2_ + k] = prelu(a2_, c, acc[c]);
+}
+
+void VoxelEncoder::head(float* out) const
+{
+    // act2_ is laid out as x.view(N, -1) flattens the conv output
+    int in = act2_.size();
+    for (int o = 0; o < head_out_; o++)
+    {
+        const float* w = &wh_[o * in];
+        float acc = 0.f;
+        for (int k = 0; k < in; k++)
+            acc += w[k] * act2_[k];
+        out[o] = acc + bh_[o];
+    }
+}
@@ -0,0 +1,251 @@
+/**
+# build the obstacle occupancy grid of the encoder from meshes or point clouds
+**/
+
+#include "mpnet_voxelizer.hpp"
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+Voxelizer::Voxelizer(const std::vector<float>& lower_bound, const std::vector<float>& upper_bound, int grid_size,
+                     int threads)
+  : lower_(lower_bound)
+  , upper_(upper_bound)
+  , resolution_(3)
+  , n_(grid_size)
+  , threads_(threads)
+{
+    for (int i = 0; i < 3; i++)
+        resolution_[i] = ((double)upper_[i] - lower_[i]) / n_;
+    if (threads_ <= 0)
+        threads_ = std::max(1u, std::thread::hardware_concurrency());
+    threads_ = std::min(threads_, n_);
+}
+
+template <typename Fill>
+void Voxelizer::parallelSlabs(const Fill& fill) const
+{
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads_; t++)
+    {
+        int x_begin = n_ * t / threads_;
+        int x_end = n_ * (t + 1) / threads_;
+        workers.emplace_back([&fill, t, x_begin, x_end]() { fill(t, x_begin, x_end); });
+    }
+    for (auto& worker : workers)
+        worker.join();
+}
+
+template <typename Range>
+std::vector<std::vector<std::vector<int>>> Voxelizer::bucketBySlab(std::size_t count, const Range& range) const
+{
+    std::vector<int> slab_of(n_);
+    for (int t = 0; t < threads_; t++)
+        for (int i = n_ * t / threads_; i < n_ * (t + 1) / threads_; i++)
+            slab_of[i] = t;
+    std::vector<std::vector<std::vector<int>>> buckets(threads_, std::vector<std::vector<int>>(threads_));
+    // the threads split the input here, not the grid
+    parallelSlabs([&](int part, int, int) {
+        std::size_t begin = count * part / threads_;
+        std::size_t end = count * (part + 1) / threads_;
+        for (std::size_t idx = begin; idx < end; idx++)
+        {
+            int lo, hi;
+            int value = range(idx, lo, hi);
+            if (value < 0)
+                continue;
+            for (int slab = slab_of[lo]; slab <= slab_of[hi]; slab++)
+                buckets[part][slab].push_back(value);
+        }
+    });
+    return buckets;
+}
+
+int Voxelizer::cell(float p, int axis) const
+{
+    // same as the offline voxelize(): cells are half open, the upper bound itself is outside
+    double offset = (double)p - lower_[axis];
+    if (offset < 0. || offset >= (double)n_ * resolution_[axis])
+        return -1;
+    return std::min(n_ - 1, (int)(offset / resolution_[axis]));
+}
+
+std::vector<float> Voxelizer::fromPointCloud(const std::vector<Point3>& points) const
+{
+    std::vector<float> voxels(n_ * n_ * n_, 0.f);
+    // the points are bucketed as the index of their voxel
+    auto buckets = bucketBySlab(points.size(), [&](std::size_t idx, int& lo, int& hi) {
+        const Point3& p = points[idx];
+        lo = hi = cell(p[0], 0);
+        int j = cell(p[1], 1);
+        int k = cell(p[2], 2);
+        return lo < 0 || j < 0 || k < 0 ? -1 : (lo * n_ + j) * n_ + k;
+    });
+    parallelSlabs([&](int slab, int, int) {
+        for (const auto& part : buckets)
+            for (int voxel : part[slab])
+                voxels[voxel] = 1.f;
+    });
+    return voxels;
+}
+
+std::vector<float> Voxelizer::fromTriangles(const std::vector<Triangle3>& triangles) const
+{
+    std::vector<float> voxels(n_ * n_ * n_, 0.f);
+    auto buckets = bucketBySlab(triangles.size(), [&](std::size_t idx, int& x_lo, int& x_hi) {
+        int lo[3], hi[3];
+        if (!triangleCells(triangles[idx], lo, hi))
+            return -1;
+        x_lo = lo[0];
+        x_hi = hi[0];
+        return (int)idx;
+    });
+    parallelSlabs([&](int slab, int x_begin, int x_end) {
+        for (const auto& part : buckets)
+            for (int idx : part[slab])
+            {
+                const Triangle3& tri = triangles[idx];
+                // cell range of the triangle bounding box, clipped to this slab
+                int lo[3], hi[3];
+                triangleCells(tri, lo, hi);
+                lo[0] = std::max(lo[0], x_begin);
+                hi[0] = std::min(hi[0], x_end - 1);
+                for (int i = lo[0]; i <= hi[0]; i++)
+                    for (int j = lo[1]; j <= hi[1]; j++)
+                        for (int k = lo[2]; k <= hi[2]; k++)
+                        {
+                            float& voxel = voxels[(i * n_ + j) * n_ + k];
+                            if (voxel == 0.f && triangleOverlapsCell(tri, i, j, k))
+                                voxel = 1.f;
+                        }
+            }
+    });
+    return voxels;
+}
+
+bool Voxelizer::triangleCells(const Triangle3& tri, int* lo, int* hi) const
+{
+    for (int a = 0; a < 3; a++)
+    {
+        float tmin = std::min({tri[0][a], tri[1][a], tri[2][a]});
+        float tmax = std::max({tri[0][a], tri[1][a], tri[2][a]});
+        if (tmax < lower_[a] || tmin > upper_[a])
+            return false;
+        lo[a] = std::max(0, (int)std::floor((tmin - lower_[a]) / resolution_[a]));
+        hi[a] = std::min(n_ - 1, (int)std::floor((tmax - lower_[a]) / resolution_[a]));
+        // a triangle touching the upper bound only
+        if (lo[a] > hi[a])
+            return false;
+    }
+    return true;
+}
+
+bool Voxelizer::triangleOverlapsCell(const Triangle3& tri, int i, int j, int k) const
+/**
+* separating axis test between the triangle and the cell box: the three box normals,
+* the triangle normal and the nine edge cross products
+**/
+{
+    int idx[3] = {i, j, k};
+    double half[3], v[3][3];
+    for (int a = 0; a < 3; a++)
+    {
+        half[a] = resolution_[a] / 2;
+        double center = lower_[a] + (idx[a] + 0.5) * resolution_[a];
+        for (int p = 0; p < 3; p++)
+            v[p][a] = tri[p][a] - center;
+    }
+    double e[3][3];
+    for (int a = 0; a < 3; a++)
+    {
+        e[0][a] = v[1][a] - v[0][a];
+        e[1][a] = v[2][a] - v[1][a];
+        e[2][a] = v[0][a] - v[2][a];
+    }
+    auto separated = [&](const double* axis) {
+        double r = half[0] * std::fabs(axis[0]) + half[1] * std::fabs(axis[1]) + half[2] * std::fabs(axis[2]);
+        double pmin = std::numeric_limits<double>::infinity();
+        double pmax = -pmin;
+        for (int p = 0; p < 3; p++)
+        {
+            double d = v[p][0] * axis[0] + v[p][1] * axis[1] + v[p][2] * axis[2];
+            pmin = std::min(pmin, d);
+            pmax = std::max(pmax, d);
+        }
+        return pmin > r || pmax < -r;
+    };
+    for (int a = 0; a < 3; a++)
+    {
+        double axis[3] = {0., 0., 0.};
+        axis[a] = 1.;
+        if (separated(axis))
+            return false;
+    }
+    double normal[3] = {e[0][1] * e[1][2] - e[0][2] * e[1][1], e[0][2] * e[1][0] - e[0][0] * e[1][2],
+                        e[0][0] * e[1][1] - e[0][1] * e[1][0]};
+    if (separated(normal))
+        return false;
+    for (int a = 0; a < 3; a++)
+        for (int p = 0; p < 3; p++)
+        {
+            // cross product of the box axis a and the triangle edge p
+            double axis[3] = {0., 0., 0.};
+            axis[(a + 1) % 3] = -e[p][(a + 2) % 3];
+            axis[(a + 2) % 3] = e[p][(a + 1) % 3];
+            if (separated(axis))
+                return false;
+        }
+    return true;
+}
+
+bool Voxelizer::loadMesh(const std::string& fname, std::vector<Triangle3>& triangles)
+{
+    Assimp::Importer importer;
+    const aiScene* scene = importer.ReadFile(fname, aiProcess_Triangulate | aiProcess_PreTransformVertices);
+    if (scene == nullptr)
+        return false;
+    for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+    {
+        const aiMesh* mesh = scene->mMeshes[m];
+        for (unsigned int f = 0; f < mesh->mNumFaces; f++)
+        {
+            const aiFace& face = mesh->mFaces[f];
+            if (face.mNumIndices != 3)
+                continue;
+            Triangle3 tri;
+            for (int p = 0; p < 3; p++)
+            {
+                const aiVector3D& vertex = mesh->mVertices[face.mIndices[p]];
+                tri[p] = {vertex.x, vertex.y, vertex.z};
+            }
+            triangles.push_back(tri);
+        }
+    }
+    return true;
+}
+
+void Voxelizer::pointBounds(const std::vector<Point3>& points, std::vector<float>& lower, std::vector<float>& upper)
+{
+    lower.assign(3, std::numeric_limits<float>::infinity());
+    upper.assign(3, -std::numeric_limits<float>::infinity());
+    for (const Point3& p : points)
+        for (int a = 0; a < 3; a++)
+        {
+            lower[a] = std::min(lower[a], p[a]);
+            upper[a] = std::max(upper[a], p[a]);
+        }
+}
+
+void Voxelizer::triangleBounds(const std::vector<Triangle3>& triangles, std::vector<float>& lower,
+                               std::vector<float>& upper)
+{
+    std::vector<Point3> points;
+    points.reserve(3 * triangles.size());
+    for (const Triangle3& tri : triangles)
+        points.insert(points.end(), tri.begin(), tri.end());
+    pointBounds(points, lower, upper);
+}
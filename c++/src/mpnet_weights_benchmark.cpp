@@ -0,0 +1,184 @@
+/**
+* Memory and startup time of N planner processes loading the MPNet MLP: the native weight file
+* mapped and shared (default), the same file read into private memory (--copy), or the TorchScript
+* MLP loaded by every process (--torchscript=<mlp>). The processes are started together, each loads
+* the network and runs some predictions, then reports its startup time, RSS and PSS (the share of
+* the shared pages it is charged for) while all of them are still alive.
+**/
+#include "mpnet_mapped_weights.hpp"
+#include "mpnet_quantized_mlp.hpp"
+
+#include <torch/script.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    struct Sample
+    {
+        double startup{0.};
+        long rss_kb{-1};
+        long rss_anon_kb{-1};
+        long rss_file_kb{-1};
+        long pss_kb{-1};
+    };
+
+    /** \brief value in kB of the line starting with \e key in a /proc file, -1 if there is none */
+    long procValue(const std::string& fname, const std::string& key)
+    {
+        std::ifstream infile(fname);
+        std::string line;
+        while (getline(infile, line))
+        {
+            if (line.compare(0, key.size(), key) == 0)
+                return std::stol(line.substr(key.size()));
+        }
+        return -1;
+    }
+
+    Sample measure(double startup)
+    {
+        Sample sample;
+        sample.startup = startup;
+        sample.rss_kb = procValue("/proc/self/status", "VmRSS:");
+        sample.rss_anon_kb = procValue("/proc/self/status", "RssAnon:");
+        sample.rss_file_kb = procValue("/proc/self/status", "RssFile:");
+        sample.pss_kb = procValue("/proc/self/smaps_rollup", "Pss:");
+        return sample;
+    }
+
+    /** \brief load the network as a planner process would, run \e predictions forwards and measure
+        the memory while the network is still loaded */
+    Sample loadAndPredict(const std::string& weights_fname, bool copy, const std::string& torchscript_fname,
+                          int predictions)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        std::mt19937 gen(getpid());
+        if (!torchscript_fname.empty())
+        {
+            torch::jit::script::Module mlp = torch::jit::load(torchscript_fname);
+            torch::NoGradGuard no_grad;
+            std::vector<torch::jit::IValue> inputs = {torch::zeros({1, 78})};
+            for (int i = 0; i < predictions; i++)
+                mlp.forward(inputs);
+            return measure(std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+        }
+        auto weights = std::make_shared<MappedWeights>(weights_fname, copy);
+        QuantizedMLP mlp(weights);
+        std::size_t obs_size = 0;
+        mlp.setEnvironmentEncoding(weights->getFloat("env.obs_enc", &obs_size));
+        std::uniform_real_distribution<float> uniform(-1.f, 1.f);
+        std::vector<float> sg(mlp.inputSize() - obs_size), out(mlp.outputSize());
+        for (int i = 0; i < predictions; i++)
+        {
+            for (float& v : sg)
+                v = uniform(gen);
+            mlp.forward(sg.data(), out.data(), gen);
+        }
+        return measure(std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+    }
+}
+
+int main(int argc, char** argv)
+{
+    // command line options:
+    //   --weights=<file>      native weight file (home_ompl --int8 --weights=<file> writes it)
+    //   --processes=<n>       processes started together
+    //   --copy                read the weight file into private memory instead of mapping it
+    //   --torchscript=<mlp>   load this TorchScript MLP in every process instead
+    //   --predictions=<k>     predictions run by every process after loading
+    std::string weights_fname = "../mpnet_weights.bin";
+    std::string torchscript_fname = "";
+    int n_processes = 1;
+    int predictions = 100;
+    bool copy = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (arg.compare(0, 10, "--weights=") == 0)
+            weights_fname = arg.substr(10);
+        else if (arg.compare(0, 12, "--processes=") == 0)
+            n_processes = std::stoi(arg.substr(12));
+        else if (arg == "--copy")
+            copy = true;
+        else if (arg.compare(0, 14, "--torchscript=") == 0)
+            torchscript_fname = arg.substr(14);
+        else if (arg.compare(0, 14, "--predictions=") == 0)
+            predictions = std::stoi(arg.substr(14));
+    }
+
+    // every child writes its sample to \e results, then waits until \e release is closed
+    int results[2], release[2];
+    if (pipe(results) != 0 || pipe(release) != 0)
+    {
+        std::cout << "could not create the pipes" << std::endl;
+        return 1;
+    }
+    std::vector<pid_t> children;
+    for (int p = 0; p < n_processes; p++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(results[0]);
+            close(release[1]);
+            Sample sample;
+            try
+            {
+                sample = loadAndPredict(weights_fname, copy, torchscript_fname, predictions);
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << e.what() << std::endl;
+                sample.startup = -1.;
+            }
+            if (write(results[1], &sample, sizeof(sample)) != sizeof(sample))
+                _exit(1);
+            char c;
+            while (read(release[0], &c, 1) > 0)
+                ;
+            _exit(0);
+        }
+        children.push_back(pid);
+    }
+    close(results[1]);
+    close(release[0]);
+    std::vector<Sample> samples;
+    Sample sample;
+    while (samples.size() < children.size() && read(results[0], &sample, sizeof(sample)) == sizeof(sample))
+        samples.push_back(sample);
+    close(release[1]);
+    for (pid_t pid : children)
+        waitpid(pid, nullptr, 0);
+
+    Sample total;
+    total.rss_kb = total.rss_anon_kb = total.rss_file_kb = total.pss_kb = 0;
+    double max_startup = 0.;
+    for (const Sample& s : samples)
+    {
+        if (s.startup < 0.)
+        {
+            std::cout << "a process could not load the network" << std::endl;
+            return 1;
+        }
+        total.startup += s.startup / samples.size();
+        max_startup = std::max(max_startup, s.startup);
+        total.rss_kb += s.rss_kb;
+        total.rss_anon_kb += s.rss_anon_kb;
+        total.rss_file_kb += s.rss_file_kb;
+        total.pss_kb += s.pss_kb;
+    }
+    std::string mode = !torchscript_fname.empty() ? "torchscript" : copy ? "copied" : "mapped";
+    std::cout << samples.size() << " processes, " << mode << " weights: startup mean " << total.startup << "s, max "
+              << max_startup << "s; RSS total " << total.rss_kb / 1024. << " MB (anonymous " << total.rss_anon_kb / 1024.
+              << " MB, file " << total.rss_file_kb / 1024. << " MB), PSS total " << total.pss_kb / 1024. << " MB"
+              << std::endl;
+    return 0;
+}
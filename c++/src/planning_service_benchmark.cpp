@@ -0,0 +1,190 @@
+/**
+* Load generator for the planning service: throughput and latency of concurrent queries with a
+* shared batched MLP, against one independent planner per client thread.
+**/
+#include <omplapp/apps/SE3RigidBodyPlanning.h>
+#include <omplapp/config.h>
+#include "mpnet_planner.hpp"
+#include "mpnet_planning_service.hpp"
+
+#include <torch/torch.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <chrono>
+typedef std::chrono::high_resolution_clock Time;
+typedef std::chrono::duration<float> fsec;
+
+#define STATE_N 7
+
+using namespace ompl;
+
+namespace
+{
+    std::vector<PlanningQuery> loadQueries(const std::string& path_dir, int first, int n)
+    {
+        std::vector<PlanningQuery> queries;
+        for (int path_idx = first; path_idx < first + n; path_idx++)
+        {
+            std::ifstream infile(path_dir + "path_" + std::to_string(path_idx) + ".txt");
+            std::string line;
+            std::vector<std::vector<float>> path;
+            while (getline(infile, line))
+            {
+                if (line.empty())
+                    continue;
+                std::vector<float> state(STATE_N);
+                std::stringstream ss(line);
+                for (int i = 0; i < STATE_N; i++)
+                    ss >> state[i];
+                path.push_back(state);
+            }
+            if (path.size() < 2)
+                continue;
+            PlanningQuery query;
+            query.start = path.front();
+            query.goal = path.back();
+            queries.push_back(query);
+        }
+        return queries;
+    }
+
+    void report(const std::string& name, const std::vector<PlanningResult>& results, float total_time)
+    {
+        std::vector<float> latencies;
+        int exact = 0;
+        for (const PlanningResult& result : results)
+        {
+            latencies.push_back(result.latency);
+            exact += result.exact;
+        }
+        std::sort(latencies.begin(), latencies.end());
+        float mean = 0.;
+        for (float latency : latencies)
+            mean += latency / latencies.size();
+        std::cout << name << ": " << results.size() / total_time << " queries/s, latency mean " << mean << "s, p50 "
+                  << latencies[latencies.size() / 2] << "s, p95 " << latencies[latencies.size() * 95 / 100]
+                  << "s, exact " << exact << "/" << results.size() << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    // command line options:
+    //   --paths=<dir>        directory of the path_<i>.txt files the queries are taken from
+    //   --first=<i>          index of the first path file
+    //   --queries=<n>        number of queries
+    //   --clients=<n>        concurrent clients, each waits for its query before sending the next
+    //   --max-batch=<a,b,..> batch sizes of the service runs
+    //   --max-wait-us=<us>   longest wait of the first input of a batch
+    std::string path_dir = "/media/arclabdl1/HD1/YLmiao/data/home/paths/";
+    int first = 2196;
+    int n_queries = 100;
+    int clients = 8;
+    std::vector<int> max_batches = {1, 8, 32};
+    int max_wait_us = 500;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (arg.compare(0, 8, "--paths=") == 0)
+            path_dir = arg.substr(8);
+        else if (arg.compare(0, 8, "--first=") == 0)
+            first = std::stoi(arg.substr(8));
+        else if (arg.compare(0, 10, "--queries=") == 0)
+            n_queries = std::stoi(arg.substr(10));
+        else if (arg.compare(0, 10, "--clients=") == 0)
+            clients = std::stoi(arg.substr(10));
+        else if (arg.compare(0, 12, "--max-batch=") == 0)
+        {
+            max_batches.clear();
+            std::stringstream ss(arg.substr(12));
+            std::string item;
+            while (getline(ss, item, ','))
+                max_batches.push_back(std::stoi(item));
+        }
+        else if (arg.compare(0, 14, "--max-wait-us=") == 0)
+            max_wait_us = std::stoi(arg.substr(14));
+    }
+
+    std::vector<PlanningQuery> queries = loadQueries(path_dir, first, n_queries);
+    if (queries.empty())
+    {
+        std::cout << "no queries found in " << path_dir << std::endl;
+        return 1;
+    }
+    std::cout << queries.size() << " queries, " << clients << " clients" << std::endl;
+
+    std::string robot_fname = std::string(OMPLAPP_RESOURCE_DIR) + "/3D/Home_robot.dae";
+    std::string env_fname = std::string(OMPLAPP_RESOURCE_DIR) + "/3D/Home_env.dae";
+    auto make_setup = [&]() {
+        auto setup = std::make_shared<app::SE3RigidBodyPlanning>();
+        setup->setRobotMesh(robot_fname);
+        setup->setEnvironmentMesh(env_fname);
+        setup->getSpaceInformation()->setStateValidityCheckingResolution(0.01);
+        return std::static_pointer_cast<geometric::SimpleSetup>(setup);
+    };
+
+    // one planner per client thread, every prediction is a batch-1 forward of its own MLP
+    {
+        std::vector<geometric::SimpleSetupPtr> setups;
+        for (int c = 0; c < clients; c++)
+        {
+            geometric::SimpleSetupPtr setup = make_setup();
+            setup->setPlanner(base::PlannerPtr(new MPNetPlanner(setup->getSpaceInformation(), false, 1001, 3000)));
+            setup->setup();
+            setups.push_back(setup);
+        }
+        std::vector<PlanningResult> results(queries.size());
+        std::atomic<int> next(0);
+        auto t0 = Time::now();
+        std::vector<std::thread> threads;
+        for (int c = 0; c < clients; c++)
+        {
+            threads.emplace_back([&, c]() {
+                for (int q = next++; q < queries.size(); q = next++)
+                {
+                    results[q] = PlanningService::solve(*setups[c], queries[q]);
+                    results[q].latency = results[q].plan_time;
+                }
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+        report("planner per thread", results, fsec(Time::now() - t0).count());
+    }
+
+    for (int max_batch : max_batches)
+    {
+        PlanningService::Options options;
+        options.workers = clients;
+        options.batching.max_batch = max_batch;
+        options.batching.max_wait_us = max_wait_us;
+        options.batching.device = torch::cuda::is_available() ? at::kCUDA : at::kCPU;
+        PlanningService service(make_setup, options);
+
+        std::vector<PlanningResult> results(queries.size());
+        std::atomic<int> next(0);
+        auto t0 = Time::now();
+        std::vector<std::thread> threads;
+        for (int c = 0; c < clients; c++)
+        {
+            threads.emplace_back([&]() {
+                for (int q = next++; q < queries.size(); q = next++)
+                    results[q] = service.submit(queries[q]).get();
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+        float total_time = fsec(Time::now() - t0).count();
+        report("service, max batch " + std::to_string(max_batch), results, total_time);
+        std::cout << "    " << service.mlp().forwards() << " forwards, mean batch "
+                  << (float)service.mlp().requests() / std::max(1L, service.mlp().forwards()) << std::endl;
+    }
+    return 0;
+}
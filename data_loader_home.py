@@ -144,6 +144,29 @@ def load_dataset(N=1,NP=4000,folder='../data/simple/',s=0):
     # dataset and targets are both list
     # here the first item of data is index in obs
     # return obs, list(zip(*data))
+
+
+def load_packed_paths(fname, env_id=0):
+    # load the paths of env_id from a packed dataset written by c++/mpnet_datagen
+    # returns {path index: path}, leaving out the unsolved (shorter than 2 states) ones
+    paths = {}
+    with open(fname, 'rb') as f:
+        data = f.read()
+    if data[:4] != b'MPPD' or np.frombuffer(data, dtype=np.int32, count=1, offset=4)[0] != 1:
+        return paths
+    offset = 8
+    while offset + 12 <= len(data):
+        env, index, n = np.frombuffer(data, dtype=np.int32, count=3, offset=offset)
+        if offset + 12 + n*7*4 > len(data):
+            # incomplete last record of an interrupted run
+            break
+        path = np.frombuffer(data, dtype=np.float32, count=n*7, offset=offset+12).reshape(n, 7)
+        offset += 12 + n*7*4
+        if env == env_id and n >= 2:
+            paths[int(index)] = path
+    return paths
+
+
 def load_train_dataset(N=100,NP=4000,folder='../data/simple/',s=0):
     # load data as [path]
     # for each path, it is